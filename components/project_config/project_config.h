@@ -22,5 +22,13 @@
 // COLUMN AND ROW PINS USED FOR THE KEYPAD LOGIC
 #define KEYPAD_ROW_PINS {GPIO_NUM_26, GPIO_NUM_25, GPIO_NUM_17, GPIO_NUM_16}
 #define KEYPAD_COL_PINS {GPIO_NUM_27, GPIO_NUM_14, GPIO_NUM_12, GPIO_NUM_13}
+#define KEYPAD_KEY_MAP  {"123A", "456B", "789C", "*0#D"}
+
+// OFFLINE PAYMENTS. SIGNED PAYMENTS ARE STORED WHILE WI-FI IS DOWN AND SENT WHEN IT RETURNS
+// NEEDS CONFIG_NVS_ENCRYPTION, THE STORED PAYMENTS HOLD CARD NUMBERS AND PIN DIGESTS
+#define PLUTO_OFFLINE_MODE_ENABLED  0
+
+// PAYMENT BODY ENCODING. 1 SENDS CBOR (application/cbor) INSTEAD OF JSON, THE SERVER HAS TO ACCEPT BOTH
+#define PLUTO_PAYMENT_ENCODING_CBOR 0
 
 #endif
\ No newline at end of file
@@ -0,0 +1,68 @@
+#ifndef CLOCK_DISCIPLINE_H_
+#define CLOCK_DISCIPLINE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define CLOCK_MAX_RATE_PPM  500     // Anything above is a bad sample, not a crystal
+
+/*
+    Where the clock was last set from, in increasing order of trust.
+*/
+typedef enum {
+    CLOCK_SOURCE_NONE,
+    CLOCK_SOURCE_STORED,        // time of the last sync kept in NVS
+    CLOCK_SOURCE_HTTP_DATE,     // Date header of a payment response, 1 s resolution
+    CLOCK_SOURCE_SNTP
+} clock_source_t;
+
+typedef struct {
+    clock_source_t source;
+    uint32_t sntp_syncs;
+    uint32_t date_corrections;      // Date headers that moved the clock
+    int32_t last_correction_ms;     // how far the clock was off at the last correction
+    int32_t rate_ppm;               // measured between the last two SNTP syncs, 0 until there were two
+} clock_discipline_stats_t;
+
+/**
+ * Current time in us since the epoch, from esp_timer and the disciplined offset and rate.
+ * Safe from any task. Before any source was applied it is the system time.
+ */
+int64_t clock_now_us();
+
+static inline time_t clock_now() {
+    return (time_t)(clock_now_us() / 1000000);
+}
+
+/**
+ * Takes an exact time read at esp_timer time mono_us, from SNTP or NVS.
+ * Two SNTP syncs in a row also set the rate the clock runs at between corrections.
+ */
+void clock_discipline_set(int64_t wall_us, int64_t mono_us, clock_source_t source);
+
+/**
+ * Checks the clock against the Date header of a response to a request sent at sent_us and answered
+ * at received_us, both esp_timer times. The clock is only moved when it is outside what the
+ * header allows, and then just far enough to be inside it, so a good SNTP time is never made worse.
+ *
+ * @return true if the clock was corrected.
+ */
+bool clock_discipline_http_date(time_t date, int64_t sent_us, int64_t received_us);
+
+/**
+ * Days from 1970-01-01 to a proleptic Gregorian date, negative before it. month is 1 to 12.
+ */
+int64_t clock_days_from_civil(int year, int month, int day);
+
+/**
+ * Reads an IMF-fixdate, "Sun, 06 Nov 1994 08:49:37 GMT", to epoch seconds.
+ */
+bool clock_parse_http_date(const char *value, size_t len, time_t *out);
+
+clock_source_t clock_discipline_source();
+void clock_discipline_get_stats(clock_discipline_stats_t *out);
+void clock_discipline_log_stats();
+
+#endif
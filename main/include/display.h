@@ -0,0 +1,76 @@
+#ifndef DISPLAY_H_
+#define DISPLAY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "driver/i2c_master.h"
+#include "lcd_framebuffer.h"
+
+#define DISPLAY_TASK_STACK_DEPTH    3072
+#define DISPLAY_TASK_PRIORITY       4
+#define DISPLAY_SPINNER_PERIOD_MS   150
+
+typedef struct display *display_handle_t;
+
+typedef struct {
+    uint32_t commands;
+    uint32_t collapsed;         // commands whose frame was never drawn because a newer one followed
+    int64_t latency_total_us;   // command posted to lcd written
+    int64_t latency_max_us;
+    uint32_t latency_count;
+} display_stats_t;
+
+/**
+ * Starts the display task, which owns dev from here on. Nothing else may write to the lcd.
+ * The lcd must be initialized by lcd_1602_init.
+ */
+esp_err_t display_start(display_handle_t *out, i2c_master_dev_handle_t dev);
+
+/**
+ * Stops the task and waits for it, after that dev can be removed.
+ */
+void display_stop(display_handle_t display);
+
+/*
+    Render commands. All of them only change the state the screen should show and return at once,
+    false only without a display. The task draws the newest state when it wakes, so a burst of
+    commands costs a single lcd write.
+*/
+
+/**
+ * Replaces the screen and ends any toast or spinner.
+ */
+bool display_frame(display_handle_t display, const lcd_frame_t *frame);
+
+/**
+ * Replaces the screen with text laid out by lcd_frame_layout.
+ */
+bool display_text(display_handle_t display, const char *text);
+
+/**
+ * Replaces one row of the screen, the rest is left as it is.
+ */
+bool display_line(display_handle_t display, uint8_t row, const char *text);
+
+/**
+ * Shows text over the screen for duration_ms, then the screen again with any changes made meanwhile.
+ */
+bool display_toast(display_handle_t display, const char *text, uint32_t duration_ms);
+
+/**
+ * Turns the spinner in the given cell on or off.
+ */
+bool display_spinner(display_handle_t display, uint8_t row, uint8_t col, bool on);
+
+/**
+ * Blanks the screen with the lcd's clear command.
+ */
+bool display_clear(display_handle_t display);
+
+/**
+ * Logs the display and lcd counters from the display task, then resets them.
+ */
+bool display_log_stats(display_handle_t display);
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef EVENT_BUS_H_
+#define EVENT_BUS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "pluto_events.h"
+
+typedef enum {
+    EVENT_POLICY_DROP_NEWEST,   // a full channel rejects the new event
+    EVENT_POLICY_OVERWRITE      // single slot, the new event replaces the pending one
+} event_policy_t;
+
+// At least HTTPS_REQUEST_SLOTS, checked where both are known
+#define EVENT_PAYMENT_CHANNEL_DEPTH 3
+
+/*
+    Channels as X(name, depth, policy), highest priority first. The receiver always takes
+    from the first channel holding an event. Only events of one type share an overwrite slot,
+    so an overwrite never loses anything but an outdated event of the same kind. PAYMENT has a
+    slot for every request in flight, so a payment result is never dropped.
+*/
+#define EVENT_CHANNEL_TABLE(X) \
+    X(CONNECTIVITY, 1,                              EVENT_POLICY_OVERWRITE)     \
+    X(PAYMENT,      EVENT_PAYMENT_CHANNEL_DEPTH,    EVENT_POLICY_DROP_NEWEST)   \
+    X(TIMER,        1,                              EVENT_POLICY_OVERWRITE)     \
+    X(CARD,         1,                              EVENT_POLICY_OVERWRITE)     \
+    X(SCAN_FAILED,  1,                              EVENT_POLICY_OVERWRITE)     \
+    X(KEYS,         16,                             EVENT_POLICY_DROP_NEWEST)
+
+#define EVENT_CHANNEL_ENUM(name, depth, policy) EVENT_CHANNEL_##name,
+
+typedef enum {
+    EVENT_CHANNEL_TABLE(EVENT_CHANNEL_ENUM)
+    EVENT_CHANNEL_COUNT
+} event_channel_t;
+
+typedef struct {
+    uint32_t posted;        // events accepted
+    uint32_t dropped;       // events rejected by a full channel
+    uint32_t overwritten;   // pending events replaced before they were received
+    uint32_t high_water;    // most events waiting at once
+    uint32_t depth;         // events waiting now
+} event_bus_stats_t;
+
+typedef struct event_bus *event_bus_handle_t;
+
+/**
+ * Creates the channels and the card side slot.
+ *
+ * @return ESP_OK, or ESP_ERR_NO_MEM.
+ */
+esp_err_t event_bus_create(event_bus_handle_t *out);
+
+void event_bus_destroy(event_bus_handle_t bus);
+
+/**
+ * Posts an event on the channel for its type. Never blocks, so it can be called from
+ * esp_event and esp_timer callbacks.
+ *
+ * @return false if the event was dropped.
+ */
+bool event_bus_post(event_bus_handle_t bus, const pluto_event_handle_t *event);
+
+/**
+ * Stores the card number in the side slot and posts an EV_RFID event for it.
+ */
+bool event_bus_post_card(event_bus_handle_t bus, const char *card_number);
+
+/**
+ * Waits for the next event, taking from the highest priority channel first.
+ *
+ * @return false if nothing arrived within timeout.
+ */
+bool event_bus_receive(event_bus_handle_t bus, pluto_event_handle_t *out, TickType_t timeout);
+
+/**
+ * Copies the card number of the last EV_RFID event.
+ */
+void event_bus_take_card(event_bus_handle_t bus, char *out, size_t out_size);
+
+void event_bus_get_stats(event_bus_handle_t bus, event_channel_t channel, event_bus_stats_t *out);
+
+/**
+ * Logs depth and counters of every channel.
+ */
+void event_bus_log_stats(event_bus_handle_t bus);
+
+#endif
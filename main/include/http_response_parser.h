@@ -0,0 +1,77 @@
+#ifndef HTTP_RESPONSE_PARSER_H_
+#define HTTP_RESPONSE_PARSER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define HTTP_PARSER_MAX_LINE 256
+// Largest Content-Length or chunk size accepted, far above any payment response
+#define HTTP_PARSER_MAX_BODY (64 * 1024)
+
+typedef enum {
+    HTTP_PARSE_STATUS,
+    HTTP_PARSE_HEADER,
+    HTTP_PARSE_BODY,
+    HTTP_PARSE_BODY_UNTIL_CLOSE,
+    HTTP_PARSE_CHUNK_SIZE,
+    HTTP_PARSE_CHUNK_DATA,
+    HTTP_PARSE_CHUNK_END,
+    HTTP_PARSE_TRAILER,
+    HTTP_PARSE_DONE,
+    HTTP_PARSE_ERROR
+} http_parse_state_t;
+
+/**
+ * Called for every header line. name and value point into the parser or the fed data and are
+ * only valid during the call.
+ */
+typedef void (*http_parser_header_cb)(void *ctx, const char *name, size_t name_len, const char *value, size_t value_len);
+
+/**
+ * Called with each run of body bytes, pointing straight into the fed data.
+ */
+typedef void (*http_parser_body_cb)(void *ctx, const char *data, size_t len);
+
+typedef struct {
+    http_parse_state_t state;
+    int status_code;
+    long content_length;
+    bool chunked;
+    bool keep_alive;
+    size_t remaining;
+
+    http_parser_header_cb on_header;
+    http_parser_body_cb on_body;
+    void *ctx;
+
+    // Only lines split across two reads are copied here
+    char line[HTTP_PARSER_MAX_LINE];
+    size_t line_len;
+} http_response_parser_t;
+
+void http_parser_init(http_response_parser_t *parser, http_parser_header_cb on_header, http_parser_body_cb on_body, void *ctx);
+
+/**
+ * Feeds the next bytes read from the connection. Bytes after the end of the response are not consumed.
+ *
+ * @return number of bytes consumed.
+ */
+size_t http_parser_feed(http_response_parser_t *parser, const char *data, size_t len);
+
+/**
+ * Tells the parser the connection was closed. Completes a body that is delimited by the close.
+ *
+ * @return true if the response is complete.
+ */
+bool http_parser_on_close(http_response_parser_t *parser);
+
+static inline bool http_parser_is_done(const http_response_parser_t *parser) {
+    return parser->state == HTTP_PARSE_DONE;
+}
+
+static inline bool http_parser_has_error(const http_response_parser_t *parser) {
+    return parser->state == HTTP_PARSE_ERROR;
+}
+
+#endif
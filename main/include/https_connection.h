@@ -0,0 +1,58 @@
+#ifndef HTTPS_CONNECTION_H_
+#define HTTPS_CONNECTION_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "esp_tls.h"
+
+#define HTTPS_SERVER_PORT           443
+#define HTTPS_CONNECTION_MAX_IDLE_MS 60000
+
+typedef struct {
+    uint32_t reused;        // requests sent on an already open session
+    uint32_t handshakes;    // full TLS handshakes performed
+    uint32_t resumed;       // handshakes that offered a cached TLS session
+    uint32_t stale;         // sessions found closed by the server
+    uint32_t failed;        // handshakes that did not complete
+    uint64_t handshake_us;  // total time spent in full handshakes
+    uint64_t resumed_us;    // total time spent in resumed handshakes
+} https_connection_stats_t;
+
+/**
+ * Creates the lock guarding the shared session and prepares the TLS session cache.
+ * Must be called once before any request is sent.
+ *
+ * @return ESP_OK on success.
+ */
+esp_err_t https_connection_init();
+
+/**
+ * Takes ownership of the shared session to SERVER_HOST. An open session is checked for being
+ * closed by the server and reused if still alive, otherwise a new handshake is made.
+ * Every successful call must be paired with https_connection_release.
+ *
+ * @param cfg tls configuration used if a new handshake is needed.
+ * @param reused set to true if an already open session was returned.
+ * @param tcp_connected_us set to the esp_timer time the TCP connect of a new session finished, 0 for a reused one.
+ *
+ * @return session handle or NULL if no connection could be established.
+ */
+esp_tls_t *https_connection_acquire(const esp_tls_cfg_t *cfg, bool *reused, int64_t *tcp_connected_us);
+
+/**
+ * Gives the session back to the manager.
+ *
+ * @param keep_alive false if the session is broken or the server asked to close it.
+ */
+void https_connection_release(bool keep_alive);
+
+/**
+ * Closes the shared session if one is open.
+ */
+void https_connection_close();
+
+void https_connection_get_stats(https_connection_stats_t *out);
+
+#endif
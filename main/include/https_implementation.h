@@ -4,37 +4,117 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "esp_err.h"
 #include "esp_tls.h"
+#include "payment_response.h"
 
 #include <ctype.h>
+#include <stdbool.h>
 
 #define HTTPS_TASK_STACK_DEPTH  8192
-#define HTTPS_MAX_RESPONSE_BODY_LCD 33
-#define HTTPS_MAX_URL_SIZE 255
-#define MAX_HTTPS_REQUEST_BUFFER 1024
+#define HTTPS_WORKER_PRIORITY   5
+#define HTTPS_REQUEST_SLOTS     3
+#define HTTPS_HEADER_TAIL_SIZE 128
 #define MAX_HTTPS_OUTPUT_BUFFER 1024
 #define REQUEST_BODY_SIZE 512
 #define MAX_PATH_LENGTH 128
 #define MAX_TIMEOUT_MS  5000
 
+// Longest a request can take: connect and write on a stale session, then again on a fresh one and read the answer
+#define HTTPS_REQUEST_MAX_MS    (5 * MAX_TIMEOUT_MS)
+
 typedef enum {
     GET,
     POST
 } HTTPS_REQUEST_TYPE;
 
-typedef struct {
-    char url[HTTPS_MAX_URL_SIZE];
+typedef struct https_request_args https_request_args_t;
+
+/**
+ * Called from the network task once a request is done, before the handle is released.
+ * Must not block, https_wait_for_response on the handle returns as soon as it has returned.
+ */
+typedef void (*https_done_cb_t)(https_request_args_t *request, void *ctx);
+
+struct https_request_args {
     // char path[MAX_PATH_LENGTH];
-    TaskHandle_t caller;
+    SemaphoreHandle_t done;
+    StaticSemaphore_t done_buffer;
     esp_err_t status;
-    char hmac[65];
+    uint16_t http_status;
     char response_buffer[MAX_HTTPS_OUTPUT_BUFFER + 1];
-    char request[MAX_HTTPS_REQUEST_BUFFER + 1];
-    char request_body[REQUEST_BODY_SIZE];
+    size_t response_len;
+    char header_tail[HTTPS_HEADER_TAIL_SIZE];
+    size_t header_tail_len;
+    const char *request_body;
+    size_t request_body_len;
     HTTPS_REQUEST_TYPE https_request_type;
-} https_request_args_t;
+    https_done_cb_t on_done;
+    void *on_done_ctx;
+    int64_t first_byte_us;
+    bool sent;              // every byte of the request was written, the server may have acted on it
+};
+
+typedef https_request_args_t* https_request_handle_t;
+
+/**
+ * Starts the network task that sends every request over the shared session.
+ * Must be called once before any request is submitted.
+ *
+ * @return ESP_OK on success.
+ */
+esp_err_t https_worker_init();
+
+/**
+ * Queues a payment request for the network task. The body is written straight from the
+ * caller's buffer, so it must stay untouched until https_wait_for_response returns.
+ *
+ * @param request_body payment body, json or cbor depending on PLUTO_PAYMENT_CONTENT_TYPE.
+ * @param request_body_len length of the body, which may contain zero bytes.
+ * @param hmac value for the Authorization header.
+ * @param on_done optional completion callback, lets an event loop pick the response up without waiting.
+ * @param out completion handle to wait on with https_wait_for_response.
+ *
+ * @return ESP_OK if queued, ESP_ERR_NO_MEM if every request slot is in use.
+ */
+esp_err_t https_submit_request(const char *request_body, size_t request_body_len, const char *hmac,
+                               https_done_cb_t on_done, void *on_done_ctx, https_request_handle_t *out);
+
+/**
+ * esp_timer time the first byte of the request was written to the session, 0 if it never was.
+ * Only valid until the handle is passed to https_wait_for_response.
+ */
+int64_t https_request_first_byte_us(https_request_handle_t handle);
+
+/**
+ * Whether https_wait_for_response would return at once, for when the completion callback
+ * may have been missed.
+ */
+bool https_request_is_done(https_request_handle_t handle);
+
+/**
+ * Blocks until the request behind the handle is done and releases its slot.
+ *
+ * @param response receives the parsed server response.
+ *
+ * @return ESP_OK if the payment was approved, ESP_ERR_INVALID_RESPONSE if the server answered
+ * with anything else, ESP_FAIL if the request was never sent and can be sent again,
+ * ESP_ERR_TIMEOUT if it was sent but not answered, so the server may have processed it.
+ */
+esp_err_t https_wait_for_response(https_request_handle_t handle, payment_response_t *response);
+
+/**
+ * Queues a session setup on the network task, so the handshake overlaps with user input. A request sent while the pre-warm is still running waits for it to finish.
+ * If the payment is canceled the session is left open for the next one.
+ */
+void https_prewarm_connection();
 
-esp_err_t https_create_and_send_request(char *request_body, char *hmac, char *out, size_t out_size);
+/**
+ * Queues closing the shared session on the network task, for when Wi-Fi is lost and the socket
+ * is dead anyway. Requests already queued are handled first, without waiting for them.
+ */
+void https_close_connection();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,75 @@
+#ifndef JSON_PARSER_H_
+#define JSON_PARSER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define JSON_MAX_DEPTH 8
+
+typedef enum {
+    JSON_TOKEN_OBJECT,
+    JSON_TOKEN_ARRAY,
+    JSON_TOKEN_STRING,
+    JSON_TOKEN_PRIMITIVE
+} json_token_type_t;
+
+/**
+ * Points into the parsed text, nothing is copied. Strings exclude the quotes.
+ * size is the number of direct children, keys and values both count for objects.
+ */
+typedef struct {
+    json_token_type_t type;
+    uint16_t start;
+    uint16_t end;
+    uint16_t size;
+} json_token_t;
+
+typedef enum {
+    JSON_ERROR_NO_TOKENS = -1,
+    JSON_ERROR_INVALID = -2,
+    JSON_ERROR_PARTIAL = -3
+} json_error_t;
+
+/**
+ * Splits json into tokens without allocating.
+ *
+ * @return number of tokens used, or a json_error_t.
+ */
+int json_tokenize(const char *json, size_t len, json_token_t *tokens, size_t max_tokens);
+
+/**
+ * @return index of the first token after the value at index, children included.
+ */
+int json_skip(const json_token_t *tokens, int count, int index);
+
+/**
+ * Looks up the value of key in the object at tokens[object].
+ *
+ * @return token index of the value, or -1 if the key is missing.
+ */
+int json_object_get(const char *json, const json_token_t *tokens, int count, int object, const char *key);
+
+bool json_token_equals(const char *json, const json_token_t *token, const char *value, size_t value_len);
+
+/**
+ * Copies a string token, resolving escapes.
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_SIZE if out is too small, ESP_ERR_INVALID_ARG if the token is not a string.
+ */
+esp_err_t json_token_copy_string(const char *json, const json_token_t *token, char *out, size_t out_size);
+
+esp_err_t json_token_to_int(const char *json, const json_token_t *token, int64_t *out);
+
+/**
+ * Reads a decimal amount, quoted or not, as integer minor units ("12.5" -> 1250 with 2 decimals).
+ */
+esp_err_t json_token_to_minor_units(const char *json, const json_token_t *token, uint8_t decimals, int64_t *out);
+
+/**
+ * Decodes a hex string token of exactly out_len bytes.
+ */
+esp_err_t json_token_hex_to_bytes(const char *json, const json_token_t *token, uint8_t *out, size_t out_len);
+
+#endif
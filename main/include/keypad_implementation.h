@@ -1,14 +1,44 @@
 #ifndef KEYPAD_IMPLEMENTATION_H
 #define KEYPAD_IMPLEMENTATION_H
 
-#define KEYPAD_TASK_WORD_SIZE   1024
+#include <stdint.h>
+#include "esp_err.h"
+#include "event_bus.h"
 
-#include "4x4_matrix.h"
+#define KEYPAD_ROWS         4
+#define KEYPAD_COLS         4
+#define KEYPAD_SCAN_MS      10  // Between scans while a key is down
+#define KEYPAD_STABLE_SCANS 2   // Equal scans in a row before a press or release counts
+#define KEYPAD_SETTLE_US    5   // After switching rows, before the columns are read
+
+typedef struct {
+    uint32_t interrupts;
+    uint32_t scans;
+    uint32_t keys;
+    uint32_t bounces;           // wake ups that ended without a key
+    int64_t scan_cpu_us;        // time spent in the scan timer callback
+    int64_t latency_total_us;   // first edge to event posted
+    int64_t latency_max_us;
+    int64_t since_us;           // esp_timer time the counters were reset
+} keypad_stats_t;
+
+/**
+    Sets up the rows, the column interrupts and the scan timer. Keys are posted to bus as
+    EV_KEY events stamped with the time of the first edge, once keypad_start is called.
+    @param event_bus_handle_t bus - bus to post events to.
+*/
+esp_err_t keypad_init(event_bus_handle_t bus);
+
+/**
+    Arms the column interrupts. Nothing runs until a key is pressed.
+*/
+void keypad_start();
+
+void keypad_get_stats(keypad_stats_t *out);
 
 /**
-    Starts up a task to add pluto_event_handle_t to the passed QueueHandle_t
-    @param QueueHandle_t queue - queue to add events to.
+    Logs press to event latency and the cpu time spent scanning, per hour, then resets the counters.
 */
-void _4x4_matrix_task(void *args);
+void keypad_log_stats();
 
 #endif
\ No newline at end of file
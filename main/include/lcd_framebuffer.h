@@ -0,0 +1,79 @@
+#ifndef LCD_FRAMEBUFFER_H_
+#define LCD_FRAMEBUFFER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "driver/i2c_master.h"
+#include "lcd_1602.h"
+
+#define LCD_FB_COLS LCD_1602_SCREEN_CHAR_WIDTH
+#define LCD_FB_ROWS LCD_1602_MAX_ROWS
+
+typedef struct {
+    char cells[LCD_FB_ROWS][LCD_FB_COLS];
+} lcd_frame_t;
+
+typedef struct {
+    uint32_t frames;            // flushes
+    uint32_t unchanged;         // flushes that sent nothing
+    uint32_t transactions;      // i2c transmits
+    uint32_t bytes;             // bytes on the bus, four per character or command
+    uint32_t cells;             // characters sent
+    int64_t flush_total_us;
+    int64_t flush_max_us;
+} lcd_fb_stats_t;
+
+/**
+ * The screen as it is on the lcd. Only the cells a new frame changes are sent,
+ * as one i2c transaction per flush.
+ */
+typedef struct {
+    i2c_master_dev_handle_t dev;
+    lcd_frame_t shown;
+    uint8_t cursor_row;
+    uint8_t cursor_col;
+    lcd_fb_stats_t stats;
+    uint32_t redraw_transactions;   // one screen through lcd_1602_send_string, measured by lcd_fb_init
+    uint32_t redraw_bytes;
+} lcd_framebuffer_t;
+
+/**
+ * Fills frame with spaces.
+ */
+void lcd_frame_begin(lcd_frame_t *frame);
+
+/**
+ * Writes text into frame at row and col, cut at the end of the row.
+ */
+void lcd_frame_write(lcd_frame_t *frame, uint8_t row, uint8_t col, const char *text, size_t len);
+
+/**
+ * Lays text out the way lcd_1602_send_string does: rows wrap at the screen width,
+ * '\n' starts the next row and the rest of the screen is blank.
+ */
+void lcd_frame_layout(lcd_frame_t *frame, const char *text);
+
+/**
+ * Clears the lcd, which must already be initialized by lcd_1602_init, so the shadow matches it.
+ * Before that it sends one blank screen through the driver to measure what a full redraw costs.
+ */
+esp_err_t lcd_fb_init(lcd_framebuffer_t *fb, i2c_master_dev_handle_t dev);
+
+/**
+ * Sends the cells of frame that differ from the lcd.
+ */
+esp_err_t lcd_fb_flush(lcd_framebuffer_t *fb, const lcd_frame_t *frame);
+
+/**
+ * Blanks the screen with the clear command, cheaper than sending a frame of spaces.
+ */
+esp_err_t lcd_fb_clear(lcd_framebuffer_t *fb);
+
+/**
+ * Logs the counters against what sending every frame through the driver costs, then resets them.
+ */
+void lcd_fb_log_stats(lcd_framebuffer_t *fb);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef OFFLINE_QUEUE_H_
+#define OFFLINE_QUEUE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "security_measures.h"
+#include "https_implementation.h"
+
+#define OFFLINE_QUEUE_CAPACITY      16
+#define OFFLINE_QUEUE_BATCH_SIZE    (HTTPS_REQUEST_SLOTS - 1)  // one slot is always left for a live payment
+#define OFFLINE_DRAIN_TASK_STACK_DEPTH  4096
+#define OFFLINE_DRAIN_TASK_PRIORITY     3
+#define OFFLINE_RECORD_BODY_SIZE    512
+
+typedef struct {
+    char hmac[SHA256_OUT_BUF_SIZE];
+    char body[OFFLINE_RECORD_BODY_SIZE];
+} offline_record_t;
+
+/**
+ * Reads the queue position from NVS and starts the task that drains the queue.
+ * Must be called once after nvs_flash_init.
+ *
+ * @return ESP_OK on success.
+ */
+esp_err_t offline_queue_init();
+
+/**
+ * Appends a signed payment to the queue. Queued payments are never overwritten,
+ * a full queue rejects new ones. The body is stored as is, json or cbor.
+ *
+ * @return ESP_OK if stored, ESP_ERR_NO_MEM if the queue is full.
+ */
+esp_err_t offline_queue_append(const char *body, size_t body_len, const char *hmac);
+
+/**
+ * @return number of payments waiting to be sent.
+ */
+uint32_t offline_queue_depth();
+
+/**
+ * Wakes the drain task and returns at once. It sends the queued payments in batches over the
+ * shared session. Every payment the server answered is removed, unreadable ones are dropped.
+ * Draining stops after the batch in which one went unanswered, that one and everything behind
+ * it are sent again by the next drain.
+ */
+void offline_queue_drain_async();
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef PAYMENT_RESPONSE_H_
+#define PAYMENT_RESPONSE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define PAYMENT_AUTH_ID_SIZE        40
+#define PAYMENT_MESSAGE_SIZE        17  // One lcd row
+#define PAYMENT_RESPONSE_MAX_TOKENS 16
+
+#define PAYMENT_RESPONSE_KEY_RESULT         "resultCode"
+#define PAYMENT_RESPONSE_KEY_AUTHORIZATION  "authorizationId"
+#define PAYMENT_RESPONSE_KEY_MESSAGE        "displayMessage"
+
+/*
+    Payment results as X(name, result code sent by the server, lcd text).
+    Results with an empty code are never sent by the server, the device assigns them.
+*/
+#define PAYMENT_RESULT_TABLE(X) \
+    X(APPROVED,             "approved",             "Payment approved")         \
+    X(DECLINED,             "declined",             "Payment declined")         \
+    X(INSUFFICIENT_FUNDS,   "insufficient_funds",   "Insufficient\nfunds")      \
+    X(INVALID_PIN,          "invalid_pin",          "Wrong pin code")           \
+    X(CARD_BLOCKED,         "card_blocked",         "Card blocked")             \
+    X(DUPLICATE,            "duplicate",            "Duplicate\npayment")       \
+    X(REJECTED,             "",                     "Request rejected")         \
+    X(SERVER_ERROR,         "",                     "Server error\nTry again")  \
+    X(INVALID_RESPONSE,     "",                     "Unknown response")         \
+    X(NO_RESPONSE,          "",                     "No response\nTry again")        \
+    X(NO_ANSWER,            "",                     "Sent, no answer\nCheck status")
+
+#define PAYMENT_RESULT_ENUM(name, code, text) PAYMENT_RESULT_##name,
+
+typedef enum {
+    PAYMENT_RESULT_TABLE(PAYMENT_RESULT_ENUM)
+    PAYMENT_RESULT_COUNT
+} payment_result_t;
+
+typedef struct {
+    uint16_t http_status;
+    payment_result_t result;
+    char authorization_id[PAYMENT_AUTH_ID_SIZE];
+    char message[PAYMENT_MESSAGE_SIZE];
+} payment_response_t;
+
+/**
+ * Parses a payment response without allocating. 2xx and 4xx bodies are read for the result,
+ * a 4xx without a known result becomes REJECTED and any 5xx becomes SERVER_ERROR.
+ * out is always filled in, also when an error is returned.
+ *
+ * @return ESP_OK if the body matched the response schema, ESP_ERR_INVALID_RESPONSE otherwise.
+ */
+esp_err_t payment_response_parse(uint16_t http_status, const char *body, size_t len, payment_response_t *out);
+
+/**
+ * Fills out for a request the server never answered. A request that was sent may still have
+ * been processed, so it gets its own result and must not simply be tried again.
+ */
+void payment_response_no_answer(payment_response_t *out, bool request_sent);
+
+/**
+ * Text for the lcd, the result from the message table followed by the server's message when it fits.
+ */
+void payment_response_lcd_text(const payment_response_t *response, char *out, size_t out_size);
+
+const char *payment_response_result_name(payment_result_t result);
+
+#endif
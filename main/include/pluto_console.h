@@ -0,0 +1,17 @@
+#ifndef PLUTO_CONSOLE_H_
+#define PLUTO_CONSOLE_H_
+
+#include "esp_err.h"
+#include "event_bus.h"
+
+#define PLUTO_CONSOLE_PROMPT "pluto>"
+
+/**
+ * Starts a REPL on the serial console with a "stats" command. The command posts EV_STATS to
+ * bus, the statistics are logged by the task handling the bus like they are for the B key.
+ *
+ * @return ESP_OK, or the error from esp_console.
+ */
+esp_err_t pluto_console_start(event_bus_handle_t bus);
+
+#endif
@@ -2,24 +2,31 @@
 #define PLUTO_APP_EVENTS_H
 
 #include <stdbool.h>
+#include <stdint.h>
+
+// Card numbers travel in the event bus side slot, not in the event
+#define EVENT_CARD_NUMBER_SIZE 30
 
 typedef enum pluto_event_type {
     EV_RFID,
     EV_KEY,
     EV_PIN,
     EV_WIFI,
-    EV_SCAN_FAILED
+    EV_SCAN_FAILED,
+    EV_TIMER,
+    EV_PAYMENT_DONE,
+    EV_STATS            // asked for from the serial console
 }pluto_event_type;
 
 typedef struct pluto_event_handle_t {
     pluto_event_type event_type;
+    // esp_timer time the event was created, set for key presses
+    int64_t timestamp_us;
 
     union {
-        struct {char cardNumber[30];}rfid;
-        struct {char code[5];}pin;
         struct {char key_pressed;}key;
         struct {bool isConnected;}wifi;
     };
 }pluto_event_handle_t;
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,149 @@
+#ifndef PLUTO_PAYMENT_H_
+#define PLUTO_PAYMENT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "security_measures.h"
+#include "request_formater.h"
+#include "time_sync.h"
+#include "project_config.h"
+
+#define PLUTO_CARD_LENGTH       20
+#define PLUTO_CURRENCY_SIZE     4
+#define PLUTO_OPERATION_SIZE    20
+#define PLUTO_AMOUNT_DECIMALS   2
+#define MAC_ADDRESS_LEN         18
+
+#if PLUTO_PAYMENT_ENCODING_CBOR
+#define PLUTO_PAYMENT_CONTENT_TYPE "application/cbor"
+#else
+#define PLUTO_PAYMENT_CONTENT_TYPE "application/json"
+#endif
+
+/*
+    Payment schema. Each field is listed once as X(name, json key, type, size), the struct,
+    key table, serializers and parser are all generated from this list.
+    In CBOR the map key is the field's position in the list, so only append new fields.
+
+    STRING       char[size], JSON string, CBOR text
+    DIGEST       uint8_t[size], JSON lowercase hex, CBOR bytes
+    MINOR_UNITS  int64_t amount in 1/100, JSON "12.50", CBOR integer. size is unused
+    TIMESTAMP    int64_t epoch seconds, JSON local ISO time, CBOR tag 1 integer. size is unused
+*/
+#define PLUTO_PAYMENT_SCHEMA(X) \
+    X(amount,       "amount",           MINOR_UNITS,    1)                      \
+    X(card_number,  "cardNumber",       STRING,         PLUTO_CARD_LENGTH)      \
+    X(pin_code,     "pinCode",          DIGEST,         SHA256_DIGEST_SIZE)     \
+    X(currency,     "currency",         STRING,         PLUTO_CURRENCY_SIZE)    \
+    X(date,         "timeStamp",        TIMESTAMP,      1)                      \
+    X(nonce,        "nonce",            DIGEST,         SHA256_DIGEST_SIZE)     \
+    X(operation,    "operation",        STRING,         PLUTO_OPERATION_SIZE)   \
+    X(device_id,    "deviceMacAddress", STRING,         MAC_ADDRESS_LEN)        \
+    X(time_quality, "timeQuality",      STRING,         TIME_QUALITY_NAME_SIZE)
+
+#define PAYMENT_FIELD_DECL_STRING(name, size)       char name[size];
+#define PAYMENT_FIELD_DECL_DIGEST(name, size)       uint8_t name[size];
+#define PAYMENT_FIELD_DECL_MINOR_UNITS(name, size)  int64_t name;
+#define PAYMENT_FIELD_DECL_TIMESTAMP(name, size)    int64_t name;
+#define PAYMENT_FIELD_DECL(name, key, type, size)   PAYMENT_FIELD_DECL_##type(name, size)
+
+// PAYMENT STRUCT
+typedef struct pluto_payment {
+    PLUTO_PAYMENT_SCHEMA(PAYMENT_FIELD_DECL)
+} pluto_payment;
+
+#define PAYMENT_FIELD_ENUM(name, key, type, size)   PAYMENT_FIELD_##name,
+
+// FIELD ENUM
+typedef enum pluto_payment_field_t {
+    PLUTO_PAYMENT_SCHEMA(PAYMENT_FIELD_ENUM)
+    PAYMENT_FIELD_COUNT
+} pluto_payment_field_t;
+
+typedef struct {
+    const char *key;
+    uint8_t key_len;
+} pluto_payment_key_t;
+
+// JSON KEYS, indexed by pluto_payment_field_t
+extern const pluto_payment_key_t pluto_payment_keys[PAYMENT_FIELD_COUNT];
+
+// The field only known once the customer confirms, serializers write it last
+#define PAYMENT_FIELD_DEFERRED PAYMENT_FIELD_pin_code
+
+#if PLUTO_PAYMENT_ENCODING_CBOR
+typedef cbor_writer_t pluto_payment_writer_t;
+#else
+typedef json_writer_t pluto_payment_writer_t;
+#endif
+
+/**
+ * Payment serialized in two steps. Everything but the deferred field is written and hashed
+ * while the customer types the pin, confirming only appends the pin digest and ends the body.
+ */
+typedef struct {
+    pluto_payment payment;
+    pluto_payment_writer_t writer;
+    bool prepared;
+} pluto_payment_builder_t;
+
+/**
+ * Writes the payment up to the deferred field into out. Fill in builder->payment first,
+ * date and nonce are set here.
+ *
+ * @return ESP_OK, or ESP_ERR_INVALID_SIZE if the fields did not fit out.
+ */
+esp_err_t pluto_payment_prepare(pluto_payment_builder_t *builder, char *out, size_t out_len);
+
+/**
+ * Adds the pin digest and ends the body prepared in out.
+ *
+ * @param body_len receives the number of bytes written.
+ * @param hashed_body receives the hex SHA-256 of the written body.
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_STATE if nothing was prepared, or ESP_ERR_INVALID_SIZE if the body did not fit.
+ */
+esp_err_t pluto_payment_finish(pluto_payment_builder_t *builder, const uint8_t pin_digest[SHA256_DIGEST_SIZE],
+                               size_t *body_len, char hashed_body[SHA256_OUT_BUF_SIZE]);
+
+/**
+ * Drops a prepared payment that will not be sent. Safe to call when nothing is prepared.
+ */
+void pluto_payment_discard(pluto_payment_builder_t *builder);
+
+/**
+ * Writes the payment as a JSON object. Fields are written in schema order by straight-line code,
+ * with every key rendered at compile time. The deferred field comes last.
+ *
+ * @param body_len receives the number of bytes written.
+ * @param hashed_body receives the hex SHA-256 of the written body.
+ *
+ * @return ESP_OK, or ESP_ERR_INVALID_SIZE if the body did not fit out.
+ */
+esp_err_t pluto_payment_to_json(const pluto_payment *payment, char *out, size_t out_len, size_t *body_len, char hashed_body[SHA256_OUT_BUF_SIZE]);
+
+/**
+ * Writes the payment as a CBOR map keyed by field number. Same contract as pluto_payment_to_json,
+ * except that the body is binary.
+ */
+esp_err_t pluto_payment_to_cbor(const pluto_payment *payment, char *out, size_t out_len, size_t *body_len, char hashed_body[SHA256_OUT_BUF_SIZE]);
+
+/**
+ * Writes the payment in the encoding matching PLUTO_PAYMENT_CONTENT_TYPE.
+ */
+esp_err_t pluto_payment_serialize(const pluto_payment *payment, char *out, size_t out_len, size_t *body_len, char hashed_body[SHA256_OUT_BUF_SIZE]);
+
+/**
+ * Encodes the payment both ways and logs size and encode time of each.
+ */
+void pluto_payment_compare_encodings(const pluto_payment *payment);
+
+/**
+ * Reads a payment written by pluto_payment_to_json. Unknown keys are skipped.
+ *
+ * @return ESP_OK, ESP_ERR_NOT_FOUND if a field is missing, ESP_ERR_INVALID_ARG if the json or a value is malformed.
+ */
+esp_err_t pluto_payment_parse(const char *json, size_t len, pluto_payment *out);
+
+#endif
@@ -3,11 +3,106 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdbool.h>
 #include "esp_err.h"
+#include "mbedtls/sha256.h"
 
 #define SHA256_DIGEST_SIZE 32
 #define SHA256_OUT_SIZE     (SHA256_DIGEST_SIZE * 2) + 1
 
-uint8_t create_request_body(const char* keys[], const char* values[], uint8_t key_value_len,  char* out, size_t out_len);
+/**
+ * Writes the request body straight into the transmit buffer and hashes every fragment
+ * as it is written, so the body hash is ready when serialization ends.
+ */
+typedef struct {
+    char *out;
+    size_t out_len;
+    size_t len;
+    bool overflow;
+    mbedtls_sha256_context sha;
+} body_writer_t;
 
-#endif
\ No newline at end of file
+void body_writer_init(body_writer_t *writer, char *out, size_t out_len);
+void body_writer_append(body_writer_t *writer, const char *data, size_t len);
+
+/**
+ * Terminates the body and finishes the hash.
+ *
+ * @param hashed_body receives the hex SHA-256 of the body.
+ *
+ * @return ESP_OK, or ESP_ERR_INVALID_SIZE if the body did not fit the buffer.
+ */
+esp_err_t body_writer_finish(body_writer_t *writer, char hashed_body[SHA256_OUT_SIZE]);
+
+/**
+ * Drops a body that will not be finished and releases its hash state.
+ */
+void body_writer_discard(body_writer_t *writer);
+
+/**
+ * JSON object emitter on top of body_writer. Tracks the write position instead of rescanning
+ * the output, escapes string values and reports overflow when the object is ended.
+ */
+typedef struct {
+    body_writer_t body;
+    bool first_field;
+} json_writer_t;
+
+// Quotes a key at compile time, for use with json_write_key_literal
+#define JSON_KEY(key) "\"" key "\":"
+
+void json_writer_begin(json_writer_t *json, char *out, size_t out_len);
+
+/**
+ * Writes a key already rendered with JSON_KEY, so neither its length nor its escaping is worked out at runtime.
+ * Must be followed by one of the json_value_* functions.
+ */
+void json_write_key_literal(json_writer_t *json, const char *rendered_key, size_t len);
+
+void json_value_string(json_writer_t *json, const char *value);
+void json_value_int(json_writer_t *json, int64_t value);
+
+/**
+ * Writes an amount held as integer minor units (1250 -> "12.50"). Kept as a string value,
+ * which is the format the server expects.
+ */
+void json_value_minor_units(json_writer_t *json, int64_t minor_units, uint8_t decimals);
+
+/**
+ * Writes raw bytes, such as a digest, as a lowercase hex string.
+ */
+void json_value_hex(json_writer_t *json, const uint8_t *bytes, size_t len);
+
+/**
+ * Closes the object and finishes the body hash.
+ *
+ * @return ESP_OK, or ESP_ERR_INVALID_SIZE if the object did not fit the buffer.
+ */
+esp_err_t json_writer_end(json_writer_t *json, char hashed_body[SHA256_OUT_SIZE]);
+
+/**
+ * CBOR (RFC 8949) emitter on top of body_writer. Only definite length items are written,
+ * so the caller gives the number of map entries up front.
+ */
+typedef struct {
+    body_writer_t body;
+} cbor_writer_t;
+
+#define CBOR_TAG_EPOCH_TIME 1
+
+void cbor_writer_begin(cbor_writer_t *cbor, char *out, size_t out_len);
+void cbor_write_map(cbor_writer_t *cbor, size_t entries);
+void cbor_write_uint(cbor_writer_t *cbor, uint64_t value);
+void cbor_write_int(cbor_writer_t *cbor, int64_t value);
+void cbor_write_text(cbor_writer_t *cbor, const char *value);
+void cbor_write_bytes(cbor_writer_t *cbor, const uint8_t *bytes, size_t len);
+void cbor_write_tag(cbor_writer_t *cbor, uint64_t tag);
+
+/**
+ * Finishes the body hash. The body is binary, use the length in cbor->body.len.
+ *
+ * @return ESP_OK, or ESP_ERR_INVALID_SIZE if the items did not fit the buffer.
+ */
+esp_err_t cbor_writer_end(cbor_writer_t *cbor, char hashed_body[SHA256_OUT_SIZE]);
+
+#endif
@@ -2,13 +2,31 @@
 #define SECURITY_MEASURES_H_
 
 #include <ctype.h>
+#include <stdint.h>
+#include <stddef.h>
 #include "esp_err.h"
 
 #define SHA256_DIGEST_SIZE 32
 #define SHA256_OUT_BUF_SIZE ((SHA256_DIGEST_SIZE * 2) + 1)
-#define CANONICAL_STRING_SIZE 256
 
-void sec_generate_nonce(char *out_buf, size_t buf_len);
+void sec_generate_nonce(uint8_t out[SHA256_DIGEST_SIZE]);
+void sec_to_hex(const unsigned char *digest, size_t digest_len, char *hex_output_buffer);
+esp_err_t hash_sha256_digest(const unsigned char *input_buffer, size_t input_buffer_len, uint8_t digest[SHA256_DIGEST_SIZE]);
 esp_err_t hash_sha256(const unsigned char *input_buffer, size_t input_buffer_len, char hex_output_buffer[SHA256_OUT_BUF_SIZE]);
-void build_canonical_string(const char *hashed_body, char *out_buf, size_t out_buf_size);
+
+/**
+ * Checks the HMAC-SHA256 implementation against a known answer, then keys it with DEVICE_KEY
+ * and hashes the constant part of the canonical string once.
+ *
+ * @return ESP_OK on success.
+ */
+esp_err_t sec_signer_init();
+
+/**
+ * HMAC-SHA256 over the canonical string of a payment request, keyed with DEVICE_KEY.
+ *
+ * @param hashed_body hex SHA-256 of the request body, the only part of the canonical string that varies.
+ * @param hex_output_buffer receives the signature as lowercase hex.
+ */
+esp_err_t sec_sign_request(const char *hashed_body, char hex_output_buffer[SHA256_OUT_BUF_SIZE]);
 #endif
\ No newline at end of file
@@ -1,13 +1,51 @@
 #ifndef PLUTO_TIME_SYNC_H
 #define PLUTO_TIME_SYNC_H
 
+#include <time.h>
+#include <stdint.h>
 #include "esp_err.h"
 
-#define TIME_STRING_SIZE    64
+#define TIME_STRING_SIZE        64
+#define TIME_QUALITY_NAME_SIZE  8
+#define TIME_SYNC_INTERVAL_MS   3600000
+
+typedef enum {
+    TIME_QUALITY_NONE,      // clock never set, it starts at 1970
+    TIME_QUALITY_STORED,    // seeded from NVS, behind by however long the device was off
+    TIME_QUALITY_SYNCED     // set by SNTP or a server's Date header since boot
+} time_quality_t;
 
 void time_set_timezone();
 void time_get_current_time(char *buf, size_t buf_size);
-esp_err_t time_update_and_store_in_nvs(void *args);
-esp_err_t time_updated_from_nvs();
+
+/**
+ * Writes timestamp as local "YYYY-MM-DDTHH:MM:SS". The date and hour are cached,
+ * so within an hour this is only integer work. Writes an empty string if buf is too small.
+ */
+void time_format_timestamp(time_t timestamp, char *buf, size_t buf_size);
+
+/**
+ * Reads a local time written by time_format_timestamp back to epoch seconds.
+ */
+esp_err_t time_parse_timestamp(const char *buf, time_t *out);
+
+/**
+ * Sets the clock from the time stored at the last sync, so timestamps are close to right
+ * before the network is up. The clock is never moved back.
+ *
+ * @return ESP_OK, or ESP_ERR_NOT_FOUND if no time was ever stored.
+ */
+esp_err_t time_seed_from_nvs();
+
+/**
+ * Starts SNTP in the background and returns at once. Every sync, the first and the
+ * periodic ones, disciplines the clock and stores the time in NVS.
+ * Needs esp_netif to be initialized.
+ */
+esp_err_t time_sync_start();
+esp_err_t time_sync_stop();
+
+time_quality_t time_get_quality();
+const char *time_quality_name(time_quality_t quality);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,24 @@
+#ifndef TLS_SESSION_CACHE_H_
+#define TLS_SESSION_CACHE_H_
+
+#include "esp_err.h"
+#include "esp_tls.h"
+
+/**
+ * @return the cached session to offer in the next handshake, or NULL if there is none.
+ */
+esp_tls_client_session_t *tls_session_cache_get();
+
+/**
+ * Takes the session negotiated on tls, replacing the cached one.
+ *
+ * @param tls an established connection.
+ */
+esp_err_t tls_session_cache_store(esp_tls_t *tls);
+
+/**
+ * Drops the cached session. Used when a resumed handshake fails.
+ */
+void tls_session_cache_clear();
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef TXN_TRACE_H_
+#define TXN_TRACE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define TXN_TRACE_RING_SIZE     64  // Power of two
+#define TXN_TRACE_BUCKET_COUNT  15
+
+/*
+    Transaction stages as X(name, from, also_from, label). The latency of a stage is measured from
+    the later of its two from stages, a stage with a single one names it twice. A stage is marked
+    each time the transaction crosses it, the last mark counts.
+    A new session marks CONNECT_STARTED, TCP_CONNECTED (the DNS lookup included) and TLS_ESTABLISHED,
+    a reused one marks nothing. The session is usually opened by the pre-warm while the amount is
+    typed, so the request is written from whichever came last, the session or the signature.
+*/
+#define TXN_STAGE_TABLE(X) \
+    X(STARTED,          STARTED,            STARTED,            "started")      \
+    X(AMOUNT_CONFIRMED, STARTED,            STARTED,            "amount")       \
+    X(CARD_READ,        AMOUNT_CONFIRMED,   AMOUNT_CONFIRMED,   "card")         \
+    X(PIN_CONFIRMED,    CARD_READ,          CARD_READ,          "pin")          \
+    X(SIGNED,           PIN_CONFIRMED,      PIN_CONFIRMED,      "signed")       \
+    X(CONNECT_STARTED,  CONNECT_STARTED,    CONNECT_STARTED,    "connect")      \
+    X(TCP_CONNECTED,    CONNECT_STARTED,    CONNECT_STARTED,    "tcp")          \
+    X(TLS_ESTABLISHED,  TCP_CONNECTED,      TCP_CONNECTED,      "tls")          \
+    X(REQUEST_WRITTEN,  TLS_ESTABLISHED,    SIGNED,             "written")      \
+    X(FIRST_BYTE,       REQUEST_WRITTEN,    REQUEST_WRITTEN,    "first byte")   \
+    X(BODY_COMPLETE,    FIRST_BYTE,         FIRST_BYTE,         "body")
+
+#define TXN_STAGE_ENUM(name, from, also_from, label) TXN_STAGE_##name,
+
+typedef enum {
+    TXN_STAGE_TABLE(TXN_STAGE_ENUM)
+    TXN_STAGE_COUNT
+} txn_stage_t;
+
+/**
+ * Latencies in fixed millisecond buckets, see txn_trace_bucket_limits_ms.
+ * The last bucket counts everything above the largest limit.
+ */
+typedef struct {
+    uint32_t buckets[TXN_TRACE_BUCKET_COUNT];
+    uint32_t count;
+    uint64_t total_us;
+    uint32_t max_us;
+} txn_histogram_t;
+
+/**
+ * Upper limit of each bucket in ms, the last bucket has none.
+ */
+extern const uint32_t txn_trace_bucket_limits_ms[TXN_TRACE_BUCKET_COUNT - 1];
+
+/**
+ * Starts a new transaction, stages marked from here on belong to it.
+ * A transaction that was not ended is aggregated first.
+ */
+void txn_trace_begin();
+
+/**
+ * Records a stage of the current transaction at the current time. Lock free and safe
+ * from any task, does nothing outside a transaction.
+ */
+void txn_trace_mark(txn_stage_t stage);
+
+/**
+ * Records a stage at an earlier esp_timer time, such as the time of the key press.
+ */
+void txn_trace_mark_at(txn_stage_t stage, int64_t timestamp_us);
+
+/**
+ * Ends the current transaction and adds its stage latencies to the histograms.
+ * Does nothing if no transaction is running.
+ */
+void txn_trace_end();
+
+/**
+ * Copies the histogram of one stage. TXN_STAGE_COUNT gives the one from pin confirmed to body complete.
+ *
+ * @return ESP_OK, or ESP_ERR_INVALID_ARG for an unknown stage.
+ */
+esp_err_t txn_trace_get_histogram(txn_stage_t stage, txn_histogram_t *out);
+
+/**
+ * Upper limit in ms of the bucket holding the given percentile, the maximum for the overflow bucket.
+ */
+uint32_t txn_trace_percentile_ms(const txn_histogram_t *histogram, uint8_t percentile);
+
+/**
+ * Logs count, p50, p95, p99 and max of every stage.
+ */
+void txn_trace_dump();
+
+#endif
@@ -3,13 +3,17 @@
 
 #include "esp_err.h"
 #include <stdbool.h>
+#include "event_bus.h"
 
 #define WIFI_MAX_WAIT_MS    5000
 
-esp_err_t wifi_init();
+/**
+ * Starts the station. Connect and disconnect changes are posted to the bus as EV_WIFI
+ * from the Wi-Fi event handler, the moment they happen.
+ */
+esp_err_t wifi_init(event_bus_handle_t owner_bus);
 bool wifi_is_connected();
 esp_err_t wifi_wait_for_connection(int wait_time_ms);
 esp_err_t wifi_destroy();
-void wifi_check_status (void *args);
 
 #endif
\ No newline at end of file
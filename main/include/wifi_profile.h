@@ -0,0 +1,67 @@
+#ifndef WIFI_PROFILE_H_
+#define WIFI_PROFILE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "esp_wifi.h"
+
+#define WIFI_PROFILE_VERSION            1
+#define WIFI_PROFILE_MAX_FAST_ATTEMPTS  2
+
+/**
+ * Access point of the last connection that got an IP. The lease itself is restored by lwIP
+ * (CONFIG_LWIP_DHCP_RESTORE_LAST_IP), which asks the DHCP server for the same address.
+ */
+typedef struct {
+    uint8_t version;
+    uint8_t bssid[6];
+    uint8_t channel;
+    char ssid[33];
+} wifi_profile_t;
+
+/**
+ * Reads the profile saved in NVS. A profile saved for another SSID is treated as missing.
+ *
+ * @return ESP_OK, or ESP_ERR_NOT_FOUND if there is no usable profile.
+ */
+esp_err_t wifi_profile_load(const char *ssid, wifi_profile_t *out);
+
+/**
+ * Saves the profile if it differs from the one in NVS.
+ */
+esp_err_t wifi_profile_store(const wifi_profile_t *profile);
+
+void wifi_profile_clear();
+
+/*
+    The functions below only touch their arguments, so the connect logic can be driven
+    by a mocked driver on the host.
+*/
+
+/**
+ * Fills the profile from the STA_CONNECTED event of the current connection.
+ */
+void wifi_profile_from_event(const char *ssid, const wifi_event_sta_connected_t *event, wifi_profile_t *out);
+
+/**
+ * Locks the station config to the profile's access point and channel, so the driver
+ * probes one channel instead of scanning all of them.
+ */
+void wifi_profile_apply(const wifi_profile_t *profile, wifi_sta_config_t *config);
+
+/**
+ * Returns the station config to a full scan for the SSID.
+ */
+void wifi_profile_release(wifi_sta_config_t *config);
+
+/**
+ * @param reason disconnect reason of the last attempt.
+ * @param failed_attempts directed attempts that failed so far, including this one.
+ *
+ * @return true if the directed connect should be given up for a full scan.
+ */
+bool wifi_profile_should_fall_back(uint8_t reason, uint8_t failed_attempts);
+
+#endif
@@ -23,11 +23,16 @@ int app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
+    // Usable timestamps right away, SNTP corrects them once the network is up
+    time_set_timezone();
+    if (time_seed_from_nvs() != ESP_OK) {
+        ESP_LOGW(MAIN_TAG, "No stored time, clock unset until SNTP syncs");
+    }
+
     pluto_system_handle_t pluto = NULL;
     ESP_ERROR_CHECK(pluto_system_init(&pluto));
 
-    ESP_ERROR_CHECK(time_update_and_store_in_nvs(NULL));
-    time_set_timezone();
+    ESP_ERROR_CHECK(time_sync_start());
 
     pluto_run(pluto);
     
@@ -0,0 +1,216 @@
+/*
+    The clock is an esp_timer base, the wall time it stood for and a rate correction. Reading it is
+    a few integer operations and never touches the system time, which the SNTP client may be stepping
+    at the same moment. Corrections come from SNTP, exact but only every hour, and from the Date header
+    of every payment response, coarse but frequent enough to catch a clock that ran off between syncs.
+*/
+
+#include "clock_discipline.h"
+
+#include <string.h>
+#include <sys/time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *CLOCK_TAG = "CLOCK";
+
+#define HTTP_DATE_LEN 29
+
+static portMUX_TYPE clock_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Guarded by clock_lock
+static clock_source_t clock_source = CLOCK_SOURCE_NONE;
+static int64_t base_mono_us = 0;
+static int64_t base_wall_us = 0;
+static int32_t rate_ppm = 0;
+static int64_t last_sntp_mono_us = 0;
+static int64_t last_sntp_wall_us = 0;
+static clock_discipline_stats_t clock_stats = {0};
+
+// Caller holds clock_lock
+static int64_t clock_at(int64_t mono_us) {
+    int64_t elapsed_us = mono_us - base_mono_us;
+    return base_wall_us + elapsed_us + elapsed_us * rate_ppm / 1000000;
+}
+
+static int64_t clock_system_us() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+int64_t clock_now_us() {
+    int64_t mono_us = esp_timer_get_time();
+    int64_t now_us = 0;
+    bool set = false;
+
+    portENTER_CRITICAL(&clock_lock);
+    if (clock_source != CLOCK_SOURCE_NONE) {
+        now_us = clock_at(mono_us);
+        set = true;
+    }
+    portEXIT_CRITICAL(&clock_lock);
+
+    return set ? now_us : clock_system_us();
+}
+
+void clock_discipline_set(int64_t wall_us, int64_t mono_us, clock_source_t source) {
+    bool had_time = false;
+    bool measured = false;
+    int64_t correction_us = 0;
+
+    portENTER_CRITICAL(&clock_lock);
+    had_time = clock_source != CLOCK_SOURCE_NONE;
+    if (had_time) correction_us = wall_us - clock_at(mono_us);
+
+    if (source == CLOCK_SOURCE_SNTP) {
+        int64_t mono_elapsed_us = mono_us - last_sntp_mono_us;
+
+        // Both ends came from a server, so the difference is our oscillator
+        if (last_sntp_mono_us != 0 && mono_elapsed_us > 0) {
+            int64_t rate = (wall_us - last_sntp_wall_us - mono_elapsed_us) * 1000000 / mono_elapsed_us;
+
+            if (rate >= -CLOCK_MAX_RATE_PPM && rate <= CLOCK_MAX_RATE_PPM) {
+                rate_ppm = (int32_t)rate;
+                measured = true;
+            }
+        }
+
+        last_sntp_mono_us = mono_us;
+        last_sntp_wall_us = wall_us;
+        clock_stats.sntp_syncs++;
+    }
+
+    base_mono_us = mono_us;
+    base_wall_us = wall_us;
+    clock_source = source;
+    clock_stats.rate_ppm = rate_ppm;
+    if (had_time) clock_stats.last_correction_ms = (int32_t)(correction_us / 1000);
+    portEXIT_CRITICAL(&clock_lock);
+
+    if (measured) {
+        ESP_LOGI(CLOCK_TAG, "Corrected %d ms, running at %d ppm", (int)(correction_us / 1000), (int)rate_ppm);
+    } else if (had_time) {
+        ESP_LOGI(CLOCK_TAG, "Corrected %d ms", (int)(correction_us / 1000));
+    }
+}
+
+bool clock_discipline_http_date(time_t date, int64_t sent_us, int64_t received_us) {
+    // The server wrote the header somewhere between the two, at a time in [date, date + 1 s)
+    int64_t earliest_us = (int64_t)date * 1000000;
+    int64_t latest_us = earliest_us + 1000000;
+    int64_t correction_us = 0;
+    int64_t system_mono_us = esp_timer_get_time();
+    int64_t system_us = clock_system_us();
+
+    portENTER_CRITICAL(&clock_lock);
+    // Never set, compare against the system time
+    if (clock_source == CLOCK_SOURCE_NONE) {
+        base_mono_us = system_mono_us;
+        base_wall_us = system_us;
+    }
+
+    if (clock_at(received_us) < earliest_us) {
+        correction_us = earliest_us - clock_at(received_us);
+        base_wall_us = earliest_us;
+        base_mono_us = received_us;
+    } else if (clock_at(sent_us) > latest_us) {
+        correction_us = latest_us - clock_at(sent_us);
+        base_wall_us = latest_us;
+        base_mono_us = sent_us;
+    }
+
+    // Inside the window the header agrees with us, which is still news for a stored time
+    if (correction_us != 0 || clock_source < CLOCK_SOURCE_HTTP_DATE) clock_source = CLOCK_SOURCE_HTTP_DATE;
+    if (correction_us != 0) {
+        clock_stats.date_corrections++;
+        clock_stats.last_correction_ms = (int32_t)(correction_us / 1000);
+    }
+    portEXIT_CRITICAL(&clock_lock);
+
+    if (correction_us == 0) return false;
+
+    // Certificate checks and logs use the system time
+    int64_t now_us = clock_now_us();
+    struct timeval now = {
+        .tv_sec = (time_t)(now_us / 1000000),
+        .tv_usec = (suseconds_t)(now_us % 1000000)
+    };
+    settimeofday(&now, NULL);
+
+    ESP_LOGW(CLOCK_TAG, "Clock off by %d ms against the server's Date", (int)(correction_us / 1000));
+    return true;
+}
+
+static bool clock_parse_number(const char *text, uint8_t digits, int *out) {
+    int value = 0;
+
+    for (uint8_t i = 0; i < digits; i++) {
+        if (text[i] < '0' || text[i] > '9') return false;
+        value = value * 10 + (text[i] - '0');
+    }
+
+    *out = value;
+    return true;
+}
+
+int64_t clock_days_from_civil(int year, int month, int day) {
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int year_of_era = year - era * 400;
+    int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+
+    return (int64_t)era * 146097 + day_of_era - 719468;
+}
+
+bool clock_parse_http_date(const char *value, size_t len, time_t *out) {
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    int day, year, hour, minute, second;
+    int month = 0;
+
+    if (len != HTTP_DATE_LEN || value[3] != ',' || memcmp(value + 26, "GMT", 3) != 0) return false;
+
+    for (; month < 12; month++) {
+        if (memcmp(value + 8, months + month * 3, 3) == 0) break;
+    }
+    if (month == 12) return false;
+
+    if (!clock_parse_number(value + 5, 2, &day) || !clock_parse_number(value + 12, 4, &year) ||
+        !clock_parse_number(value + 17, 2, &hour) || !clock_parse_number(value + 20, 2, &minute) ||
+        !clock_parse_number(value + 23, 2, &second)) {
+        return false;
+    }
+
+    if (day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) return false;
+
+    *out = (time_t)(clock_days_from_civil(year, month + 1, day) * 86400 + hour * 3600 + minute * 60 + second);
+    return true;
+}
+
+clock_source_t clock_discipline_source() {
+    portENTER_CRITICAL(&clock_lock);
+    clock_source_t source = clock_source;
+    portEXIT_CRITICAL(&clock_lock);
+
+    return source;
+}
+
+void clock_discipline_get_stats(clock_discipline_stats_t *out) {
+    portENTER_CRITICAL(&clock_lock);
+    *out = clock_stats;
+    out->source = clock_source;
+    portEXIT_CRITICAL(&clock_lock);
+}
+
+void clock_discipline_log_stats() {
+    static const char *source_name[] = {"none", "stored", "date header", "sntp"};
+    clock_discipline_stats_t stats;
+
+    clock_discipline_get_stats(&stats);
+    ESP_LOGI(CLOCK_TAG, "Source %s, %lu SNTP syncs, %lu Date corrections, last %d ms, rate %d ppm",
+        source_name[stats.source], (unsigned long)stats.sntp_syncs, (unsigned long)stats.date_corrections,
+        (int)stats.last_correction_ms, (int)stats.rate_ppm);
+}
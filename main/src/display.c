@@ -0,0 +1,301 @@
+/*
+    The display task is the only writer of the lcd. Commands only change what the screen should
+    look like: the screen, a toast over it and a spinner cell. A command overwrites that state under
+    a lock and wakes the task, so a command never waits and is never lost, and frames that are out
+    of date by the time the task wakes are never written. What it draws is diffed against the lcd
+    so only changed cells go over the bus.
+*/
+
+#include "display.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *DISPLAY_TAG = "DISPLAY";
+
+// The lcd rom has no backslash, so the spinner pulses instead of turning
+static const char spinner_frames[] = {'.', 'o', 'O', 'o'};
+
+// What the screen should show, the task draws the newest one
+typedef struct {
+    lcd_frame_t screen;
+    lcd_frame_t toast;
+    int64_t toast_until_us;     // 0 when no toast is shown
+    bool spinner_on;
+    uint8_t spinner_row;
+    uint8_t spinner_col;
+} display_state_t;
+
+typedef struct display {
+    TaskHandle_t task;
+    TaskHandle_t stopper;
+    lcd_framebuffer_t fb;
+
+    // Written by the posting tasks under lock, a change replaces the one before it
+    portMUX_TYPE lock;
+    display_state_t desired;
+    bool clear_pending;
+    bool spinner_restart;
+    bool stats_pending;
+    bool stop_pending;
+    uint32_t posted;            // commands since the task last took the state
+    int64_t oldest_posted_us;
+
+    // Everything below is only touched by the display task
+    display_state_t state;
+    uint8_t spinner_phase;
+    int64_t spinner_next_us;
+    display_stats_t stats;
+} display;
+
+// Takes the lock for a command, the command only changes desired before display_post
+static bool display_lock(display_handle_t display) {
+    if (display == NULL) return false;
+
+    portENTER_CRITICAL(&display->lock);
+    return true;
+}
+
+// Counts the command, drops the lock and wakes the task, which draws whatever is desired by then
+static bool display_post(display_handle_t display, int64_t posted_us) {
+    if (display->posted++ == 0) display->oldest_posted_us = posted_us;
+    portEXIT_CRITICAL(&display->lock);
+
+    xTaskNotifyGive(display->task);
+    return true;
+}
+
+static void display_log(display_handle_t display) {
+    display_stats_t *stats = &display->stats;
+
+    ESP_LOGI(DISPLAY_TAG, "%lu commands, %lu collapsed", (unsigned long)stats->commands, (unsigned long)stats->collapsed);
+    if (stats->latency_count > 0) {
+        ESP_LOGI(DISPLAY_TAG, "Posted to lcd: avg %d us, max %d us",
+            (int)(stats->latency_total_us / stats->latency_count), (int)stats->latency_max_us);
+    }
+    lcd_fb_log_stats(&display->fb);
+
+    memset(stats, 0, sizeof(*stats));
+}
+
+// Time until the toast ends or the spinner turns, whichever is first
+static TickType_t display_next_wait(display_handle_t display) {
+    int64_t deadline_us = INT64_MAX;
+
+    if (display->state.toast_until_us != 0) deadline_us = display->state.toast_until_us;
+    if (display->state.spinner_on && display->spinner_next_us < deadline_us) deadline_us = display->spinner_next_us;
+
+    if (deadline_us == INT64_MAX) return portMAX_DELAY;
+
+    int64_t wait_us = deadline_us - esp_timer_get_time();
+    if (wait_us <= 0) return 0;
+
+    TickType_t ticks = pdMS_TO_TICKS((wait_us + 999) / 1000);
+    return ticks > 0 ? ticks : 1;
+}
+
+static void display_draw(display_handle_t display, bool clear) {
+    int64_t now_us = esp_timer_get_time();
+    display_state_t *state = &display->state;
+    lcd_frame_t out;
+
+    if (state->spinner_on && now_us >= display->spinner_next_us) {
+        display->spinner_phase = (display->spinner_phase + 1) % sizeof(spinner_frames);
+        display->spinner_next_us = now_us + DISPLAY_SPINNER_PERIOD_MS * 1000;
+    }
+
+    if (state->toast_until_us != 0) {
+        out = state->toast;
+    } else {
+        out = state->screen;
+        if (state->spinner_on && state->spinner_row < LCD_FB_ROWS && state->spinner_col < LCD_FB_COLS) {
+            out.cells[state->spinner_row][state->spinner_col] = spinner_frames[display->spinner_phase];
+        }
+    }
+
+    if (clear) {
+        lcd_fb_clear(&display->fb);
+    }
+
+    lcd_fb_flush(&display->fb, &out);
+}
+
+static void display_task(void *pvparameters) {
+    display_handle_t display = (display_handle_t)pvparameters;
+
+    while (true) {
+        // Woken by a command, or when the toast ends or the spinner turns
+        ulTaskNotifyTake(pdTRUE, display_next_wait(display));
+
+        int64_t now_us = esp_timer_get_time();
+
+        // Whatever was posted while the last frame went out is taken at once, only the newest state is drawn
+        portENTER_CRITICAL(&display->lock);
+        if (display->desired.toast_until_us != 0 && now_us >= display->desired.toast_until_us) {
+            display->desired.toast_until_us = 0;
+        }
+        display->state = display->desired;
+        bool clear = display->clear_pending;
+        bool spinner_restart = display->spinner_restart;
+        bool stats = display->stats_pending;
+        bool stop = display->stop_pending;
+        uint32_t taken = display->posted;
+        int64_t oldest_us = display->oldest_posted_us;
+        display->clear_pending = false;
+        display->spinner_restart = false;
+        display->stats_pending = false;
+        display->posted = 0;
+        portEXIT_CRITICAL(&display->lock);
+
+        if (stop) break;
+
+        if (spinner_restart) {
+            display->spinner_phase = 0;
+            display->spinner_next_us = now_us + DISPLAY_SPINNER_PERIOD_MS * 1000;
+        }
+
+        display_draw(display, clear);
+
+        if (taken > 0) {
+            int64_t latency_us = esp_timer_get_time() - oldest_us;
+            display->stats.commands += taken;
+            display->stats.collapsed += taken - 1;
+            display->stats.latency_total_us += latency_us;
+            display->stats.latency_count++;
+            if (latency_us > display->stats.latency_max_us) display->stats.latency_max_us = latency_us;
+        }
+
+        if (stats) display_log(display);
+    }
+
+    xTaskNotifyGive(display->stopper);
+    vTaskDelete(NULL);
+}
+
+esp_err_t display_start(display_handle_t *out, i2c_master_dev_handle_t dev) {
+    if (out == NULL || dev == NULL) return ESP_ERR_INVALID_ARG;
+
+    display_handle_t display = (display_handle_t)calloc(1, sizeof(struct display));
+    if (display == NULL) {
+        ESP_LOGE(DISPLAY_TAG, "Failed to allocate memory for structure");
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = lcd_fb_init(&display->fb, dev);
+    if (err != ESP_OK) {
+        ESP_LOGE(DISPLAY_TAG, "Failed to clear lcd");
+        goto exit;
+    }
+    portMUX_INITIALIZE(&display->lock);
+    lcd_frame_begin(&display->desired.screen);
+    display->state = display->desired;
+
+    if (xTaskCreate(display_task, "display_task", DISPLAY_TASK_STACK_DEPTH, display, DISPLAY_TASK_PRIORITY, &display->task) != pdPASS) {
+        ESP_LOGE(DISPLAY_TAG, "Failed to create display task");
+        err = ESP_ERR_NO_MEM;
+        goto exit;
+    }
+
+    *out = display;
+    return ESP_OK;
+
+exit:
+    free(display);
+    return err;
+}
+
+void display_stop(display_handle_t display) {
+    if (display == NULL) return;
+
+    display->stopper = xTaskGetCurrentTaskHandle();
+
+    portENTER_CRITICAL(&display->lock);
+    display->stop_pending = true;
+    portEXIT_CRITICAL(&display->lock);
+    xTaskNotifyGive(display->task);
+
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    free(display);
+}
+
+bool display_frame(display_handle_t display, const lcd_frame_t *frame) {
+    int64_t now_us = esp_timer_get_time();
+
+    if (!display_lock(display)) return false;
+    display->desired.screen = *frame;
+    display->desired.toast_until_us = 0;
+    display->desired.spinner_on = false;
+
+    return display_post(display, now_us);
+}
+
+bool display_text(display_handle_t display, const char *text) {
+    lcd_frame_t frame;
+    lcd_frame_layout(&frame, text);
+
+    return display_frame(display, &frame);
+}
+
+bool display_line(display_handle_t display, uint8_t row, const char *text) {
+    int64_t now_us = esp_timer_get_time();
+    lcd_frame_t line;
+    lcd_frame_begin(&line);
+    lcd_frame_write(&line, 0, 0, text, strlen(text));
+
+    if (!display_lock(display)) return false;
+    if (row < LCD_FB_ROWS) {
+        memcpy(display->desired.screen.cells[row], line.cells[0], LCD_FB_COLS);
+    }
+
+    return display_post(display, now_us);
+}
+
+bool display_toast(display_handle_t display, const char *text, uint32_t duration_ms) {
+    int64_t now_us = esp_timer_get_time();
+    lcd_frame_t toast;
+    lcd_frame_layout(&toast, text);
+
+    if (!display_lock(display)) return false;
+    display->desired.toast = toast;
+    display->desired.toast_until_us = now_us + (int64_t)duration_ms * 1000;
+
+    return display_post(display, now_us);
+}
+
+bool display_spinner(display_handle_t display, uint8_t row, uint8_t col, bool on) {
+    int64_t now_us = esp_timer_get_time();
+
+    if (!display_lock(display)) return false;
+    display->desired.spinner_on = on;
+    display->desired.spinner_row = row;
+    display->desired.spinner_col = col;
+    display->spinner_restart = true;
+
+    return display_post(display, now_us);
+}
+
+bool display_clear(display_handle_t display) {
+    int64_t now_us = esp_timer_get_time();
+
+    if (!display_lock(display)) return false;
+    lcd_frame_begin(&display->desired.screen);
+    display->desired.toast_until_us = 0;
+    display->desired.spinner_on = false;
+    display->clear_pending = true;
+
+    return display_post(display, now_us);
+}
+
+bool display_log_stats(display_handle_t display) {
+    int64_t now_us = esp_timer_get_time();
+
+    if (!display_lock(display)) return false;
+    display->stats_pending = true;
+
+    return display_post(display, now_us);
+}
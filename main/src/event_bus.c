@@ -0,0 +1,212 @@
+/*
+    One queue per channel and a counting semaphore that is given for every post. The semaphore
+    only wakes the receiver, which then scans the channels in priority order, so a wake up may
+    find nothing when an event was already taken by an earlier scan.
+*/
+
+#include "event_bus.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+static const char *BUS_TAG = "EVENT_BUS";
+
+#define EVENT_CHANNEL_DEPTH(name, depth, policy)    [EVENT_CHANNEL_##name] = depth,
+#define EVENT_CHANNEL_POLICY(name, depth, policy)   [EVENT_CHANNEL_##name] = policy,
+#define EVENT_CHANNEL_NAME(name, depth, policy)     [EVENT_CHANNEL_##name] = #name,
+#define EVENT_CHANNEL_SUM(name, depth, policy)      + depth
+
+#define EVENT_BUS_TOTAL_DEPTH (0 EVENT_CHANNEL_TABLE(EVENT_CHANNEL_SUM))
+
+static const uint8_t channel_depth[EVENT_CHANNEL_COUNT] = {
+    EVENT_CHANNEL_TABLE(EVENT_CHANNEL_DEPTH)
+};
+
+static const event_policy_t channel_policy[EVENT_CHANNEL_COUNT] = {
+    EVENT_CHANNEL_TABLE(EVENT_CHANNEL_POLICY)
+};
+
+static const char *channel_name[EVENT_CHANNEL_COUNT] = {
+    EVENT_CHANNEL_TABLE(EVENT_CHANNEL_NAME)
+};
+
+typedef struct event_bus {
+    QueueHandle_t channels[EVENT_CHANNEL_COUNT];
+    SemaphoreHandle_t pending;
+    portMUX_TYPE lock;      // guards the card slot and the counters
+    char card_number[EVENT_CARD_NUMBER_SIZE];
+    event_bus_stats_t stats[EVENT_CHANNEL_COUNT];
+} event_bus;
+
+static event_channel_t event_bus_channel_for(pluto_event_type type) {
+    switch (type) {
+        case EV_WIFI:
+            return EVENT_CHANNEL_CONNECTIVITY;
+
+        case EV_PAYMENT_DONE:
+            return EVENT_CHANNEL_PAYMENT;
+
+        // Only the newest arming counts, events of older ones are ignored by the deadline anyway
+        case EV_TIMER:
+            return EVENT_CHANNEL_TIMER;
+
+        case EV_RFID:
+            return EVENT_CHANNEL_CARD;
+
+        // Own slot, a failed re-read must not replace a card that was read
+        case EV_SCAN_FAILED:
+            return EVENT_CHANNEL_SCAN_FAILED;
+
+        default:
+            return EVENT_CHANNEL_KEYS;
+    }
+}
+
+esp_err_t event_bus_create(event_bus_handle_t *out) {
+    if (out == NULL) return ESP_ERR_INVALID_ARG;
+
+    event_bus_handle_t bus = (event_bus_handle_t)calloc(1, sizeof(event_bus));
+    if (bus == NULL) {
+        ESP_LOGE(BUS_TAG, "Failed to allocate memory for structure");
+        return ESP_ERR_NO_MEM;
+    }
+
+    portMUX_INITIALIZE(&bus->lock);
+
+    bus->pending = xSemaphoreCreateCounting(EVENT_BUS_TOTAL_DEPTH, 0);
+    if (bus->pending == NULL) goto exit;
+
+    for (uint8_t channel = 0; channel < EVENT_CHANNEL_COUNT; channel++) {
+        bus->channels[channel] = xQueueCreate(channel_depth[channel], sizeof(pluto_event_handle_t));
+        if (bus->channels[channel] == NULL) goto exit;
+    }
+
+    *out = bus;
+    return ESP_OK;
+
+exit:
+    ESP_LOGE(BUS_TAG, "Failed to create channels");
+    event_bus_destroy(bus);
+    return ESP_ERR_NO_MEM;
+}
+
+void event_bus_destroy(event_bus_handle_t bus) {
+    if (bus == NULL) return;
+
+    for (uint8_t channel = 0; channel < EVENT_CHANNEL_COUNT; channel++) {
+        if (bus->channels[channel] != NULL) vQueueDelete(bus->channels[channel]);
+    }
+
+    if (bus->pending != NULL) vSemaphoreDelete(bus->pending);
+
+    free(bus);
+}
+
+bool event_bus_post(event_bus_handle_t bus, const pluto_event_handle_t *event) {
+    if (bus == NULL || event == NULL) return false;
+
+    event_channel_t channel = event_bus_channel_for(event->event_type);
+    QueueHandle_t queue = bus->channels[channel];
+    event_bus_stats_t *stats = &bus->stats[channel];
+    bool replaced = false;
+
+    if (channel_policy[channel] == EVENT_POLICY_OVERWRITE) {
+        replaced = uxQueueMessagesWaiting(queue) > 0;
+        xQueueOverwrite(queue, event);
+    } else if (xQueueSend(queue, event, 0) != pdPASS) {
+        portENTER_CRITICAL(&bus->lock);
+        stats->dropped++;
+        portEXIT_CRITICAL(&bus->lock);
+        return false;
+    }
+
+    uint32_t depth = uxQueueMessagesWaiting(queue);
+
+    portENTER_CRITICAL(&bus->lock);
+    stats->posted++;
+    if (replaced) stats->overwritten++;
+    if (depth > stats->high_water) stats->high_water = depth;
+    portEXIT_CRITICAL(&bus->lock);
+
+    // Saturates at the total depth, which is as many wake ups as there can be events
+    xSemaphoreGive(bus->pending);
+
+    return true;
+}
+
+bool event_bus_post_card(event_bus_handle_t bus, const char *card_number) {
+    if (bus == NULL || card_number == NULL) return false;
+
+    pluto_event_handle_t event = {
+        .event_type = EV_RFID
+    };
+
+    portENTER_CRITICAL(&bus->lock);
+    snprintf(bus->card_number, sizeof(bus->card_number), "%s", card_number);
+    portEXIT_CRITICAL(&bus->lock);
+
+    return event_bus_post(bus, &event);
+}
+
+void event_bus_take_card(event_bus_handle_t bus, char *out, size_t out_size) {
+    if (bus == NULL || out == NULL || out_size == 0) return;
+
+    portENTER_CRITICAL(&bus->lock);
+    snprintf(out, out_size, "%s", bus->card_number);
+    portEXIT_CRITICAL(&bus->lock);
+}
+
+static bool event_bus_poll(event_bus_handle_t bus, pluto_event_handle_t *out) {
+    for (uint8_t channel = 0; channel < EVENT_CHANNEL_COUNT; channel++) {
+        if (xQueueReceive(bus->channels[channel], out, 0) == pdPASS) return true;
+    }
+
+    return false;
+}
+
+bool event_bus_receive(event_bus_handle_t bus, pluto_event_handle_t *out, TickType_t timeout) {
+    if (bus == NULL || out == NULL) return false;
+
+    TickType_t start = xTaskGetTickCount();
+
+    while (true) {
+        if (event_bus_poll(bus, out)) return true;
+
+        TickType_t wait = portMAX_DELAY;
+        if (timeout != portMAX_DELAY) {
+            TickType_t elapsed = xTaskGetTickCount() - start;
+            if (elapsed >= timeout) return false;
+            wait = timeout - elapsed;
+        }
+
+        if (!xSemaphoreTake(bus->pending, wait)) return false;
+    }
+}
+
+void event_bus_get_stats(event_bus_handle_t bus, event_channel_t channel, event_bus_stats_t *out) {
+    if (bus == NULL || out == NULL || channel >= EVENT_CHANNEL_COUNT) return;
+
+    portENTER_CRITICAL(&bus->lock);
+    *out = bus->stats[channel];
+    portEXIT_CRITICAL(&bus->lock);
+
+    out->depth = uxQueueMessagesWaiting(bus->channels[channel]);
+}
+
+void event_bus_log_stats(event_bus_handle_t bus) {
+    event_bus_stats_t stats;
+
+    for (uint8_t channel = 0; channel < EVENT_CHANNEL_COUNT; channel++) {
+        event_bus_get_stats(bus, channel, &stats);
+
+        ESP_LOGI(BUS_TAG, "%-12s depth %lu/%d, high %lu, posted %lu, dropped %lu, overwritten %lu", channel_name[channel],
+            (unsigned long)stats.depth, (int)channel_depth[channel], (unsigned long)stats.high_water,
+            (unsigned long)stats.posted, (unsigned long)stats.dropped, (unsigned long)stats.overwritten);
+    }
+}
@@ -0,0 +1,246 @@
+/*
+    Incremental HTTP/1.1 response parser. Works on whatever each TLS read returns, so the
+    response never has to be collected in one buffer, and knows when the body is complete
+    through Content-Length or the last chunk.
+*/
+
+#include "http_response_parser.h"
+
+#include <string.h>
+#include <ctype.h>
+
+static bool http_parser_token_equals(const char *token, size_t token_len, const char *expected) {
+    size_t expected_len = strlen(expected);
+    if (token_len != expected_len) return false;
+
+    for (size_t i = 0; i < token_len; i++) {
+        if (tolower((unsigned char)token[i]) != expected[i]) return false;
+    }
+
+    return true;
+}
+
+static void http_parser_status_line(http_response_parser_t *parser, const char *line, size_t len) {
+    // HTTP/1.x SSS
+    if (len < 12 || memcmp(line, "HTTP/1.", 7) != 0 || line[8] != ' ' ||
+        !isdigit((unsigned char)line[9]) || !isdigit((unsigned char)line[10]) || !isdigit((unsigned char)line[11])) {
+        parser->state = HTTP_PARSE_ERROR;
+        return;
+    }
+
+    parser->status_code = (line[9] - '0') * 100 + (line[10] - '0') * 10 + (line[11] - '0');
+    parser->keep_alive = line[7] == '1';
+    parser->content_length = -1;
+    parser->chunked = false;
+    parser->state = HTTP_PARSE_HEADER;
+}
+
+static void http_parser_headers_done(http_response_parser_t *parser) {
+    if (parser->status_code / 100 == 1) {
+        // Interim response, the real one follows
+        parser->state = HTTP_PARSE_STATUS;
+    } else if (parser->status_code == 204 || parser->status_code == 304) {
+        parser->state = HTTP_PARSE_DONE;
+    } else if (parser->chunked) {
+        parser->state = HTTP_PARSE_CHUNK_SIZE;
+    } else if (parser->content_length >= 0) {
+        parser->remaining = (size_t)parser->content_length;
+        parser->state = parser->remaining == 0 ? HTTP_PARSE_DONE : HTTP_PARSE_BODY;
+    } else {
+        parser->keep_alive = false;
+        parser->state = HTTP_PARSE_BODY_UNTIL_CLOSE;
+    }
+}
+
+static void http_parser_header_line(http_response_parser_t *parser, const char *line, size_t len) {
+    if (len == 0) {
+        http_parser_headers_done(parser);
+        return;
+    }
+
+    const char *colon = memchr(line, ':', len);
+    if (colon == NULL) {
+        parser->state = HTTP_PARSE_ERROR;
+        return;
+    }
+
+    size_t name_len = colon - line;
+    const char *value = colon + 1;
+    size_t value_len = len - name_len - 1;
+
+    while (value_len > 0 && (*value == ' ' || *value == '\t')) {
+        value++;
+        value_len--;
+    }
+    while (value_len > 0 && (value[value_len - 1] == ' ' || value[value_len - 1] == '\t')) {
+        value_len--;
+    }
+
+    if (http_parser_token_equals(line, name_len, "content-length")) {
+        long content_length = 0;
+        if (value_len == 0) {
+            parser->state = HTTP_PARSE_ERROR;
+            return;
+        }
+        for (size_t i = 0; i < value_len; i++) {
+            int digit = value[i] - '0';
+            if (!isdigit((unsigned char)value[i]) || content_length > (HTTP_PARSER_MAX_BODY - digit) / 10) {
+                parser->state = HTTP_PARSE_ERROR;
+                return;
+            }
+            content_length = content_length * 10 + digit;
+        }
+        parser->content_length = content_length;
+    }
+    else if (http_parser_token_equals(line, name_len, "transfer-encoding")) {
+        // chunked is always the last coding applied, a whole token after a comma or whitespace
+        parser->chunked = value_len >= 7 && http_parser_token_equals(value + value_len - 7, 7, "chunked") &&
+            (value_len == 7 || value[value_len - 8] == ',' || value[value_len - 8] == ' ' || value[value_len - 8] == '\t');
+    }
+    else if (http_parser_token_equals(line, name_len, "connection")) {
+        if (http_parser_token_equals(value, value_len, "close")) parser->keep_alive = false;
+        else if (http_parser_token_equals(value, value_len, "keep-alive")) parser->keep_alive = true;
+    }
+
+    if (parser->on_header != NULL) {
+        parser->on_header(parser->ctx, line, name_len, value, value_len);
+    }
+}
+
+static void http_parser_chunk_size_line(http_response_parser_t *parser, const char *line, size_t len) {
+    size_t size = 0;
+    size_t i = 0;
+
+    for (; i < len && isxdigit((unsigned char)line[i]); i++) {
+        char c = line[i];
+        size = (size << 4) | (size_t)(isdigit((unsigned char)c) ? c - '0' : (tolower((unsigned char)c) - 'a' + 10));
+        // Checked every digit, so the shift never overflows
+        if (size > HTTP_PARSER_MAX_BODY) {
+            parser->state = HTTP_PARSE_ERROR;
+            return;
+        }
+    }
+
+    // Chunk extensions after ';' are ignored
+    if (i == 0 || (i < len && line[i] != ';' && line[i] != ' ')) {
+        parser->state = HTTP_PARSE_ERROR;
+        return;
+    }
+
+    if (size == 0) {
+        parser->state = HTTP_PARSE_TRAILER;
+    } else {
+        parser->remaining = size;
+        parser->state = HTTP_PARSE_CHUNK_DATA;
+    }
+}
+
+static void http_parser_line(http_response_parser_t *parser, const char *line, size_t len) {
+    if (len > 0 && line[len - 1] == '\r') len--;
+
+    switch (parser->state) {
+        case HTTP_PARSE_STATUS:
+            http_parser_status_line(parser, line, len);
+            break;
+
+        case HTTP_PARSE_HEADER:
+            http_parser_header_line(parser, line, len);
+            break;
+
+        case HTTP_PARSE_CHUNK_SIZE:
+            http_parser_chunk_size_line(parser, line, len);
+            break;
+
+        case HTTP_PARSE_CHUNK_END:
+            parser->state = len == 0 ? HTTP_PARSE_CHUNK_SIZE : HTTP_PARSE_ERROR;
+            break;
+
+        case HTTP_PARSE_TRAILER:
+            if (len == 0) parser->state = HTTP_PARSE_DONE;
+            break;
+
+        default:
+            parser->state = HTTP_PARSE_ERROR;
+            break;
+    }
+}
+
+void http_parser_init(http_response_parser_t *parser, http_parser_header_cb on_header, http_parser_body_cb on_body, void *ctx) {
+    memset(parser, 0, sizeof(*parser));
+    parser->state = HTTP_PARSE_STATUS;
+    parser->content_length = -1;
+    parser->on_header = on_header;
+    parser->on_body = on_body;
+    parser->ctx = ctx;
+}
+
+size_t http_parser_feed(http_response_parser_t *parser, const char *data, size_t len) {
+    size_t pos = 0;
+
+    while (pos < len && parser->state != HTTP_PARSE_DONE && parser->state != HTTP_PARSE_ERROR) {
+        switch (parser->state) {
+            case HTTP_PARSE_BODY:
+            case HTTP_PARSE_CHUNK_DATA: {
+                size_t n = len - pos;
+                if (n > parser->remaining) n = parser->remaining;
+
+                if (parser->on_body != NULL) parser->on_body(parser->ctx, data + pos, n);
+                pos += n;
+                parser->remaining -= n;
+
+                if (parser->remaining == 0) {
+                    parser->state = parser->state == HTTP_PARSE_BODY ? HTTP_PARSE_DONE : HTTP_PARSE_CHUNK_END;
+                }
+                break;
+            }
+
+            case HTTP_PARSE_BODY_UNTIL_CLOSE:
+                if (parser->on_body != NULL) parser->on_body(parser->ctx, data + pos, len - pos);
+                pos = len;
+                break;
+
+            default: {
+                const char *newline = memchr(data + pos, '\n', len - pos);
+                size_t segment_len = newline != NULL ? (size_t)(newline - (data + pos)) : len - pos;
+
+                if (newline != NULL && parser->line_len == 0) {
+                    // The whole line is in this read, parse it in place
+                    http_parser_line(parser, data + pos, segment_len);
+                    pos += segment_len + 1;
+                    break;
+                }
+
+                if (parser->line_len + segment_len > sizeof(parser->line)) {
+                    parser->state = HTTP_PARSE_ERROR;
+                    break;
+                }
+
+                memcpy(parser->line + parser->line_len, data + pos, segment_len);
+                parser->line_len += segment_len;
+                pos += segment_len;
+
+                if (newline != NULL) {
+                    pos++;
+                    size_t line_len = parser->line_len;
+                    parser->line_len = 0;
+                    http_parser_line(parser, parser->line, line_len);
+                }
+                break;
+            }
+        }
+    }
+
+    return pos;
+}
+
+bool http_parser_on_close(http_response_parser_t *parser) {
+    if (parser->state == HTTP_PARSE_BODY_UNTIL_CLOSE) {
+        parser->state = HTTP_PARSE_DONE;
+    } else if (parser->state != HTTP_PARSE_DONE) {
+        parser->state = HTTP_PARSE_ERROR;
+    }
+
+    parser->keep_alive = false;
+
+    return parser->state == HTTP_PARSE_DONE;
+}
@@ -0,0 +1,242 @@
+#include "https_connection.h"
+#include "tls_session_cache.h"
+#include "credentials.h"
+
+#include <string.h>
+#include <errno.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+
+static const char *CONN_TAG = "HTTPS_CONN";
+
+static SemaphoreHandle_t connection_lock = NULL;
+static esp_tls_t *connection = NULL;
+static int64_t connection_last_used_us = 0;
+static https_connection_stats_t connection_stats = {0};
+
+/**
+ * A healthy idle session has nothing to read. If the socket reports EOF, an error or
+ * unsolicited data (such as a close_notify alert) the server has given up on it.
+ */
+static bool https_connection_is_alive(esp_tls_t *tls) {
+    if ((esp_timer_get_time() - connection_last_used_us) / 1000 > HTTPS_CONNECTION_MAX_IDLE_MS) {
+        return false;
+    }
+
+    int sockfd = -1;
+    if (esp_tls_get_conn_sockfd(tls, &sockfd) != ESP_OK || sockfd < 0) {
+        return false;
+    }
+
+    if (esp_tls_get_bytes_avail(tls) > 0) {
+        return false;
+    }
+
+    char peek;
+    int ret = recv(sockfd, &peek, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    return ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+static void https_connection_destroy() {
+    if (connection != NULL) {
+        esp_tls_conn_destroy(connection);
+        connection = NULL;
+    }
+}
+
+// Waits for a connect in progress, the socket turns writable once it is done
+static bool https_connection_wait_writable(int sockfd, int64_t deadline_us) {
+    int64_t remaining_us = deadline_us - esp_timer_get_time();
+    if (remaining_us <= 0) return false;
+
+    fd_set wset;
+    FD_ZERO(&wset);
+    FD_SET(sockfd, &wset);
+
+    struct timeval tv = {
+        .tv_sec = remaining_us / 1000000,
+        .tv_usec = remaining_us % 1000000
+    };
+
+    return select(sockfd + 1, NULL, &wset, NULL, &tv) > 0;
+}
+
+// The handshake and the requests after it block on the socket like a session made with esp_tls_conn_new_sync
+static bool https_connection_set_blocking(int sockfd, int timeout_ms) {
+    struct timeval tv = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000
+    };
+
+    int flags = fcntl(sockfd, F_GETFL, 0);
+
+    return flags >= 0 && fcntl(sockfd, F_SETFL, flags & ~O_NONBLOCK) == 0 &&
+           setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0 &&
+           setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == 0;
+}
+
+/**
+ * esp_tls_conn_new_sync does the TCP connect and the TLS handshake in one call. The async
+ * variant is stepped instead so the end of the connect can be timed on its own, the socket
+ * is made blocking as soon as it is connected so the handshake does not have to be polled.
+ */
+static bool https_connection_connect(esp_tls_t *tls, const esp_tls_cfg_t *cfg, int64_t *tcp_connected_us) {
+    int64_t deadline_us = esp_timer_get_time() + (int64_t)cfg->timeout_ms * 1000;
+
+    *tcp_connected_us = 0;
+
+    while (true) {
+        int ret = esp_tls_conn_new_async(SERVER_HOST, strlen(SERVER_HOST), HTTPS_SERVER_PORT, cfg, tls);
+        if (ret < 0) return false;
+
+        int sockfd = -1;
+        esp_tls_conn_state_t state = ESP_TLS_FAIL;
+        if (esp_tls_get_conn_sockfd(tls, &sockfd) != ESP_OK || esp_tls_get_conn_state(tls, &state) != ESP_OK) {
+            return false;
+        }
+
+        if (state == ESP_TLS_CONNECTING && !https_connection_wait_writable(sockfd, deadline_us)) break;
+
+        // If esp-tls waited for the connect itself, the mark also holds loading the certificates
+        if (*tcp_connected_us == 0) {
+            *tcp_connected_us = esp_timer_get_time();
+            if (!https_connection_set_blocking(sockfd, cfg->timeout_ms)) return false;
+        }
+
+        if (ret == 1) return true;
+        if (esp_timer_get_time() > deadline_us) break;
+    }
+
+    ESP_LOGE(CONN_TAG, "Connection timed out");
+    return false;
+}
+
+static esp_tls_t *https_connection_open(const esp_tls_cfg_t *cfg, int64_t *tcp_connected_us) {
+    esp_tls_t *tls = esp_tls_init();
+    if (!tls) {
+        ESP_LOGE(CONN_TAG, "Failed to allocate esp_tls handle!");
+        return NULL;
+    }
+
+    esp_tls_cfg_t session_cfg = *cfg;
+    session_cfg.client_session = tls_session_cache_get();
+    session_cfg.non_block = true;
+    bool resuming = session_cfg.client_session != NULL;
+
+    int64_t start_us = esp_timer_get_time();
+
+    if (https_connection_connect(tls, &session_cfg, tcp_connected_us)) {
+        int64_t elapsed_us = esp_timer_get_time() - start_us;
+
+        if (resuming) {
+            connection_stats.resumed++;
+            connection_stats.resumed_us += elapsed_us;
+        } else {
+            connection_stats.handshakes++;
+            connection_stats.handshake_us += elapsed_us;
+        }
+        ESP_LOGI(CONN_TAG, "Connection established in %d ms, TCP connect %d ms (%s)", (int)(elapsed_us / 1000),
+            (int)((*tcp_connected_us - start_us) / 1000), resuming ? "resumed" : "full");
+
+        tls_session_cache_store(tls);
+        return tls;
+    }
+
+    // A rejected ticket should not make every following handshake fail
+    if (resuming) {
+        tls_session_cache_clear();
+    }
+
+    ESP_LOGE(CONN_TAG, "Connection failed...");
+    int esp_tls_code = 0, esp_tls_flags = 0;
+    esp_tls_error_handle_t tls_e = NULL;
+    esp_tls_get_error_handle(tls, &tls_e);
+    /* Try to get TLS stack level error and certificate failure flags, if any */
+    if (esp_tls_get_and_clear_last_error(tls_e, &esp_tls_code, &esp_tls_flags) == ESP_OK) {
+        ESP_LOGE(CONN_TAG, "TLS error = -0x%x, TLS flags = -0x%x", esp_tls_code, esp_tls_flags);
+    }
+
+    connection_stats.failed++;
+    esp_tls_conn_destroy(tls);
+    return NULL;
+}
+
+esp_err_t https_connection_init() {
+    if (connection_lock != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    connection_lock = xSemaphoreCreateMutex();
+    if (connection_lock == NULL) {
+        ESP_LOGE(CONN_TAG, "Failed to create connection lock");
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+esp_tls_t *https_connection_acquire(const esp_tls_cfg_t *cfg, bool *reused, int64_t *tcp_connected_us) {
+    if (connection_lock == NULL || cfg == NULL) {
+        ESP_LOGE(CONN_TAG, "Connection manager not initialized");
+        return NULL;
+    }
+
+    xSemaphoreTake(connection_lock, portMAX_DELAY);
+
+    if (reused != NULL) *reused = false;
+    if (tcp_connected_us != NULL) *tcp_connected_us = 0;
+
+    if (connection != NULL) {
+        if (https_connection_is_alive(connection)) {
+            connection_stats.reused++;
+            if (reused != NULL) *reused = true;
+            return connection;
+        }
+
+        ESP_LOGW(CONN_TAG, "Session closed by server, reconnecting");
+        connection_stats.stale++;
+        https_connection_destroy();
+    }
+
+    int64_t connected_us = 0;
+    connection = https_connection_open(cfg, &connected_us);
+    if (connection == NULL) {
+        xSemaphoreGive(connection_lock);
+        return NULL;
+    }
+
+    if (tcp_connected_us != NULL) *tcp_connected_us = connected_us;
+
+    return connection;
+}
+
+void https_connection_release(bool keep_alive) {
+    if (connection_lock == NULL) return;
+
+    if (keep_alive) {
+        connection_last_used_us = esp_timer_get_time();
+    } else {
+        https_connection_destroy();
+    }
+
+    xSemaphoreGive(connection_lock);
+}
+
+void https_connection_close() {
+    if (connection_lock == NULL) return;
+
+    xSemaphoreTake(connection_lock, portMAX_DELAY);
+    https_connection_destroy();
+    xSemaphoreGive(connection_lock);
+}
+
+void https_connection_get_stats(https_connection_stats_t *out) {
+    if (out == NULL) return;
+
+    *out = connection_stats;
+}
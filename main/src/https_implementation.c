@@ -1,6 +1,12 @@
 #include "https_implementation.h"
+#include "https_connection.h"
+#include "http_response_parser.h"
+#include "pluto_payment.h"
+#include "txn_trace.h"
+#include "clock_discipline.h"
 
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <inttypes.h>
 #include <time.h>
@@ -29,6 +35,45 @@
 
 static const char *TAG = "HTTPS";
 
+typedef enum {
+    HTTPS_JOB_PREWARM,
+    HTTPS_JOB_POST,
+    HTTPS_JOB_CLOSE
+} https_job_type_t;
+
+typedef struct {
+    https_job_type_t type;
+    https_request_args_t *args;
+} https_job_t;
+
+// One extra entry so a pre-warm can be queued while every slot is busy
+#define HTTPS_WORK_QUEUE_LEN (HTTPS_REQUEST_SLOTS + 1)
+
+// Everything the worker needs is allocated once, so heap usage does not grow per payment
+static https_request_args_t request_slots[HTTPS_REQUEST_SLOTS];
+static QueueHandle_t free_slots = NULL;
+static StaticQueue_t free_slots_buffer;
+static uint8_t free_slots_storage[HTTPS_REQUEST_SLOTS * sizeof(https_request_args_t*)];
+
+static QueueHandle_t work_queue = NULL;
+static StaticQueue_t work_queue_buffer;
+static uint8_t work_queue_storage[HTTPS_WORK_QUEUE_LEN * sizeof(https_job_t)];
+
+static StaticTask_t worker_tcb;
+static StackType_t worker_stack[HTTPS_TASK_STACK_DEPTH];
+
+static volatile bool prewarm_running = false;
+// Constant part of every request, assembled at compile time
+#define HTTPS_REQUEST_HEADER_TEMPLATE \
+    "POST " PLUTO_PAYMENT_API " HTTP/1.1\r\n" \
+    "Host: " SERVER_HOST "\r\n" \
+    "User-Agent: esp-idf/1.0 esp32\r\n" \
+    "Connection: keep-alive\r\n" \
+    "Content-Type: " PLUTO_PAYMENT_CONTENT_TYPE "\r\n"
+
+// Time the last pre-warm spent setting up a session, consumed by the next request
+static int64_t prewarm_connect_us = 0;
+
 // Maps out where in the firmware our server certificate exists
 extern const uint8_t ca_root_cert_pem_start[] asm("_binary_ca_cert_pem_start");
 extern const uint8_t ca_root_cert_pem_end[]   asm("_binary_ca_cert_pem_end");
@@ -39,99 +84,205 @@ extern const uint8_t pluto_cert_pem_end[]       asm("_binary_client_cert_pem_end
 extern const uint8_t pluto_key_pem_start[]      asm("_binary_client_key_pem_start");
 extern const uint8_t pluto_key_pem_end[]        asm("_binary_client_key_pem_end");
 
-void https_send_request(esp_tls_cfg_t cfg, https_request_args_t *args)
-{
-    bool got_status_line = false;
-    char buf[MAX_HTTPS_OUTPUT_BUFFER + 1];
-    uint8_t request_buf_index = 0;
-    int ret, len;
-
-    esp_tls_t *tls = esp_tls_init();
-    if (!tls) {
-        ESP_LOGE(TAG, "Failed to allocate esp_tls handle!");
-        return;
+/*
+    Whether a failed exchange may be retried depends on how far the request got. Until the last
+    byte is written the server cannot have acted on it. After that it may have charged the card,
+    and sending it again on a new session could charge it twice.
+*/
+typedef enum {
+    HTTPS_EXCHANGE_OK,
+    HTTPS_EXCHANGE_FAILED,      // answered, but the response was unusable
+    HTTPS_EXCHANGE_NOT_SENT,    // write failed, safe to retry
+    HTTPS_EXCHANGE_NO_ANSWER    // written in full, no answer, never retried
+} https_exchange_result_t;
+
+typedef struct {
+    https_request_args_t *args;
+    size_t body_len;
+    bool truncated;
+    int64_t written_us;     // esp_timer time the request was out, the earliest the server could answer
+} https_response_ctx_t;
+
+// Every response carries the server's time, which keeps the clock within a second between SNTP syncs
+static void https_on_header(void *ctx, const char *name, size_t name_len, const char *value, size_t value_len) {
+    https_response_ctx_t *response = (https_response_ctx_t*)ctx;
+    time_t date;
+
+    if (name_len != 4 || strncasecmp(name, "Date", 4) != 0) return;
+
+    if (clock_parse_http_date(value, value_len, &date)) {
+        clock_discipline_http_date(date, response->written_us, esp_timer_get_time());
+    } else {
+        ESP_LOGW(TAG, "Unreadable Date header");
     }
+}
 
-    if (esp_tls_conn_http_new_sync(args->url, &cfg, tls) == 1) {
-        ESP_LOGI(TAG, "Connection established...");
-    } else {
-        ESP_LOGE(TAG, "Connection failed...");
-        int esp_tls_code = 0, esp_tls_flags = 0;
-        esp_tls_error_handle_t tls_e = NULL;
-        esp_tls_get_error_handle(tls, &tls_e);
-        /* Try to get TLS stack level error and certificate failure flags, if any */
-        ret = esp_tls_get_and_clear_last_error(tls_e, &esp_tls_code, &esp_tls_flags);
-        if (ret == ESP_OK) {
-            ESP_LOGE(TAG, "TLS error = -0x%x, TLS flags = -0x%x", esp_tls_code, esp_tls_flags);
-        }
-        goto cleanup;
+static void https_on_body(void *ctx, const char *data, size_t len) {
+    https_response_ctx_t *response = (https_response_ctx_t*)ctx;
+    size_t space = MAX_HTTPS_OUTPUT_BUFFER - response->body_len;
+
+    if (len > space) {
+        response->truncated = true;
+        len = space;
     }
 
+    memcpy(response->args->response_buffer + response->body_len, data, len);
+    response->body_len += len;
+}
+
+// A socket timeout comes back as WANT_READ or WANT_WRITE, so a session that went quiet would be retried forever
+static bool https_timed_out(int64_t since_us) {
+    return esp_timer_get_time() - since_us > (int64_t)MAX_TIMEOUT_MS * 1000;
+}
+
+static bool https_write_all(esp_tls_t *tls, const char *data, size_t len) {
     size_t written_bytes = 0;
-    do {
-        ret = esp_tls_conn_write(tls,
-                                 args->request + written_bytes,
-                                 strlen(args->request) - written_bytes);
+    int64_t progress_us = esp_timer_get_time();
+
+    while (written_bytes < len) {
+        int ret = esp_tls_conn_write(tls, data + written_bytes, len - written_bytes);
         if (ret >= 0) {
-            ESP_LOGI(TAG, "%d bytes written", ret);
             written_bytes += ret;
+            progress_us = esp_timer_get_time();
         } else if (ret != ESP_TLS_ERR_SSL_WANT_READ  && ret != ESP_TLS_ERR_SSL_WANT_WRITE) {
             ESP_LOGE(TAG, "esp_tls_conn_write  returned: [0x%02X](%s)", ret, esp_err_to_name(ret));
-            goto cleanup;
+            return false;
+        } else if (https_timed_out(progress_us)) {
+            ESP_LOGE(TAG, "Write timed out");
+            return false;
         }
-    } while (written_bytes < strlen(args->request));
+    }
+
+    ESP_LOGI(TAG, "%d bytes written", (int)written_bytes);
+    return true;
+}
+
+/**
+ * Writes the request on an open session and feeds every read to the response parser.
+ * Reading stops as soon as the parser has the whole body, the body alone is kept in
+ * args->response_buffer.
+ */
+static https_exchange_result_t https_exchange(esp_tls_t *tls, https_request_args_t *args, bool *keep_alive) {
+    char buf[MAX_HTTPS_OUTPUT_BUFFER];
+    size_t received = 0;
+    int ret;
+
+    https_response_ctx_t response = {
+        .args = args
+    };
+    http_response_parser_t parser;
+    http_parser_init(&parser, https_on_header, https_on_body, &response);
+
+    *keep_alive = false;
 
-    memset(args->response_buffer, 0, MAX_HTTPS_OUTPUT_BUFFER);
+    const char *segments[] = {HTTPS_REQUEST_HEADER_TEMPLATE, args->header_tail, args->request_body};
+    size_t segment_lens[] = {sizeof(HTTPS_REQUEST_HEADER_TEMPLATE) - 1, args->header_tail_len, args->request_body_len};
 
-    do {
-        len = sizeof(buf) - 1;
-        memset(buf, 0x00, sizeof(buf));
-        ret = esp_tls_conn_read(tls, (char *)buf, len);
+    for (uint8_t i = 0; i < sizeof(segments) / sizeof(segments[0]); i++) {
+        if (!https_write_all(tls, segments[i], segment_lens[i])) {
+            return HTTPS_EXCHANGE_NOT_SENT;
+        }
+        if (args->first_byte_us == 0) args->first_byte_us = esp_timer_get_time();
+    }
+    response.written_us = esp_timer_get_time();
+    args->sent = true;
+    txn_trace_mark(TXN_STAGE_REQUEST_WRITTEN);
+
+    int64_t progress_us = response.written_us;
+
+    while (!http_parser_is_done(&parser)) {
+        ret = esp_tls_conn_read(tls, buf, sizeof(buf));
 
         if (ret == ESP_TLS_ERR_SSL_WANT_WRITE || ret == ESP_TLS_ERR_SSL_WANT_READ) {
-            continue;
+            if (!https_timed_out(progress_us)) continue;
+
+            ESP_LOGE(TAG, "Read timed out");
+            return received == 0 ? HTTPS_EXCHANGE_NO_ANSWER : HTTPS_EXCHANGE_FAILED;
         } else if (ret < 0) {
             ESP_LOGE(TAG, "esp_tls_conn_read returned [-0x%02X](%s)", -ret, esp_err_to_name(ret));
-            break;
+            return received == 0 ? HTTPS_EXCHANGE_NO_ANSWER : HTTPS_EXCHANGE_FAILED;
         } else if (ret == 0) {
             ESP_LOGI(TAG, "connection closed");
+            if (received == 0) return HTTPS_EXCHANGE_NO_ANSWER;
+            if (!http_parser_on_close(&parser)) return HTTPS_EXCHANGE_FAILED;
             break;
         }
 
-        buf[ret] = '\0';
+        if (received == 0) txn_trace_mark(TXN_STAGE_FIRST_BYTE);
+        received += ret;
+        progress_us = esp_timer_get_time();
+
+        // Anything after the end of the response means we are out of sync with the server
+        if (http_parser_feed(&parser, buf, ret) < (size_t)ret) {
+            parser.keep_alive = false;
+        }
+
+        if (http_parser_has_error(&parser)) {
+            ESP_LOGE(TAG, "Malformed response");
+            return HTTPS_EXCHANGE_FAILED;
+        }
+    }
+
+    if (response.truncated) {
+        ESP_LOGW(TAG, "Response body truncated to %d bytes", MAX_HTTPS_OUTPUT_BUFFER);
+    }
+
+    args->response_buffer[response.body_len] = '\0';
+    args->response_len = response.body_len;
+    args->http_status = parser.status_code;
+    args->status = ESP_OK;
+    *keep_alive = parser.keep_alive;
+    txn_trace_mark(TXN_STAGE_BODY_COMPLETE);
 
-        if (!got_status_line) {
-            got_status_line = true;
-            args->status = ESP_FAIL;
+    return HTTPS_EXCHANGE_OK;
+}
+
+// Marks the stages of a new session in the current transaction, a reused session marks nothing
+static void https_trace_connect(int64_t start_us, int64_t tcp_connected_us) {
+    if (tcp_connected_us == 0) return;
 
-            char *status_line = strtok((char *)buf, "\r\n");
-            if (status_line && strncmp(status_line, "HTTP/", 5) == 0) {
-                int status_code = atoi(status_line + 9);
+    txn_trace_mark_at(TXN_STAGE_CONNECT_STARTED, start_us);
+    txn_trace_mark_at(TXN_STAGE_TCP_CONNECTED, tcp_connected_us);
+    txn_trace_mark(TXN_STAGE_TLS_ESTABLISHED);
+}
 
-                args->status = (status_code == 200) ? ESP_OK : ESP_FAIL;
-            }
+void https_send_request(const esp_tls_cfg_t *cfg, https_request_args_t *args)
+{
+    // A reused session can be closed by the server after the liveness check, retry once on a fresh
+    // one, but only if the write failed. A request that went out in full is never sent twice.
+    for (uint8_t attempt = 0; attempt < 2; attempt++) {
+        bool reused = false;
+        bool keep_alive = false;
+
+        int64_t tcp_connected_us = 0;
+
+        int64_t acquire_start_us = esp_timer_get_time();
+        esp_tls_t *tls = https_connection_acquire(cfg, &reused, &tcp_connected_us);
+        if (tls == NULL) return;
+        https_trace_connect(acquire_start_us, tcp_connected_us);
+
+        if (attempt == 0 && prewarm_connect_us > 0) {
+            int64_t waited_us = esp_timer_get_time() - acquire_start_us;
+            ESP_LOGI(TAG, "Pre-warm overlapped %d ms of connection setup",
+                reused ? (int)((prewarm_connect_us - waited_us) / 1000) : 0);
+            prewarm_connect_us = 0;
         }
 
-        if(request_buf_index + ret < MAX_HTTPS_OUTPUT_BUFFER - 1){
-            for(int i = 0; i < ret; i++) {
-                args->response_buffer[request_buf_index++] = buf[i];
-            }
-    
-            args->response_buffer[request_buf_index++] = '\n';
-        } else {
-            ESP_LOGE(TAG, "Response buffer overflow");
-            break;
+        https_exchange_result_t result = https_exchange(tls, args, &keep_alive);
+        https_connection_release(result == HTTPS_EXCHANGE_OK && keep_alive);
+
+        if (result == HTTPS_EXCHANGE_NO_ANSWER) {
+            ESP_LOGE(TAG, "Request sent but not answered, not retrying");
+            return;
         }
-    } while (1);
 
-    args->response_buffer[request_buf_index++] = '\0';
+        if (result != HTTPS_EXCHANGE_NOT_SENT || !reused) return;
 
-cleanup:
-    esp_tls_conn_destroy(tls);
+        ESP_LOGW(TAG, "Reused session dropped before the request was sent, retrying with new handshake");
+    }
 }
 
-void https_send_with_cert(https_request_args_t *args)
-{
+static esp_tls_cfg_t https_build_cfg() {
     esp_tls_cfg_t cfg = {
         .cacert_buf = (const unsigned char *) ca_root_cert_pem_start,
         .cacert_bytes = ca_root_cert_pem_end - ca_root_cert_pem_start,
@@ -140,119 +291,211 @@ void https_send_with_cert(https_request_args_t *args)
         .clientcert_bytes = pluto_cert_pem_end - pluto_cert_pem_start,
 
         .clientkey_buf = (const unsigned char*) pluto_key_pem_start,
-        .clientkey_bytes = pluto_key_pem_end - pluto_key_pem_start
+        .clientkey_bytes = pluto_key_pem_end - pluto_key_pem_start,
+
+        .timeout_ms = MAX_TIMEOUT_MS
     };
 
-    https_send_request(cfg, args);
+    return cfg;
 }
 
-void https_post_task(void *pvparameters)
+static void https_prewarm(const esp_tls_cfg_t *cfg)
 {
-    https_request_args_t *args = (https_request_args_t*) pvparameters;
-    
-    https_send_with_cert(args);
+    bool reused = false;
+    int64_t tcp_connected_us = 0;
 
-    if(args->caller != NULL) {
-        xTaskNotifyGive(args->caller);
+    // Queued by pluto_start_payment, the session it opens belongs to that payment's transaction
+    int64_t start_us = esp_timer_get_time();
+    esp_tls_t *tls = https_connection_acquire(cfg, &reused, &tcp_connected_us);
+
+    if (tls != NULL) {
+        https_trace_connect(start_us, tcp_connected_us);
+        prewarm_connect_us = reused ? 0 : esp_timer_get_time() - start_us;
+        https_connection_release(true);
     }
-    vTaskDelete(NULL);
 }
 
-void set_request_url(https_request_args_t *args) {
-    memset(args->url, 0, HTTPS_MAX_URL_SIZE);
-    snprintf(args->url, HTTPS_MAX_URL_SIZE, "https://%s%s", SERVER_HOST, PLUTO_PAYMENT_API);
+static void https_worker_task(void *pvparameters)
+{
+    esp_tls_cfg_t cfg = https_build_cfg();
+    https_job_t job;
+
+    while (true) {
+        if (!xQueueReceive(work_queue, &job, portMAX_DELAY)) continue;
+
+        if (job.type == HTTPS_JOB_PREWARM) {
+            https_prewarm(&cfg);
+            prewarm_running = false;
+            continue;
+        }
+
+        if (job.type == HTTPS_JOB_CLOSE) {
+            https_connection_close();
+            continue;
+        }
+
+        https_send_request(&cfg, job.args);
+
+        // The slot can be reused as soon as done is given, so the callback runs first while the handle is still ours
+        if (job.args->on_done != NULL) {
+            job.args->on_done(job.args, job.args->on_done_ctx);
+        }
+        xSemaphoreGive(job.args->done);
+    }
 }
 
-esp_err_t build_request(https_request_args_t *args) {
-    memset(args->request, 0, MAX_HTTPS_REQUEST_BUFFER +1);
-    
-    char content_length[64] = "";
-    snprintf(content_length, sizeof(content_length),
-            "Content-Length: %d", (int)strlen(args->request_body));
+esp_err_t https_worker_init() {
+    if (work_queue != NULL) {
+        ESP_LOGE(TAG, "HTTPS worker already initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t err = https_connection_init();
+    if (err != ESP_OK) return err;
 
-    int written = snprintf(args->request, MAX_HTTPS_REQUEST_BUFFER + 1,
-        "POST %s HTTP/1.1\r\n"
-        "Host: %s\r\n"
-        "Authorization: %s\r\n"
-        "User-Agent: esp-idf/1.0 esp32\r\n"
-        "Connection: close\r\n"
-        "Content-Type: application/json\r\n"
-        "%s\r\n"
-        "\r\n"
-        "%s",
-        PLUTO_PAYMENT_API, 
-        SERVER_HOST,
-        args->hmac,
-        content_length,
-        args->request_body);
-    
-    if (written < 0 || written >= MAX_HTTPS_REQUEST_BUFFER + 1) {
-        ESP_LOGE(TAG, "Unable to create request");
+    free_slots = xQueueCreateStatic(HTTPS_REQUEST_SLOTS, sizeof(https_request_args_t*), free_slots_storage, &free_slots_buffer);
+    work_queue = xQueueCreateStatic(HTTPS_WORK_QUEUE_LEN, sizeof(https_job_t), work_queue_storage, &work_queue_buffer);
+
+    for (uint8_t i = 0; i < HTTPS_REQUEST_SLOTS; i++) {
+        https_request_args_t *slot = &request_slots[i];
+        slot->done = xSemaphoreCreateBinaryStatic(&slot->done_buffer);
+        xQueueSend(free_slots, &slot, 0);
+    }
+
+    if (xTaskCreateStatic(https_worker_task, "https_worker_task", HTTPS_TASK_STACK_DEPTH, NULL,
+                          HTTPS_WORKER_PRIORITY, worker_stack, &worker_tcb) == NULL) {
+        ESP_LOGE(TAG, "Unable to start HTTPS worker");
         return ESP_FAIL;
     }
 
     return ESP_OK;
 }
 
-// Solution found online for extracting body from http response
-static char* extract_body(char *resp) {
-    char *p = strstr(resp, "\r\n\r\n");
-    if (!p) p = strstr(resp, "\n\n");
-    return p ? p + ((p[1] == '\n' && p[-1] == '\r') ? 4 : 2) : resp;
+void https_prewarm_connection() {
+    if (work_queue == NULL || prewarm_running) return;
+
+    https_job_t job = {
+        .type = HTTPS_JOB_PREWARM
+    };
+
+    prewarm_running = true;
+    if (xQueueSend(work_queue, &job, 0) != pdPASS) {
+        ESP_LOGW(TAG, "HTTPS worker busy, skipping pre-warm");
+        prewarm_running = false;
+    }
+}
+
+void https_close_connection() {
+    if (work_queue == NULL) return;
+
+    https_job_t job = {
+        .type = HTTPS_JOB_CLOSE
+    };
+
+    // A session left open is found dead by the liveness check before the next request anyway
+    if (xQueueSend(work_queue, &job, 0) != pdPASS) {
+        ESP_LOGW(TAG, "HTTPS worker busy, session left to the liveness check");
+    }
 }
 
-esp_err_t https_create_and_send_request(char *request_body, char *hmac, char *out, size_t out_size) {
-    https_request_args_t *args = (https_request_args_t*)calloc(1, sizeof(https_request_args_t));
+// Only Authorization and Content-Length change between requests
+static esp_err_t build_header_tail(https_request_args_t *args, const char *hmac) {
+    int written = snprintf(args->header_tail, sizeof(args->header_tail),
+        "Authorization: %s\r\n"
+        "Content-Length: %u\r\n"
+        "\r\n",
+        hmac,
+        (unsigned)args->request_body_len);
 
-    if (args == NULL) {
-        ESP_LOGE(TAG, "Unable to heap allocate args");
+    if (written < 0 || written >= (int)sizeof(args->header_tail)) {
+        ESP_LOGE(TAG, "Unable to create request");
         return ESP_FAIL;
     }
 
-    snprintf(args->hmac, sizeof(args->hmac), "%s", hmac);
-    snprintf(args->request_body, sizeof(args->request_body), "%s", request_body);
-    args->caller = xTaskGetCurrentTaskHandle();
+    args->header_tail_len = written;
+    return ESP_OK;
+}
+
+esp_err_t https_submit_request(const char *request_body, size_t request_body_len, const char *hmac,
+                               https_done_cb_t on_done, void *on_done_ctx, https_request_handle_t *out) {
+    if (work_queue == NULL || out == NULL) {
+        ESP_LOGE(TAG, "HTTPS worker not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    https_request_args_t *args = NULL;
+    if (!xQueueReceive(free_slots, &args, 0)) {
+        ESP_LOGE(TAG, "No free request slot");
+        return ESP_ERR_NO_MEM;
+    }
+
+    args->request_body = request_body;
+    args->request_body_len = request_body_len;
     args->status = ESP_FAIL;
+    args->response_buffer[0] = '\0';
+    args->response_len = 0;
+    args->http_status = 0;
     args->https_request_type = POST;
+    args->on_done = on_done;
+    args->on_done_ctx = on_done_ctx;
+    args->first_byte_us = 0;
+    args->sent = false;
 
-    set_request_url(args);
-    build_request(args);
+    if (build_header_tail(args, hmac) != ESP_OK) {
+        xQueueSend(free_slots, &args, 0);
+        return ESP_FAIL;
+    }
 
-    xTaskCreate(https_post_task, "https_post_task", HTTPS_TASK_STACK_DEPTH, args, 5, NULL);
+    https_job_t job = {
+        .type = HTTPS_JOB_POST,
+        .args = args
+    };
 
-    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    // The work queue has room for every slot, so this can only fail if the queue is corrupt
+    if (xQueueSend(work_queue, &job, 0) != pdPASS) {
+        xQueueSend(free_slots, &args, 0);
+        return ESP_FAIL;
+    }
 
-    esp_err_t post_status = args->status;
+    *out = args;
+    return ESP_OK;
+}
 
-    char *temp_body = extract_body(args->response_buffer);
-    char body[HTTPS_MAX_RESPONSE_BODY_LCD] = {0};
-    size_t body_index = 0;
+int64_t https_request_first_byte_us(https_request_handle_t handle) {
+    return handle != NULL ? handle->first_byte_us : 0;
+}
 
-    // TRIM STARTING CRLF
-    while (*temp_body == '\r' || *temp_body == '\n') temp_body++;
+bool https_request_is_done(https_request_handle_t handle) {
+    return handle != NULL && uxSemaphoreGetCount(handle->done) > 0;
+}
 
-    while (*temp_body && isascii((unsigned char)*temp_body) && body_index < sizeof(body) - 1) {
-        unsigned char c = (unsigned char)*temp_body++;
+esp_err_t https_wait_for_response(https_request_handle_t handle, payment_response_t *response) {
+    if (handle == NULL || response == NULL) return ESP_ERR_INVALID_ARG;
 
-        // REMOVE CR
-        if (c == '\r') continue;
+    xSemaphoreTake(handle->done, portMAX_DELAY);
 
-        body[body_index++] = (char)c;
+    if (handle->status != ESP_OK) {
+        payment_response_no_answer(response, handle->sent);
+    } else if (payment_response_parse(handle->http_status, handle->response_buffer, handle->response_len, response) != ESP_OK) {
+        ESP_LOGW(TAG, "Response %d did not match the schema", (int)handle->http_status);
     }
 
-    // TRIM CRLF
-    while (body_index && (body[body_index-1] == '\n' || body[body_index-1] == '\r')) {
-        body_index--;
+    esp_err_t post_status = ESP_OK;
+    if (handle->status != ESP_OK) {
+        post_status = handle->sent ? ESP_ERR_TIMEOUT : ESP_FAIL;
+    } else if (response->result != PAYMENT_RESULT_APPROVED) {
+        post_status = ESP_ERR_INVALID_RESPONSE;
     }
-    body[body_index] = '\0';
 
-    if (strlen(body) > 32) {
-        snprintf(out, out_size, "Unkown error");
-    } else {
-        snprintf(out, out_size, "%s", body);
-    }
+    xQueueSend(free_slots, &handle, 0);
 
-    free(args);
+    https_connection_stats_t stats;
+    https_connection_get_stats(&stats);
+    ESP_LOGI(TAG, "Sessions reused: %lu, full handshakes: %lu (avg %lu ms), resumed: %lu (avg %lu ms), stale: %lu",
+        (unsigned long)stats.reused,
+        (unsigned long)stats.handshakes, (unsigned long)(stats.handshakes ? stats.handshake_us / stats.handshakes / 1000 : 0),
+        (unsigned long)stats.resumed, (unsigned long)(stats.resumed ? stats.resumed_us / stats.resumed / 1000 : 0),
+        (unsigned long)stats.stale);
 
     return post_status;
-}
\ No newline at end of file
+}
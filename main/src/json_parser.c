@@ -0,0 +1,265 @@
+/*
+    Minimal JSON tokenizer in the style of jsmn. Tokens are offsets into the input and live in
+    a caller provided array, so parsing never touches the heap.
+*/
+
+#include "json_parser.h"
+
+#include <string.h>
+#include <ctype.h>
+
+static int json_hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static int json_add_token(json_token_t *tokens, size_t max_tokens, int *count, json_token_type_t type, size_t start, size_t end) {
+    if ((size_t)*count >= max_tokens) return JSON_ERROR_NO_TOKENS;
+    if (end > UINT16_MAX) return JSON_ERROR_INVALID;
+
+    json_token_t *token = &tokens[*count];
+    token->type = type;
+    token->start = (uint16_t)start;
+    token->end = (uint16_t)end;
+    token->size = 0;
+
+    return (*count)++;
+}
+
+int json_tokenize(const char *json, size_t len, json_token_t *tokens, size_t max_tokens) {
+    int stack[JSON_MAX_DEPTH];
+    int depth = 0;
+    int count = 0;
+
+    for (size_t pos = 0; pos < len; pos++) {
+        char c = json[pos];
+        int index;
+
+        switch (c) {
+            case '{':
+            case '[':
+                if (depth >= JSON_MAX_DEPTH) return JSON_ERROR_INVALID;
+                if (depth > 0 && tokens[stack[depth - 1]].type == JSON_TOKEN_OBJECT && (tokens[stack[depth - 1]].size & 1) == 0) {
+                    return JSON_ERROR_INVALID;
+                }
+
+                index = json_add_token(tokens, max_tokens, &count, c == '{' ? JSON_TOKEN_OBJECT : JSON_TOKEN_ARRAY, pos, pos);
+                if (index < 0) return index;
+
+                if (depth > 0) tokens[stack[depth - 1]].size++;
+                stack[depth++] = index;
+                break;
+
+            case '}':
+            case ']': {
+                if (depth == 0) return JSON_ERROR_INVALID;
+
+                json_token_t *open = &tokens[stack[depth - 1]];
+                if (open->type != (c == '}' ? JSON_TOKEN_OBJECT : JSON_TOKEN_ARRAY)) return JSON_ERROR_INVALID;
+                // An object holds key and value pairs
+                if (open->type == JSON_TOKEN_OBJECT && (open->size & 1) != 0) return JSON_ERROR_INVALID;
+
+                open->end = (uint16_t)(pos + 1);
+                depth--;
+                break;
+            }
+
+            case '"': {
+                size_t start = pos + 1;
+                for (pos = start; pos < len && json[pos] != '"'; pos++) {
+                    if (json[pos] == '\\') pos++;
+                }
+                if (pos >= len) return JSON_ERROR_PARTIAL;
+
+                // Object keys must be strings
+                if (depth > 0 && tokens[stack[depth - 1]].type == JSON_TOKEN_OBJECT && (tokens[stack[depth - 1]].size & 1) == 0) {
+                    size_t next = pos + 1;
+                    while (next < len && isspace((unsigned char)json[next])) next++;
+                    if (next >= len) return JSON_ERROR_PARTIAL;
+                    if (json[next] != ':') return JSON_ERROR_INVALID;
+                }
+
+                index = json_add_token(tokens, max_tokens, &count, JSON_TOKEN_STRING, start, pos);
+                if (index < 0) return index;
+
+                if (depth > 0) tokens[stack[depth - 1]].size++;
+                break;
+            }
+
+            case ' ':
+            case '\t':
+            case '\r':
+            case '\n':
+            case ':':
+            case ',':
+                break;
+
+            default: {
+                if (c != '-' && !isdigit((unsigned char)c) && c != 't' && c != 'f' && c != 'n') return JSON_ERROR_INVALID;
+                if (depth > 0 && tokens[stack[depth - 1]].type == JSON_TOKEN_OBJECT && (tokens[stack[depth - 1]].size & 1) == 0) {
+                    return JSON_ERROR_INVALID;
+                }
+
+                size_t start = pos;
+                while (pos < len && strchr(",]} \t\r\n", json[pos]) == NULL && json[pos] != '\0') pos++;
+
+                index = json_add_token(tokens, max_tokens, &count, JSON_TOKEN_PRIMITIVE, start, pos);
+                if (index < 0) return index;
+
+                if (depth > 0) tokens[stack[depth - 1]].size++;
+                pos--;
+                break;
+            }
+        }
+    }
+
+    return depth == 0 ? count : JSON_ERROR_PARTIAL;
+}
+
+int json_skip(const json_token_t *tokens, int count, int index) {
+    if (index >= count) return count;
+
+    int next = index + 1;
+    if (tokens[index].type == JSON_TOKEN_OBJECT || tokens[index].type == JSON_TOKEN_ARRAY) {
+        for (uint16_t i = 0; i < tokens[index].size && next < count; i++) {
+            next = json_skip(tokens, count, next);
+        }
+    }
+
+    return next;
+}
+
+bool json_token_equals(const char *json, const json_token_t *token, const char *value, size_t value_len) {
+    return (size_t)(token->end - token->start) == value_len &&
+           memcmp(json + token->start, value, value_len) == 0;
+}
+
+int json_object_get(const char *json, const json_token_t *tokens, int count, int object, const char *key) {
+    if (object >= count || tokens[object].type != JSON_TOKEN_OBJECT) return -1;
+
+    size_t key_len = strlen(key);
+    int index = object + 1;
+
+    for (uint16_t i = 0; i + 1 < tokens[object].size && index + 1 < count; i += 2) {
+        if (json_token_equals(json, &tokens[index], key, key_len)) {
+            return index + 1;
+        }
+        index = json_skip(tokens, count, index + 1);
+    }
+
+    return -1;
+}
+
+esp_err_t json_token_copy_string(const char *json, const json_token_t *token, char *out, size_t out_size) {
+    if (token->type != JSON_TOKEN_STRING || out_size == 0) return ESP_ERR_INVALID_ARG;
+
+    size_t written = 0;
+
+    for (size_t pos = token->start; pos < token->end; pos++) {
+        char c = json[pos];
+
+        if (c == '\\' && pos + 1 < token->end) {
+            c = json[++pos];
+            switch (c) {
+                case 'n': c = '\n'; break;
+                case 'r': c = '\r'; break;
+                case 't': c = '\t'; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'u': {
+                    int code = 0;
+                    if (pos + 4 >= token->end) return ESP_ERR_INVALID_ARG;
+                    for (uint8_t i = 1; i <= 4; i++) {
+                        int digit = json_hex_value(json[pos + i]);
+                        if (digit < 0) return ESP_ERR_INVALID_ARG;
+                        code = (code << 4) | digit;
+                    }
+                    pos += 4;
+                    // The lcd has no use for anything outside ascii
+                    c = code < 0x80 ? (char)code : '?';
+                    break;
+                }
+                default: break;
+            }
+        }
+
+        if (written + 1 >= out_size) {
+            out[written] = '\0';
+            return ESP_ERR_INVALID_SIZE;
+        }
+        out[written++] = c;
+    }
+
+    out[written] = '\0';
+    return ESP_OK;
+}
+
+esp_err_t json_token_to_int(const char *json, const json_token_t *token, int64_t *out) {
+    size_t pos = token->start;
+    bool negative = false;
+    int64_t value = 0;
+
+    if (pos < token->end && json[pos] == '-') {
+        negative = true;
+        pos++;
+    }
+    if (pos >= token->end) return ESP_ERR_INVALID_ARG;
+
+    for (; pos < token->end; pos++) {
+        if (!isdigit((unsigned char)json[pos]) || value > (INT64_MAX - 9) / 10) return ESP_ERR_INVALID_ARG;
+        value = value * 10 + (json[pos] - '0');
+    }
+
+    *out = negative ? -value : value;
+    return ESP_OK;
+}
+
+esp_err_t json_token_to_minor_units(const char *json, const json_token_t *token, uint8_t decimals, int64_t *out) {
+    size_t pos = token->start;
+    int64_t value = 0;
+    bool digits = false;
+    bool point = false;
+    uint8_t decimals_read = 0;
+
+    for (; pos < token->end; pos++) {
+        char c = json[pos];
+
+        if (c == '.' && !point) {
+            point = true;
+            continue;
+        }
+        if (!isdigit((unsigned char)c) || value > (INT64_MAX - 9) / 10) return ESP_ERR_INVALID_ARG;
+        if (point && ++decimals_read > decimals) return ESP_ERR_INVALID_ARG;
+
+        value = value * 10 + (c - '0');
+        digits = true;
+    }
+
+    if (!digits) return ESP_ERR_INVALID_ARG;
+
+    for (; decimals_read < decimals; decimals_read++) {
+        if (value > INT64_MAX / 10) return ESP_ERR_INVALID_ARG;
+        value *= 10;
+    }
+
+    *out = value;
+    return ESP_OK;
+}
+
+esp_err_t json_token_hex_to_bytes(const char *json, const json_token_t *token, uint8_t *out, size_t out_len) {
+    if (token->type != JSON_TOKEN_STRING || (size_t)(token->end - token->start) != out_len * 2) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (size_t i = 0; i < out_len; i++) {
+        int high = json_hex_value(json[token->start + i * 2]);
+        int low = json_hex_value(json[token->start + i * 2 + 1]);
+        if (high < 0 || low < 0) return ESP_ERR_INVALID_ARG;
+
+        out[i] = (uint8_t)((high << 4) | low);
+    }
+
+    return ESP_OK;
+}
@@ -1,35 +1,257 @@
+/*
+    Idle, every row is driven low and the columns wait on pull-ups with an interrupt armed.
+    A press pulls its column low, the interrupt stamps the time, disarms itself and starts the
+    scan timer. The timer callback scans the matrix until the same key is seen on consecutive
+    scans, posts it, and keeps scanning until everything is released before arming again.
+    Between presses no task, timer or interrupt runs.
+*/
+
 #include "keypad_implementation.h"
 #include "pluto_events.h"
+#include "project_config.h"
+#include "error_checks.h"
 
 #include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "freertos/queue.h"
+#include "freertos/timers.h"
+#include "driver/gpio.h"
+#include "esp_rom_sys.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include <stdbool.h>
+#include <string.h>
+
+static const char *KEYPAD_TAG = "KEYPAD";
+
+#define KEYPAD_NO_KEY '\0'
+
+static const gpio_num_t row_pins[KEYPAD_ROWS] = KEYPAD_ROW_PINS;
+static const gpio_num_t col_pins[KEYPAD_COLS] = KEYPAD_COL_PINS;
+static const char key_map[KEYPAD_ROWS][KEYPAD_COLS + 1] = KEYPAD_KEY_MAP;
+
+static event_bus_handle_t key_bus = NULL;
+static TimerHandle_t scan_timer = NULL;
+
+// Written by the interrupt, read by the timer callback once the interrupt is disarmed
+static volatile bool armed = false;
+static volatile int64_t edge_us = 0;
+static volatile uint32_t interrupt_count = 0;
+
+// Only touched by the timer callback
+static char candidate = KEYPAD_NO_KEY;
+static uint8_t stable_scans = 0;
+static char posted_key = KEYPAD_NO_KEY;
+
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static keypad_stats_t stats;
 
-static bool task_is_running = true;
+static void IRAM_ATTR keypad_isr(void *arg) {
+    if (!armed) return;
 
-void _4x4_matrix_task(void *args) {
+    BaseType_t higher_priority_woken = pdFALSE;
 
-    QueueHandle_t queue = (QueueHandle_t)args;
-    if(queue == NULL) {
-        ESP_LOGE("KEYPAD", "Queue not parsed in keypad task");
-        vTaskDelete(NULL);
+    armed = false;
+    edge_us = esp_timer_get_time();
+    interrupt_count++;
+
+    xTimerResetFromISR(scan_timer, &higher_priority_woken);
+    if (higher_priority_woken) portYIELD_FROM_ISR();
+}
+
+static void keypad_set_column_interrupts(bool enable) {
+    for (uint8_t col = 0; col < KEYPAD_COLS; col++) {
+        if (enable) gpio_intr_enable(col_pins[col]);
+        else gpio_intr_disable(col_pins[col]);
     }
+}
+
+// First key found, one row low at a time
+static char keypad_scan() {
+    char key = KEYPAD_NO_KEY;
+
+    for (uint8_t row = 0; row < KEYPAD_ROWS; row++) {
+        gpio_set_level(row_pins[row], 1);
+    }
+
+    for (uint8_t row = 0; row < KEYPAD_ROWS && key == KEYPAD_NO_KEY; row++) {
+        gpio_set_level(row_pins[row], 0);
+        esp_rom_delay_us(KEYPAD_SETTLE_US);
+
+        for (uint8_t col = 0; col < KEYPAD_COLS; col++) {
+            if (gpio_get_level(col_pins[col]) == 0) {
+                key = key_map[row][col];
+                break;
+            }
+        }
+
+        gpio_set_level(row_pins[row], 1);
+    }
+
+    // Back to idle, any press pulls a column low
+    for (uint8_t row = 0; row < KEYPAD_ROWS; row++) {
+        gpio_set_level(row_pins[row], 0);
+    }
+
+    return key;
+}
+
+static void keypad_post(char key) {
+    int64_t now_us = esp_timer_get_time();
+    int64_t latency_us = now_us - edge_us;
+
+    pluto_event_handle_t event = {
+        .event_type = EV_KEY,
+        .timestamp_us = edge_us,
+        .key.key_pressed = key
+    };
+
+    // A full key channel drops the key rather than stalling the scan
+    event_bus_post(key_bus, &event);
+
+    portENTER_CRITICAL(&stats_lock);
+    stats.keys++;
+    stats.latency_total_us += latency_us;
+    if (latency_us > stats.latency_max_us) stats.latency_max_us = latency_us;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+static void keypad_scan_callback(TimerHandle_t timer) {
+    int64_t start_us = esp_timer_get_time();
+
+    // Column edges while the rows are switched are not presses
+    keypad_set_column_interrupts(false);
+
+    char key = keypad_scan();
+
+    if (key == candidate) {
+        if (stable_scans < KEYPAD_STABLE_SCANS) stable_scans++;
+    } else {
+        // Rolled over to another key while the first was held, it is a press of its own
+        if (key != KEYPAD_NO_KEY && posted_key != KEYPAD_NO_KEY && key != posted_key) edge_us = start_us;
+
+        candidate = key;
+        stable_scans = 1;
+    }
+
+    bool settled = stable_scans >= KEYPAD_STABLE_SCANS;
+    bool done = false;
+
+    if (settled && candidate != KEYPAD_NO_KEY && candidate != posted_key) {
+        keypad_post(candidate);
+        posted_key = candidate;
+    } else if (settled && candidate == KEYPAD_NO_KEY) {
+        done = true;
+    }
+
+    portENTER_CRITICAL(&stats_lock);
+    stats.scans++;
+    if (done && posted_key == KEYPAD_NO_KEY) stats.bounces++;
+    stats.scan_cpu_us += esp_timer_get_time() - start_us;
+    portEXIT_CRITICAL(&stats_lock);
+
+    if (!done) {
+        xTimerReset(timer, 0);
+        return;
+    }
+
+    // Everything released, wait for the next press
+    candidate = KEYPAD_NO_KEY;
+    stable_scans = 0;
+    posted_key = KEYPAD_NO_KEY;
+
+    armed = true;
+    keypad_set_column_interrupts(true);
+}
+
+esp_err_t keypad_init(event_bus_handle_t bus) {
+    if (bus == NULL) {
+        ESP_LOGE(KEYPAD_TAG, "Event bus not passed to keypad");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    key_bus = bus;
+
+    gpio_config_t row_config = {
+        .mode = GPIO_MODE_OUTPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_DISABLE
+    };
+    gpio_config_t col_config = {
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_NEGEDGE
+    };
+
+    for (uint8_t row = 0; row < KEYPAD_ROWS; row++) row_config.pin_bit_mask |= 1ULL << row_pins[row];
+    for (uint8_t col = 0; col < KEYPAD_COLS; col++) col_config.pin_bit_mask |= 1ULL << col_pins[col];
+
+    ESP_RETURN_ON_ERROR(gpio_config(&row_config), KEYPAD_TAG, "Failed to configure rows");
+    ESP_RETURN_ON_ERROR(gpio_config(&col_config), KEYPAD_TAG, "Failed to configure columns");
+
+    for (uint8_t row = 0; row < KEYPAD_ROWS; row++) {
+        gpio_set_level(row_pins[row], 0);
+    }
+
+    scan_timer = xTimerCreate("keypad_scan", pdMS_TO_TICKS(KEYPAD_SCAN_MS) > 0 ? pdMS_TO_TICKS(KEYPAD_SCAN_MS) : 1,
+                              pdFALSE, NULL, keypad_scan_callback);
+    if (scan_timer == NULL) {
+        ESP_LOGE(KEYPAD_TAG, "Failed to create scan timer");
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Other drivers may have installed the service already
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(KEYPAD_TAG, "Failed to install gpio interrupt service");
+        return err;
+    }
+
+    keypad_set_column_interrupts(false);
+    for (uint8_t col = 0; col < KEYPAD_COLS; col++) {
+        ESP_RETURN_ON_ERROR(gpio_isr_handler_add(col_pins[col], keypad_isr, NULL), KEYPAD_TAG, "Failed to add column interrupt");
+    }
+
+    stats.since_us = esp_timer_get_time();
+
+    return ESP_OK;
+}
+
+void keypad_start() {
+    armed = true;
+    keypad_set_column_interrupts(true);
+}
+
+void keypad_get_stats(keypad_stats_t *out) {
+    portENTER_CRITICAL(&stats_lock);
+    *out = stats;
+    out->interrupts = interrupt_count;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void keypad_log_stats() {
+    keypad_stats_t current;
+    keypad_get_stats(&current);
 
-    char key;
+    int64_t elapsed_us = esp_timer_get_time() - current.since_us;
+    if (elapsed_us <= 0) return;
 
-    while(task_is_running) {
-        key = _4x4_matrix_get_key_press();
+    ESP_LOGI(KEYPAD_TAG, "%lu keys, %lu interrupts, %lu scans, %lu bounces over %d s",
+        (unsigned long)current.keys, (unsigned long)current.interrupts, (unsigned long)current.scans,
+        (unsigned long)current.bounces, (int)(elapsed_us / 1000000));
 
-        pluto_event_handle_t event = {
-            .event_type = EV_KEY,
-            .key.key_pressed = key
-        };
+    // Idle time costs nothing, so this is all cpu the keypad used, spread over the hour
+    ESP_LOGI(KEYPAD_TAG, "Scan cpu %d us per hour", (int)(current.scan_cpu_us * 3600000000LL / elapsed_us));
 
-        xQueueSend(queue, &event, portMAX_DELAY);
+    if (current.keys > 0) {
+        ESP_LOGI(KEYPAD_TAG, "Press to event: avg %d us, max %d us",
+            (int)(current.latency_total_us / current.keys), (int)current.latency_max_us);
     }
 
-    vTaskDelete(NULL);
-}
\ No newline at end of file
+    portENTER_CRITICAL(&stats_lock);
+    memset(&stats, 0, sizeof(stats));
+    stats.since_us = esp_timer_get_time();
+    interrupt_count = 0;
+    portEXIT_CRITICAL(&stats_lock);
+}
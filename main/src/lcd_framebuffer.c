@@ -0,0 +1,199 @@
+/*
+    The lcd sits behind a PCF8574 expander and is driven in 4 bit mode, so every character or
+    command is four bytes on the bus: both nibbles, each with the enable line pulsed high then low.
+    A flush packs every changed cell and the cursor moves between them into one transmit.
+    The HD44780 needs 37 us per character. At 100 kHz a byte takes 90 us, so the bus itself
+    paces the writes and no delays are needed inside a transaction.
+*/
+
+#include "lcd_framebuffer.h"
+#include "project_config.h"
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *LCD_FB_TAG = "LCD_FB";
+
+_Static_assert(I2C_MASTER_FREQ_HZ <= 100000, "Writes are paced by the bus, a faster clock needs delays between characters");
+
+// The PCF8574 wiring is the driver's, the data nibble is on P4 to P7
+#if !defined(LCD_1602_PIN_RS) || !defined(LCD_1602_PIN_EN) || !defined(LCD_1602_BACKLIGHT)
+#error "lcd_1602.h does not export the PCF8574 pin map, update the lcd_1602_i2c_driver submodule"
+#endif
+
+#define LCD_CMD_SET_DDRAM   0x80
+#define LCD_BYTES_PER_WRITE 4
+#define LCD_CURSOR_UNKNOWN  0xFF
+
+// Worst case is every other cell changed, a cursor move for each character
+#define LCD_FB_MAX_BYTES    (LCD_FB_ROWS * LCD_FB_COLS * 2 * LCD_BYTES_PER_WRITE)
+
+static const uint8_t row_address[] = {0x00, 0x40, 0x14, 0x54};
+
+/*
+    Every i2c transmit in the firmware, the driver's included, goes through here, main/CMakeLists.txt
+    wraps it at link time. Only lcd_fb_init reads the counters, around writes of its own before any
+    other task uses the bus.
+*/
+esp_err_t __real_i2c_master_transmit(i2c_master_dev_handle_t dev, const uint8_t *write_buffer, size_t write_size, int xfer_timeout_ms);
+
+static uint32_t bus_transactions = 0;
+static uint32_t bus_bytes = 0;
+
+esp_err_t __wrap_i2c_master_transmit(i2c_master_dev_handle_t dev, const uint8_t *write_buffer, size_t write_size, int xfer_timeout_ms) {
+    bus_transactions++;
+    bus_bytes += write_size;
+
+    return __real_i2c_master_transmit(dev, write_buffer, write_size, xfer_timeout_ms);
+}
+
+static size_t lcd_fb_encode(uint8_t *out, uint8_t value, uint8_t mode) {
+    uint8_t high = (value & 0xF0) | mode | LCD_1602_BACKLIGHT;
+    uint8_t low = ((value << 4) & 0xF0) | mode | LCD_1602_BACKLIGHT;
+
+    out[0] = high | LCD_1602_PIN_EN;
+    out[1] = high;
+    out[2] = low | LCD_1602_PIN_EN;
+    out[3] = low;
+
+    return LCD_BYTES_PER_WRITE;
+}
+
+void lcd_frame_begin(lcd_frame_t *frame) {
+    memset(frame->cells, ' ', sizeof(frame->cells));
+}
+
+void lcd_frame_write(lcd_frame_t *frame, uint8_t row, uint8_t col, const char *text, size_t len) {
+    if (row >= LCD_FB_ROWS || col >= LCD_FB_COLS) return;
+
+    if (len > (size_t)(LCD_FB_COLS - col)) len = LCD_FB_COLS - col;
+    memcpy(&frame->cells[row][col], text, len);
+}
+
+void lcd_frame_layout(lcd_frame_t *frame, const char *text) {
+    uint8_t row = 0;
+    uint8_t col = 0;
+
+    lcd_frame_begin(frame);
+
+    for (; *text != '\0' && row < LCD_FB_ROWS; text++) {
+        if (*text == '\n') {
+            row++;
+            col = 0;
+            continue;
+        }
+
+        frame->cells[row][col++] = *text;
+        if (col == LCD_FB_COLS) {
+            row++;
+            col = 0;
+        }
+    }
+}
+
+esp_err_t lcd_fb_init(lcd_framebuffer_t *fb, i2c_master_dev_handle_t dev) {
+    if (fb == NULL || dev == NULL) return ESP_ERR_INVALID_ARG;
+
+    memset(fb, 0, sizeof(*fb));
+    fb->dev = dev;
+
+    // A whole screen through the driver, what every keypress cost before. Blank, the lcd is cleared next
+    char blank[LCD_FB_ROWS * LCD_FB_COLS + 1];
+    memset(blank, ' ', sizeof(blank) - 1);
+    blank[sizeof(blank) - 1] = '\0';
+
+    uint32_t transactions = bus_transactions;
+    uint32_t bytes = bus_bytes;
+    lcd_1602_send_string(dev, blank);
+    fb->redraw_transactions = bus_transactions - transactions;
+    fb->redraw_bytes = bus_bytes - bytes;
+
+    return lcd_fb_clear(fb);
+}
+
+esp_err_t lcd_fb_flush(lcd_framebuffer_t *fb, const lcd_frame_t *frame) {
+    uint8_t out[LCD_FB_MAX_BYTES];
+    size_t len = 0;
+    uint32_t cells = 0;
+    int64_t start_us = esp_timer_get_time();
+
+    fb->stats.frames++;
+
+    for (uint8_t row = 0; row < LCD_FB_ROWS; row++) {
+        for (uint8_t col = 0; col < LCD_FB_COLS; col++) {
+            if (frame->cells[row][col] == fb->shown.cells[row][col]) continue;
+
+            // Writing advances the cursor, so a run of changed cells needs a single move
+            if (fb->cursor_row != row || fb->cursor_col != col) {
+                len += lcd_fb_encode(&out[len], LCD_CMD_SET_DDRAM | (row_address[row] + col), 0);
+                fb->cursor_row = row;
+            }
+
+            len += lcd_fb_encode(&out[len], (uint8_t)frame->cells[row][col], LCD_1602_PIN_RS);
+            fb->cursor_col = col + 1;
+            cells++;
+        }
+    }
+
+    if (len == 0) {
+        fb->stats.unchanged++;
+        return ESP_OK;
+    }
+
+    esp_err_t err = i2c_master_transmit(fb->dev, out, len, I2C_MASTER_TIMEOUT_MS);
+
+    if (err != ESP_OK) {
+        // Unknown how much arrived, send every cell next time
+        ESP_LOGE(LCD_FB_TAG, "Failed to write lcd: %s", esp_err_to_name(err));
+        memset(&fb->shown, 0, sizeof(fb->shown));
+        fb->cursor_row = LCD_CURSOR_UNKNOWN;
+        return err;
+    }
+
+    fb->shown = *frame;
+
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+    fb->stats.transactions++;
+    fb->stats.bytes += len;
+    fb->stats.cells += cells;
+    fb->stats.flush_total_us += elapsed_us;
+    if (elapsed_us > fb->stats.flush_max_us) fb->stats.flush_max_us = elapsed_us;
+
+    return ESP_OK;
+}
+
+esp_err_t lcd_fb_clear(lcd_framebuffer_t *fb) {
+    if (lcd_1602_clear_screen(fb->dev) != 0) {
+        memset(&fb->shown, 0, sizeof(fb->shown));
+        fb->cursor_row = LCD_CURSOR_UNKNOWN;
+        return ESP_FAIL;
+    }
+
+    lcd_frame_begin(&fb->shown);
+    fb->cursor_row = 0;
+    fb->cursor_col = 0;
+
+    return ESP_OK;
+}
+
+void lcd_fb_log_stats(lcd_framebuffer_t *fb) {
+    lcd_fb_stats_t *stats = &fb->stats;
+    uint32_t sent = stats->frames - stats->unchanged;
+
+    if (stats->frames == 0) return;
+
+    ESP_LOGI(LCD_FB_TAG, "%lu frames, %lu unchanged, %lu transactions, %lu cells",
+        (unsigned long)stats->frames, (unsigned long)stats->unchanged,
+        (unsigned long)stats->transactions, (unsigned long)stats->cells);
+
+    if (sent > 0) {
+        ESP_LOGI(LCD_FB_TAG, "Per frame %lu transactions and %lu bytes against %lu and %lu through the driver",
+            (unsigned long)(stats->transactions / stats->frames), (unsigned long)(stats->bytes / stats->frames),
+            (unsigned long)fb->redraw_transactions, (unsigned long)fb->redraw_bytes);
+        ESP_LOGI(LCD_FB_TAG, "Flush avg %d us, max %d us", (int)(stats->flush_total_us / sent), (int)stats->flush_max_us);
+    }
+
+    memset(stats, 0, sizeof(*stats));
+}
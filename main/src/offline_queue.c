@@ -0,0 +1,258 @@
+/*
+    Store-and-forward queue for payments signed while Wi-Fi is down. Records are kept in NVS,
+    which already spreads its writes over the partition, and addressed by a sequence number
+    modulo OFFLINE_QUEUE_CAPACITY. Only head and tail are rewritten in place.
+    A record holds the card number and the digest of a 4 digit pin, which takes no time to brute
+    force, so the queue is only built with NVS encryption.
+*/
+
+#include "offline_queue.h"
+#include "project_config.h"
+#include "sdkconfig.h"
+
+#if PLUTO_OFFLINE_MODE_ENABLED && !defined(CONFIG_NVS_ENCRYPTION)
+#error "Offline payments store card numbers and pin digests in NVS, enable CONFIG_NVS_ENCRYPTION"
+#endif
+
+#include <string.h>
+#include <stddef.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+#define OFFLINE_STORAGE_NAMESPACE   "offline_q"
+#define OFFLINE_HEAD_NAME           "head"
+#define OFFLINE_TAIL_NAME           "tail"
+#define OFFLINE_RECORD_KEY_SIZE     8
+
+static const char *OFFLINE_TAG = "OFFLINE_QUEUE";
+
+static uint32_t queue_head = 0;
+static uint32_t queue_tail = 0;
+
+// Appends come from the state machine while the drain task sends, the lock is never held over the network
+static SemaphoreHandle_t queue_lock = NULL;
+static TaskHandle_t drain_task = NULL;
+
+static void offline_drain_task(void *pvparameters);
+
+static void offline_record_key(uint32_t sequence, char key[OFFLINE_RECORD_KEY_SIZE]) {
+    snprintf(key, OFFLINE_RECORD_KEY_SIZE, "r%lu", (unsigned long)(sequence % OFFLINE_QUEUE_CAPACITY));
+}
+
+esp_err_t offline_queue_init() {
+    nvs_handle_t nvs_handle = 0;
+    esp_err_t err = ESP_FAIL;
+
+    if ((err = nvs_open(OFFLINE_STORAGE_NAMESPACE, NVS_READWRITE, &nvs_handle)) != ESP_OK) {
+        ESP_LOGE(OFFLINE_TAG, "Unable to open NVS");
+        return err;
+    }
+
+    queue_head = 0;
+    queue_tail = 0;
+    nvs_get_u32(nvs_handle, OFFLINE_HEAD_NAME, &queue_head);
+    nvs_get_u32(nvs_handle, OFFLINE_TAIL_NAME, &queue_tail);
+
+    if (queue_tail - queue_head > OFFLINE_QUEUE_CAPACITY) {
+        ESP_LOGE(OFFLINE_TAG, "Queue position corrupt, resetting");
+        queue_head = queue_tail;
+        nvs_set_u32(nvs_handle, OFFLINE_HEAD_NAME, queue_head);
+        nvs_commit(nvs_handle);
+    }
+
+    nvs_close(nvs_handle);
+
+    ESP_LOGI(OFFLINE_TAG, "%lu payments waiting", (unsigned long)offline_queue_depth());
+
+    queue_lock = xSemaphoreCreateMutex();
+    if (queue_lock == NULL) {
+        ESP_LOGE(OFFLINE_TAG, "Failed to create queue lock");
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(offline_drain_task, "offline_drain", OFFLINE_DRAIN_TASK_STACK_DEPTH, NULL,
+                    OFFLINE_DRAIN_TASK_PRIORITY, &drain_task) != pdPASS) {
+        ESP_LOGE(OFFLINE_TAG, "Failed to create drain task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+uint32_t offline_queue_depth() {
+    return queue_tail - queue_head;
+}
+
+esp_err_t offline_queue_append(const char *body, size_t body_len, const char *hmac) {
+    static offline_record_t record;
+    nvs_handle_t nvs_handle = 0;
+    esp_err_t err = ESP_FAIL;
+    char key[OFFLINE_RECORD_KEY_SIZE];
+
+    if (offline_queue_depth() >= OFFLINE_QUEUE_CAPACITY) {
+        ESP_LOGE(OFFLINE_TAG, "Queue full");
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (body_len > sizeof(record.body)) {
+        ESP_LOGE(OFFLINE_TAG, "Payment too large to store");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    xSemaphoreTake(queue_lock, portMAX_DELAY);
+
+    snprintf(record.hmac, sizeof(record.hmac), "%s", hmac);
+    memcpy(record.body, body, body_len);
+
+    offline_record_key(queue_tail, key);
+
+    if ((err = nvs_open(OFFLINE_STORAGE_NAMESPACE, NVS_READWRITE, &nvs_handle)) != ESP_OK) goto exit;
+    if ((err = nvs_set_blob(nvs_handle, key, &record, offsetof(offline_record_t, body) + body_len)) != ESP_OK) goto exit;
+    if ((err = nvs_set_u32(nvs_handle, OFFLINE_TAIL_NAME, queue_tail + 1)) != ESP_OK) goto exit;
+    if ((err = nvs_commit(nvs_handle)) != ESP_OK) goto exit;
+
+    queue_tail++;
+    ESP_LOGI(OFFLINE_TAG, "Stored payment, %lu waiting", (unsigned long)offline_queue_depth());
+
+exit:
+    if (nvs_handle != 0) {
+        nvs_close(nvs_handle);
+    }
+
+    xSemaphoreGive(queue_lock);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(OFFLINE_TAG, "Error storing payment in NVS");
+    }
+
+    return err;
+}
+
+// A record that is gone was answered by an earlier drain that stopped before head got past it
+static bool offline_record_done(nvs_handle_t nvs_handle, uint32_t sequence) {
+    char key[OFFLINE_RECORD_KEY_SIZE];
+    size_t len = 0;
+
+    offline_record_key(sequence, key);
+    return nvs_get_blob(nvs_handle, key, NULL, &len) == ESP_ERR_NVS_NOT_FOUND;
+}
+
+static esp_err_t offline_queue_drain() {
+    static offline_record_t batch[OFFLINE_QUEUE_BATCH_SIZE];
+    uint32_t batch_sequence[OFFLINE_QUEUE_BATCH_SIZE];
+    https_request_handle_t requests[OFFLINE_QUEUE_BATCH_SIZE];
+    nvs_handle_t nvs_handle = 0;
+    esp_err_t err = ESP_OK;
+    char key[OFFLINE_RECORD_KEY_SIZE];
+    payment_response_t response;
+    uint32_t sent = 0;
+
+    if (offline_queue_depth() == 0) return ESP_OK;
+
+    if ((err = nvs_open(OFFLINE_STORAGE_NAMESPACE, NVS_READWRITE, &nvs_handle)) != ESP_OK) {
+        ESP_LOGE(OFFLINE_TAG, "Unable to open NVS");
+        return err;
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    uint32_t next = queue_head;
+
+    while (err == ESP_OK && next != queue_tail) {
+        uint8_t batch_len = 0;
+
+        xSemaphoreTake(queue_lock, portMAX_DELAY);
+
+        // Queue the whole batch before waiting, the worker sends it back to back on one session
+        for (; batch_len < OFFLINE_QUEUE_BATCH_SIZE && next != queue_tail; next++) {
+            offline_record_t *record = &batch[batch_len];
+            size_t len = sizeof(offline_record_t);
+            offline_record_key(next, key);
+
+            esp_err_t ret = nvs_get_blob(nvs_handle, key, record, &len);
+            if (ret == ESP_ERR_NVS_NOT_FOUND) continue;
+
+            // Nothing sensible can be sent for it, and it would block every record behind it
+            if (ret != ESP_OK || len <= offsetof(offline_record_t, body) ||
+                strnlen(record->hmac, sizeof(record->hmac)) == sizeof(record->hmac)) {
+                ESP_LOGE(OFFLINE_TAG, "Record %s unreadable, dropping it", key);
+                nvs_erase_key(nvs_handle, key);
+                continue;
+            }
+
+            // The body is stored without terminator, its length is whatever follows the hmac
+            if (https_submit_request(record->body, len - offsetof(offline_record_t, body), record->hmac,
+                                     NULL, NULL, &requests[batch_len]) != ESP_OK) {
+                break;
+            }
+            batch_sequence[batch_len++] = next;
+        }
+
+        xSemaphoreGive(queue_lock);
+
+        if (batch_len == 0 && next != queue_tail) {
+            err = ESP_FAIL;
+        }
+
+        // Every answered record is erased on its own, whatever happened to the others in the batch
+        for (uint8_t i = 0; i < batch_len; i++) {
+            esp_err_t ret = https_wait_for_response(requests[i], &response);
+
+            // Once the server answered, retrying would only replay the same nonce. One that went out
+            // unanswered is kept, if the server did process it the nonce makes it reject the resend.
+            if (ret == ESP_OK || ret == ESP_ERR_INVALID_RESPONSE) {
+                if (ret != ESP_OK) {
+                    ESP_LOGW(OFFLINE_TAG, "Server rejected stored payment: %s", payment_response_result_name(response.result));
+                } else {
+                    ESP_LOGI(OFFLINE_TAG, "Stored payment approved, authorization %s", response.authorization_id);
+                }
+                offline_record_key(batch_sequence[i], key);
+                xSemaphoreTake(queue_lock, portMAX_DELAY);
+                nvs_erase_key(nvs_handle, key);
+                xSemaphoreGive(queue_lock);
+                sent++;
+            } else {
+                err = ESP_FAIL;
+            }
+        }
+
+        xSemaphoreTake(queue_lock, portMAX_DELAY);
+
+        // Head only moves over records that are gone, anything kept is sent again by the next drain
+        while (queue_head != queue_tail && offline_record_done(nvs_handle, queue_head)) {
+            queue_head++;
+        }
+
+        nvs_set_u32(nvs_handle, OFFLINE_HEAD_NAME, queue_head);
+        nvs_commit(nvs_handle);
+
+        xSemaphoreGive(queue_lock);
+    }
+
+    nvs_close(nvs_handle);
+
+    int64_t elapsed_ms = (esp_timer_get_time() - start_us) / 1000;
+    ESP_LOGI(OFFLINE_TAG, "Drained %lu payments in %d ms (%lu/s), %lu waiting",
+        (unsigned long)sent, (int)elapsed_ms,
+        (unsigned long)(elapsed_ms > 0 ? sent * 1000 / elapsed_ms : sent),
+        (unsigned long)offline_queue_depth());
+
+    return err;
+}
+
+static void offline_drain_task(void *pvparameters) {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        offline_queue_drain();
+    }
+}
+
+void offline_queue_drain_async() {
+    if (drain_task == NULL || offline_queue_depth() == 0) return;
+
+    xTaskNotifyGive(drain_task);
+}
@@ -0,0 +1,129 @@
+/*
+    Parser for the payment response body. Uses the json tokenizer with a fixed token array,
+    so it has no heap use and no dependencies beyond the C library and can be run on the host.
+*/
+
+#include "payment_response.h"
+#include "json_parser.h"
+
+#include <string.h>
+#include <stdio.h>
+
+#define PAYMENT_RESULT_TEXT(name, code, text) [PAYMENT_RESULT_##name] = text,
+#define PAYMENT_RESULT_NAME(name, code, text) [PAYMENT_RESULT_##name] = #name,
+
+static const char *payment_result_text[PAYMENT_RESULT_COUNT] = {
+    PAYMENT_RESULT_TABLE(PAYMENT_RESULT_TEXT)
+};
+
+static const char *payment_result_name[PAYMENT_RESULT_COUNT] = {
+    PAYMENT_RESULT_TABLE(PAYMENT_RESULT_NAME)
+};
+
+#define PAYMENT_RESULT_MATCH(name, code, text)                                              \
+    if (sizeof(code) > 1 && json_token_equals(json, token, code, sizeof(code) - 1)) {       \
+        *out = PAYMENT_RESULT_##name;                                                       \
+        return true;                                                                        \
+    }
+
+static bool payment_result_from_token(const char *json, const json_token_t *token, payment_result_t *out) {
+    if (token->type != JSON_TOKEN_STRING) return false;
+
+    PAYMENT_RESULT_TABLE(PAYMENT_RESULT_MATCH)
+
+    return false;
+}
+
+// The lcd only shows printable ascii
+static void payment_response_sanitize(char *text) {
+    for (; *text != '\0'; text++) {
+        if (*text < 0x20 || *text > 0x7e) *text = '?';
+    }
+}
+
+// Reads the response schema, result is left alone if the code is missing or unknown
+static esp_err_t payment_response_read_body(const char *body, size_t len, payment_response_t *out, payment_result_t *result) {
+    json_token_t tokens[PAYMENT_RESPONSE_MAX_TOKENS];
+
+    int count = json_tokenize(body, len, tokens, PAYMENT_RESPONSE_MAX_TOKENS);
+    if (count < 1 || tokens[0].type != JSON_TOKEN_OBJECT) return ESP_ERR_INVALID_RESPONSE;
+
+    int index = json_object_get(body, tokens, count, 0, PAYMENT_RESPONSE_KEY_RESULT);
+    if (index < 0 || !payment_result_from_token(body, &tokens[index], result)) return ESP_ERR_INVALID_RESPONSE;
+
+    index = json_object_get(body, tokens, count, 0, PAYMENT_RESPONSE_KEY_AUTHORIZATION);
+    if (index >= 0 && json_token_copy_string(body, &tokens[index], out->authorization_id, sizeof(out->authorization_id)) != ESP_OK) {
+        // A cut authorization id is useless for lookups
+        out->authorization_id[0] = '\0';
+    }
+
+    index = json_object_get(body, tokens, count, 0, PAYMENT_RESPONSE_KEY_MESSAGE);
+    if (index >= 0) {
+        // Too long is fine, the lcd shows what fits
+        json_token_copy_string(body, &tokens[index], out->message, sizeof(out->message));
+        payment_response_sanitize(out->message);
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t payment_response_parse(uint16_t http_status, const char *body, size_t len, payment_response_t *out) {
+    payment_result_t result = PAYMENT_RESULT_INVALID_RESPONSE;
+    esp_err_t ret = ESP_ERR_INVALID_RESPONSE;
+
+    memset(out, 0, sizeof(*out));
+    out->http_status = http_status;
+
+    if (body != NULL) {
+        ret = payment_response_read_body(body, len, out, &result);
+    }
+
+    switch (http_status / 100) {
+        case 2:
+            // An approval the server cannot refer back to is not trusted
+            if (result == PAYMENT_RESULT_APPROVED && out->authorization_id[0] == '\0') {
+                result = PAYMENT_RESULT_INVALID_RESPONSE;
+                ret = ESP_ERR_INVALID_RESPONSE;
+            }
+            break;
+
+        case 4:
+            if (ret != ESP_OK || result == PAYMENT_RESULT_APPROVED) result = PAYMENT_RESULT_REJECTED;
+            break;
+
+        case 5:
+            result = PAYMENT_RESULT_SERVER_ERROR;
+            break;
+
+        default:
+            result = PAYMENT_RESULT_INVALID_RESPONSE;
+            break;
+    }
+
+    out->result = result;
+    if (result != PAYMENT_RESULT_APPROVED) {
+        out->authorization_id[0] = '\0';
+    }
+
+    return ret;
+}
+
+void payment_response_no_answer(payment_response_t *out, bool request_sent) {
+    memset(out, 0, sizeof(*out));
+    out->result = request_sent ? PAYMENT_RESULT_NO_ANSWER : PAYMENT_RESULT_NO_RESPONSE;
+}
+
+void payment_response_lcd_text(const payment_response_t *response, char *out, size_t out_size) {
+    const char *text = response->result < PAYMENT_RESULT_COUNT ? payment_result_text[response->result] : "Unknown response";
+
+    // Only single row results leave room for the server's message
+    if (response->message[0] != '\0' && strchr(text, '\n') == NULL) {
+        snprintf(out, out_size, "%s\n%s", text, response->message);
+    } else {
+        snprintf(out, out_size, "%s", text);
+    }
+}
+
+const char *payment_response_result_name(payment_result_t result) {
+    return result < PAYMENT_RESULT_COUNT ? payment_result_name[result] : "UNKNOWN";
+}
@@ -0,0 +1,59 @@
+#include "pluto_console.h"
+#include "pluto_events.h"
+
+#include "esp_console.h"
+#include "esp_log.h"
+
+static const char *CONSOLE_TAG = "CONSOLE";
+
+static event_bus_handle_t console_bus = NULL;
+
+// Runs on the console task, the histograms are only read by the task that writes them
+static int pluto_console_stats(int argc, char **argv) {
+    pluto_event_handle_t event = {
+        .event_type = EV_STATS
+    };
+
+    if (!event_bus_post(console_bus, &event)) {
+        ESP_LOGW(CONSOLE_TAG, "Event bus full, try again");
+        return 1;
+    }
+
+    return 0;
+}
+
+esp_err_t pluto_console_start(event_bus_handle_t bus) {
+    if (bus == NULL) return ESP_ERR_INVALID_ARG;
+    if (console_bus != NULL) return ESP_ERR_INVALID_STATE;
+
+    esp_console_repl_t *repl = NULL;
+    esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    esp_console_dev_uart_config_t uart_config = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+    repl_config.prompt = PLUTO_CONSOLE_PROMPT;
+
+    esp_err_t err = esp_console_new_repl_uart(&uart_config, &repl_config, &repl);
+    if (err != ESP_OK) return err;
+
+    const esp_console_cmd_t stats_cmd = {
+        .command = "stats",
+        .help = "Log the transaction stage histograms and the other latency counters",
+        .hint = NULL,
+        .func = pluto_console_stats
+    };
+
+    console_bus = bus;
+
+    err = esp_console_cmd_register(&stats_cmd);
+    if (err != ESP_OK) goto exit;
+
+    err = esp_console_start_repl(repl);
+    if (err != ESP_OK) goto exit;
+
+    return ESP_OK;
+
+exit:
+    ESP_LOGE(CONSOLE_TAG, "Unable to start console: %s", esp_err_to_name(err));
+    repl->del(repl);
+    console_bus = NULL;
+    return err;
+}
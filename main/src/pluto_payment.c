@@ -0,0 +1,236 @@
+#include "pluto_payment.h"
+#include "request_formater.h"
+#include "json_parser.h"
+#include "clock_discipline.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+// Room for the object, every key and value, and a few unknown keys
+#define PLUTO_PAYMENT_MAX_TOKENS (1 + (PAYMENT_FIELD_COUNT * 2) + 8)
+#define PLUTO_PAYMENT_COMPARE_SIZE 512
+
+static const char *PAYMENT_TAG = "PLUTO_PAYMENT";
+
+_Static_assert(PAYMENT_FIELD_COUNT < 32, "Parser tracks fields in a 32 bit mask");
+
+#define PAYMENT_KEY_ENTRY(name, key, type, size) [PAYMENT_FIELD_##name] = {key, sizeof(key) - 1},
+
+const pluto_payment_key_t pluto_payment_keys[PAYMENT_FIELD_COUNT] = {
+    PLUTO_PAYMENT_SCHEMA(PAYMENT_KEY_ENTRY)
+};
+
+static void pluto_payment_json_timestamp(json_writer_t *json, int64_t timestamp) {
+    char date[TIME_STRING_SIZE];
+
+    time_format_timestamp((time_t)timestamp, date, sizeof(date));
+    json_value_string(json, date);
+}
+
+#define PAYMENT_WRITE_STRING(json, field, size)         json_value_string(json, field)
+#define PAYMENT_WRITE_DIGEST(json, field, size)         json_value_hex(json, field, size)
+#define PAYMENT_WRITE_MINOR_UNITS(json, field, size)    json_value_minor_units(json, field, PLUTO_AMOUNT_DECIMALS)
+#define PAYMENT_WRITE_TIMESTAMP(json, field, size)      pluto_payment_json_timestamp(json, field)
+
+// The comparison is constant, so every field but the wanted ones drops out at compile time
+#define PAYMENT_WRITE_FIELD(name, key, type, size)                                      \
+    if ((PAYMENT_FIELD_##name == PAYMENT_FIELD_DEFERRED) == deferred) {                 \
+        json_write_key_literal(json, JSON_KEY(key), sizeof(JSON_KEY(key)) - 1);         \
+        PAYMENT_WRITE_##type(json, payment->name, size);                                \
+    }
+
+static inline void pluto_payment_json_fields(json_writer_t *json, const pluto_payment *payment, const bool deferred) {
+    PLUTO_PAYMENT_SCHEMA(PAYMENT_WRITE_FIELD)
+}
+
+esp_err_t pluto_payment_to_json(const pluto_payment *payment, char *out, size_t out_len, size_t *body_len, char hashed_body[SHA256_OUT_BUF_SIZE]) {
+    json_writer_t json;
+    json_writer_begin(&json, out, out_len);
+
+    pluto_payment_json_fields(&json, payment, false);
+    pluto_payment_json_fields(&json, payment, true);
+
+    esp_err_t ret = json_writer_end(&json, hashed_body);
+    *body_len = json.body.len;
+
+    return ret;
+}
+
+#define PAYMENT_CBOR_STRING(cbor, field, size)          cbor_write_text(cbor, field)
+#define PAYMENT_CBOR_DIGEST(cbor, field, size)          cbor_write_bytes(cbor, field, size)
+#define PAYMENT_CBOR_MINOR_UNITS(cbor, field, size)     cbor_write_int(cbor, field)
+#define PAYMENT_CBOR_TIMESTAMP(cbor, field, size)       cbor_write_tag(cbor, CBOR_TAG_EPOCH_TIME); cbor_write_int(cbor, field)
+
+#define PAYMENT_CBOR_FIELD(name, key, type, size)                                       \
+    if ((PAYMENT_FIELD_##name == PAYMENT_FIELD_DEFERRED) == deferred) {                 \
+        cbor_write_uint(cbor, PAYMENT_FIELD_##name);                                    \
+        PAYMENT_CBOR_##type(cbor, payment->name, size);                                 \
+    }
+
+// CBOR maps do not have to be in key order, which lets the deferred field go last here too
+static inline void pluto_payment_cbor_fields(cbor_writer_t *cbor, const pluto_payment *payment, const bool deferred) {
+    PLUTO_PAYMENT_SCHEMA(PAYMENT_CBOR_FIELD)
+}
+
+esp_err_t pluto_payment_to_cbor(const pluto_payment *payment, char *out, size_t out_len, size_t *body_len, char hashed_body[SHA256_OUT_BUF_SIZE]) {
+    cbor_writer_t cbor;
+    cbor_writer_begin(&cbor, out, out_len);
+
+    cbor_write_map(&cbor, PAYMENT_FIELD_COUNT);
+    pluto_payment_cbor_fields(&cbor, payment, false);
+    pluto_payment_cbor_fields(&cbor, payment, true);
+
+    esp_err_t ret = cbor_writer_end(&cbor, hashed_body);
+    *body_len = cbor.body.len;
+
+    return ret;
+}
+
+esp_err_t pluto_payment_serialize(const pluto_payment *payment, char *out, size_t out_len, size_t *body_len, char hashed_body[SHA256_OUT_BUF_SIZE]) {
+#if PLUTO_PAYMENT_ENCODING_CBOR
+    return pluto_payment_to_cbor(payment, out, out_len, body_len, hashed_body);
+#else
+    return pluto_payment_to_json(payment, out, out_len, body_len, hashed_body);
+#endif
+}
+
+esp_err_t pluto_payment_prepare(pluto_payment_builder_t *builder, char *out, size_t out_len) {
+    pluto_payment *payment = &builder->payment;
+
+    pluto_payment_discard(builder);
+
+    payment->date = clock_now();
+    // Until the first SNTP sync the server should not trust the timestamp for ordering or expiry
+    snprintf(payment->time_quality, sizeof(payment->time_quality), "%s", time_quality_name(time_get_quality()));
+    sec_generate_nonce(payment->nonce);
+
+#if PLUTO_PAYMENT_ENCODING_CBOR
+    cbor_writer_begin(&builder->writer, out, out_len);
+    cbor_write_map(&builder->writer, PAYMENT_FIELD_COUNT);
+    pluto_payment_cbor_fields(&builder->writer, payment, false);
+#else
+    json_writer_begin(&builder->writer, out, out_len);
+    pluto_payment_json_fields(&builder->writer, payment, false);
+#endif
+
+    builder->prepared = true;
+
+    if (builder->writer.body.overflow) {
+        ESP_LOGE(PAYMENT_TAG, "Payment does not fit %d bytes", (int)out_len);
+        pluto_payment_discard(builder);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t pluto_payment_finish(pluto_payment_builder_t *builder, const uint8_t pin_digest[SHA256_DIGEST_SIZE],
+                               size_t *body_len, char hashed_body[SHA256_OUT_BUF_SIZE]) {
+    pluto_payment *payment = &builder->payment;
+    esp_err_t ret;
+
+    if (!builder->prepared) return ESP_ERR_INVALID_STATE;
+
+    memcpy(payment->pin_code, pin_digest, sizeof(payment->pin_code));
+
+#if PLUTO_PAYMENT_ENCODING_CBOR
+    pluto_payment_cbor_fields(&builder->writer, payment, true);
+    ret = cbor_writer_end(&builder->writer, hashed_body);
+#else
+    pluto_payment_json_fields(&builder->writer, payment, true);
+    ret = json_writer_end(&builder->writer, hashed_body);
+#endif
+
+    *body_len = builder->writer.body.len;
+    builder->prepared = false;
+
+    return ret;
+}
+
+void pluto_payment_discard(pluto_payment_builder_t *builder) {
+    if (!builder->prepared) return;
+
+    body_writer_discard(&builder->writer.body);
+    builder->prepared = false;
+}
+
+void pluto_payment_compare_encodings(const pluto_payment *payment) {
+    static char scratch[PLUTO_PAYMENT_COMPARE_SIZE];
+    char hashed_body[SHA256_OUT_BUF_SIZE];
+    size_t json_len = 0;
+    size_t cbor_len = 0;
+
+    int64_t start_us = esp_timer_get_time();
+    pluto_payment_to_json(payment, scratch, sizeof(scratch), &json_len, hashed_body);
+    int64_t json_us = esp_timer_get_time() - start_us;
+
+    start_us = esp_timer_get_time();
+    pluto_payment_to_cbor(payment, scratch, sizeof(scratch), &cbor_len, hashed_body);
+    int64_t cbor_us = esp_timer_get_time() - start_us;
+
+    ESP_LOGI(PAYMENT_TAG, "JSON: %u bytes in %d us, CBOR: %u bytes in %d us",
+        (unsigned)json_len, (int)json_us, (unsigned)cbor_len, (int)cbor_us);
+}
+
+static esp_err_t pluto_payment_read_timestamp(const char *json, const json_token_t *token, int64_t *out) {
+    char date[TIME_STRING_SIZE];
+    time_t timestamp = 0;
+
+    if (json_token_copy_string(json, token, date, sizeof(date)) != ESP_OK ||
+        time_parse_timestamp(date, &timestamp) != ESP_OK) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *out = timestamp;
+    return ESP_OK;
+}
+
+#define PAYMENT_READ_STRING(json, token, field, size)       json_token_copy_string(json, token, field, size)
+#define PAYMENT_READ_DIGEST(json, token, field, size)       json_token_hex_to_bytes(json, token, field, size)
+#define PAYMENT_READ_MINOR_UNITS(json, token, field, size)  json_token_to_minor_units(json, token, PLUTO_AMOUNT_DECIMALS, &field)
+#define PAYMENT_READ_TIMESTAMP(json, token, field, size)    pluto_payment_read_timestamp(json, token, &field)
+
+#define PAYMENT_READ_FIELD(name, key_literal, type, size)                           \
+    if (json_token_equals(json, key, key_literal, sizeof(key_literal) - 1)) {       \
+        *seen |= 1UL << PAYMENT_FIELD_##name;                                       \
+        return PAYMENT_READ_##type(json, value, out->name, size);                   \
+    }
+
+static esp_err_t pluto_payment_read_field(const char *json, const json_token_t *key, const json_token_t *value, pluto_payment *out, uint32_t *seen) {
+    PLUTO_PAYMENT_SCHEMA(PAYMENT_READ_FIELD)
+
+    return ESP_OK;
+}
+
+esp_err_t pluto_payment_parse(const char *json, size_t len, pluto_payment *out) {
+    json_token_t tokens[PLUTO_PAYMENT_MAX_TOKENS];
+    uint32_t seen = 0;
+
+    int count = json_tokenize(json, len, tokens, PLUTO_PAYMENT_MAX_TOKENS);
+    if (count < 1 || tokens[0].type != JSON_TOKEN_OBJECT) {
+        ESP_LOGE(PAYMENT_TAG, "Payment is not a json object (%d)", count);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int index = 1;
+    for (uint16_t i = 0; i + 1 < tokens[0].size && index + 1 < count; i += 2) {
+        esp_err_t ret = pluto_payment_read_field(json, &tokens[index], &tokens[index + 1], out, &seen);
+        if (ret != ESP_OK) {
+            ESP_LOGE(PAYMENT_TAG, "Invalid value for %.*s", (int)(tokens[index].end - tokens[index].start), json + tokens[index].start);
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        index = json_skip(tokens, count, index + 1);
+    }
+
+    if (seen != (1UL << PAYMENT_FIELD_COUNT) - 1) {
+        ESP_LOGE(PAYMENT_TAG, "Payment is missing fields");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    return ESP_OK;
+}
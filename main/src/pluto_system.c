@@ -1,5 +1,7 @@
 #include "pluto_system.h"
 #include "pluto_events.h"
+#include "pluto_console.h"
+#include "event_bus.h"
 #include "lcd_1602.h"
 #include "error_checks.h"
 #include "rc522_implementation.h"
@@ -7,15 +9,20 @@
 #include "wifi_implementation.h"
 #include "time_sync.h"
 #include "security_measures.h"
-#include "request_formater.h"
+#include "pluto_payment.h"
 #include "http_implementation.h"
 #include "https_implementation.h"
 #include "lcd_render.h"
+#include "display.h"
+#include "offline_queue.h"
+#include "txn_trace.h"
+#include "clock_discipline.h"
 #include "credentials.h"
 #include "project_config.h"
 
 #include <ctype.h>
 #include <string.h>
+#include <time.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -23,15 +30,20 @@
 #include "esp_log.h"
 #include "esp_err.h"
 #include "esp_mac.h"
+#include "esp_timer.h"
+#include "esp_system.h"
 
 #define PLUTO_ERROR_MESSAGE_TIME_MS 2500
 #define PLUTO_MENU_WAIT_TIME_MS 20000
+#define PLUTO_PAYMENT_TIMEOUT_MS (HTTPS_REQUEST_MAX_MS + MAX_TIMEOUT_MS)   // room for a pre-warm ahead of the request
 #define PLUTO_WIFI_RECONNECT_TIME_MS 60000
 #define PLUTO_AMOUNT_MAX_LEN 8
-#define PLUTO_CARD_LENGTH 20
 #define PLUTO_PIN_LENGTH 5
-#define PLUTO_HTTP_HEADER_SIZE 100
-#define MAC_ADDRESS_LEN 18
+#define PLUTO_TYPE_AHEAD_SIZE 4
+#define PLUTO_TYPE_AHEAD_MAX_AGE_MS 1500
+#define PLUTO_LCD_TEXT_SIZE ((LCD_1602_SCREEN_CHAR_WIDTH * LCD_1602_MAX_ROWS) + 2)
+
+_Static_assert(EVENT_PAYMENT_CHANNEL_DEPTH >= HTTPS_REQUEST_SLOTS, "Every request in flight needs room for its completion");
 
 const char *PLUTO_TAG = "PLUTO_SYSTEM";
 const char CURRENCY[] = "SEK";
@@ -40,360 +52,889 @@ const char CURRENCY[] = "SEK";
 typedef enum pluto_system_state {
     SYS_SLEEPING,
     SYS_WAITING,
-    SYS_CREATE_PAYMENT,
+    SYS_ENTER_AMOUNT,
+    SYS_SCAN_CARD,
+    SYS_ENTER_PIN,
     SYS_MAKE_PAYMENT,
-    SYS_WIFI_RECONNECTED
+    SYS_MESSAGE,
+    SYS_WIFI_LOST,
+    SYS_STATE_COUNT,
+    SYS_STAY = SYS_STATE_COUNT
 } pluto_system_state;
 
-// PAYMENT STRUCT
-typedef struct pluto_payment {
-    char amount[PLUTO_AMOUNT_MAX_LEN];
-    char card_number[PLUTO_CARD_LENGTH];
-    char pin_code[SHA256_OUT_BUF_SIZE];
-    char currency[sizeof(CURRENCY)];
-    char date[TIME_STRING_SIZE];
-    char nonce[SHA256_OUT_BUF_SIZE];
-    char operation[20];
-    char device_id[MAC_ADDRESS_LEN];
-} pluto_payment;
-
-// JSON KEY ENUM
-typedef enum pluto_payment_keys_t {
-    PAYMENT_AMOUNT,
-    PAYMENT_CARD_NUMBER,
-    PAYMENT_PIN_CODE,
-    PAYMENT_CURRENCY,
-    PAYMENT_DATE,
-    PAYMENT_NONCE,
-    PAYMENT_OPERATION,
-    PAYMENT_DEVICE_ID,
-    PAYMENT_KEY_SIZE
-} pluto_payment_keys_t;
-
-// JSON KEYS
-static char *payment_keys[] = {"amount", "cardNumber", "pinCode", "currency", "timeStamp", "nonce", "operation", "deviceMacAddress"};
-
-// HTTP HEADERS
-typedef enum pluto_payment_http_headers {
-    HTTP_HEADER_CONTENT_TYPE,
-    HTTP_HEADER_AUTHORIZATION,
-    HTTP_HEADER_SIZE
-} pluto_payment_http_headers;
-
-#define PAYMENT_HTTP_HEADERS {"Content-Type", "Authorization"}
-#define PAYMENT_HTTP_VALUES  {"application/json"}
+// INPUT ENUM, WHAT THE STATE MACHINE SEES OF AN EVENT
+typedef enum pluto_input {
+    INPUT_DIGIT,
+    INPUT_POINT,
+    INPUT_CONFIRM,
+    INPUT_CANCEL,
+    INPUT_DELETE,
+    INPUT_STATS,
+    INPUT_OTHER_KEY,
+    INPUT_CARD,
+    INPUT_SCAN_FAILED,
+    INPUT_WIFI_UP,
+    INPUT_WIFI_DOWN,
+    INPUT_TIMEOUT,
+    INPUT_PAYMENT_DONE,
+    INPUT_COUNT,
+    INPUT_NONE = INPUT_COUNT
+} pluto_input;
+
+// WHAT ENTERING A STATE DOES WITH KEYS HELD FROM THE SCREEN BEFORE
+typedef enum pluto_type_ahead_rule {
+    TYPE_AHEAD_REPLAY,
+    TYPE_AHEAD_FLUSH
+} pluto_type_ahead_rule;
 
 // DEFINITION OF PLUTO HANDLE
 typedef struct pluto_system {
-    QueueHandle_t event_queue;
+    event_bus_handle_t event_bus;
     rc522_handle_t rc522;
     pluto_system_state current_state;
-    pluto_system_state last_state;
     i2c_master_dev_handle_t lcd_i2c;
+    display_handle_t display;
+    char last_authorization_id[PAYMENT_AUTH_ID_SIZE];
+
+    // STATE TIMEOUT, A TIMER EVENT ONLY COUNTS ONCE THE DEADLINE OF THE NEWEST ARMING HAS PASSED
+    esp_timer_handle_t state_timer;
+    int64_t timer_deadline_us;                  // 0 when not armed
+
+    // MESSAGE SCREEN
+    char message[PLUTO_LCD_TEXT_SIZE];
+    pluto_system_state message_next;
+
+    // PAYMENT BEING ENTERED, SERIALIZED AS FAR AS POSSIBLE BEFORE THE PIN IS CONFIRMED
+    pluto_payment_builder_t builder;
+    char device_id[MAC_ADDRESS_LEN];
+    char amount[PLUTO_AMOUNT_MAX_LEN];
+    uint8_t amount_len;
+    bool comma_entered;
+    uint8_t decimals_entered;
+    char pin_code[PLUTO_PIN_LENGTH];
+    uint8_t pin_code_len;
+
+    // REQUEST IN FLIGHT, THE BODY IS SENT STRAIGHT FROM HERE. A REQUEST GIVEN UP ON KEEPS READING
+    // THE BODY AT ITS INDEX UNTIL IT COMPLETES, SO THE NEXT PAYMENT IS WRITTEN TO ANOTHER ONE
+    https_request_handle_t pending_request;
+    https_request_handle_t abandoned_requests[HTTPS_REQUEST_SLOTS];    // timed out, each slot is freed once it completes
+    char request_bodies[HTTPS_REQUEST_SLOTS][HTTP_REQUEST_BODY_SIZE];
+    uint8_t request_body_index;
+    char *request_body;                         // request_bodies[request_body_index]
+    size_t request_body_len;
+    char request_hmac[SHA256_OUT_BUF_SIZE];
+    int64_t confirm_us;
+    bool encodings_compared;                    // CBOR against JSON logged, once per boot
+
+    // KEY PRESS TO RENDER COMMANDS QUEUED, THE DISPLAY TASK MEASURES THE REST
+    int64_t input_latency_total_us;
+    int64_t input_latency_max_us;
+    uint32_t input_latency_count;
+
+    // KEYS THAT ENDED A SCREEN, REPLAYED ON THE NEXT ONE
+    pluto_event_handle_t type_ahead[PLUTO_TYPE_AHEAD_SIZE];
+    uint8_t type_ahead_first;
+    uint8_t type_ahead_count;
+    uint32_t type_ahead_replayed;
+    uint32_t type_ahead_stale;
+    uint32_t type_ahead_flushed;
 } pluto_system;
 
-static bool send_request(pluto_system_handle_t handle, char *hmac_hashed, char *request_body) {
-    char response_out[33];
-    
-    esp_err_t ret = https_create_and_send_request(request_body, hmac_hashed, response_out, sizeof(response_out));
+/**
+ * Runs on an event. Gets the next state from the transition table and returns the state
+ * to actually go to, SYS_STAY to remain in the current one.
+ */
+typedef pluto_system_state (*pluto_action_t)(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next);
+
+typedef struct {
+    pluto_action_t action;
+    pluto_system_state next;
+} pluto_transition_t;
+
+typedef struct {
+    const char *name;
+    void (*on_enter)(pluto_system_handle_t handle);
+    void (*on_exit)(pluto_system_handle_t handle);
+    uint32_t timeout_ms;
+    pluto_type_ahead_rule type_ahead;
+} pluto_state_config_t;
+
+static void pluto_timer_callback(void *arg) {
+    pluto_system_handle_t handle = (pluto_system_handle_t)arg;
+
+    pluto_event_handle_t event = {
+        .event_type = EV_TIMER
+    };
 
-    lcd_1602_send_string(handle->lcd_i2c, response_out);
+    // A pending timeout is replaced, whether it still counts is decided by the deadline when it is handled
+    event_bus_post(handle->event_bus, &event);
+}
 
-    return ret == ESP_OK;
+static void pluto_request_done(https_request_handle_t request, void *ctx) {
+    pluto_system_handle_t handle = (pluto_system_handle_t)ctx;
+
+    pluto_event_handle_t event = {
+        .event_type = EV_PAYMENT_DONE
+    };
+
+    // The request slot stays taken until the event is handled, the payment channel has room for every slot
+    if (!event_bus_post(handle->event_bus, &event)) {
+        ESP_LOGE(PLUTO_TAG, "Payment channel full, payment result lost");
+    }
 }
 
-static void pluto_create_values(pluto_payment *payment, char *out_buf[]) {
-    out_buf[PAYMENT_AMOUNT] = payment->amount;
-    out_buf[PAYMENT_CARD_NUMBER] = payment->card_number;
-    out_buf[PAYMENT_PIN_CODE] = payment->pin_code;
-    out_buf[PAYMENT_CURRENCY] = payment->currency;
-    out_buf[PAYMENT_DATE] = payment->date;
-    out_buf[PAYMENT_NONCE] = payment->nonce;
-    out_buf[PAYMENT_OPERATION] = payment->operation;
-    out_buf[PAYMENT_DEVICE_ID] = payment->device_id;
+static void pluto_arm_timer(pluto_system_handle_t handle, uint32_t timeout_ms) {
+    esp_timer_stop(handle->state_timer);
+    handle->timer_deadline_us = 0;
+
+    if (timeout_ms > 0) {
+        // Set before starting, the timer cannot fire before it
+        handle->timer_deadline_us = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+        esp_timer_start_once(handle->state_timer, (uint64_t)timeout_ms * 1000);
+    }
 }
 
-static void pluto_update_state(pluto_system_handle_t handle, pluto_system_state state) {
-    handle->last_state = handle->current_state;
-    handle->current_state = state;
+/*
+    A key that ends a screen is also meant for the one after it: skipping a message with a pin
+    digit, waking the terminal with 'A' or typing the amount on the menu. The action holds the key,
+    and it is replayed once the next state is entered, unless that state flushes held keys or the
+    key waited longer than PLUTO_TYPE_AHEAD_MAX_AGE_MS, which only happens behind blocking work.
+*/
+static void pluto_type_ahead_hold(pluto_system_handle_t handle, const pluto_event_handle_t *event) {
+    if (handle->type_ahead_count == PLUTO_TYPE_AHEAD_SIZE) {
+        handle->type_ahead_flushed++;
+        return;
+    }
+
+    uint8_t slot = (handle->type_ahead_first + handle->type_ahead_count) % PLUTO_TYPE_AHEAD_SIZE;
+    handle->type_ahead[slot] = *event;
+    handle->type_ahead_count++;
 }
 
-static void pluto_wifi_state_logic(pluto_system_handle_t handle, pluto_event_handle_t event) {
-    if (!event.wifi.isConnected) {
-        ESP_LOGE(PLUTO_TAG, "WIFI DISCONNECTED");
-        lcd_1602_send_string(handle->lcd_i2c, "Wifi lost...\nReconnecting...");
-        ESP_ERROR_CHECK(wifi_wait_for_connection(PLUTO_WIFI_RECONNECT_TIME_MS));
+static void pluto_type_ahead_flush(pluto_system_handle_t handle) {
+    handle->type_ahead_flushed += handle->type_ahead_count;
+    handle->type_ahead_first = 0;
+    handle->type_ahead_count = 0;
+}
 
-        lcd_1602_send_string(handle->lcd_i2c, "Wifi reconnected");
-        pluto_update_state(handle, SYS_WIFI_RECONNECTED);
+// Oldest held key that is still fresh, false when there is none
+static bool pluto_type_ahead_take(pluto_system_handle_t handle, pluto_event_handle_t *out) {
+    int64_t now_us = esp_timer_get_time();
 
-        vTaskDelay(pdMS_TO_TICKS(PLUTO_ERROR_MESSAGE_TIME_MS));
+    while (handle->type_ahead_count > 0) {
+        *out = handle->type_ahead[handle->type_ahead_first];
+        handle->type_ahead_first = (handle->type_ahead_first + 1) % PLUTO_TYPE_AHEAD_SIZE;
+        handle->type_ahead_count--;
+
+        if (now_us - out->timestamp_us <= (int64_t)PLUTO_TYPE_AHEAD_MAX_AGE_MS * 1000) {
+            handle->type_ahead_replayed++;
+            return true;
+        }
+
+        ESP_LOGD(PLUTO_TAG, "Key '%c' held too long, dropped", out->key.key_pressed);
+        handle->type_ahead_stale++;
     }
+
+    return false;
+}
+
+static pluto_system_state pluto_show_message(pluto_system_handle_t handle, const char *message, pluto_system_state next) {
+    snprintf(handle->message, sizeof(handle->message), "%s", message);
+    handle->message_next = next;
+
+    return SYS_MESSAGE;
 }
 
-static void get_mac_address(pluto_payment *payment) {
+static void get_mac_address(char device_id[MAC_ADDRESS_LEN]) {
     unsigned char mac[6] = {0};
     esp_efuse_mac_get_default(mac);
     
-    snprintf(payment->device_id, sizeof(payment->device_id), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0],mac[1],mac[2],mac[3],mac[4],mac[5]);
+    snprintf(device_id, MAC_ADDRESS_LEN, "%02X:%02X:%02X:%02X:%02X:%02X", mac[0],mac[1],mac[2],mac[3],mac[4],mac[5]);
 }
 
-static bool pluto_get_pin_code(pluto_system_handle_t handle, pluto_payment *payment) {
-    bool pin_code_entered = false;
-    pluto_event_handle_t event;
-    char buf[LCD_1602_SCREEN_CHAR_WIDTH * LCD_1602_MAX_ROWS + 1];
-    
-    char header[LCD_1602_SCREEN_CHAR_WIDTH + 1];
-    snprintf(header, sizeof(header), "%s %s", payment->amount, CURRENCY);
-    char prompt[] = "Pin: ";
-    
-    char pin_code[PLUTO_PIN_LENGTH];
-
-    uint8_t pin_code_len = 0;
-    lcd_render_pin(handle->lcd_i2c, buf, sizeof(buf), header, prompt, pin_code_len, PLUTO_PIN_LENGTH);
+// Typed amount to minor units, the keypad allows at most PLUTO_AMOUNT_DECIMALS decimals
+static int64_t pluto_amount_to_minor_units(const char *amount) {
+    int64_t value = 0;
+    int8_t decimals = -1;
 
-    while(true) {
-        if (!xQueueReceive(handle->event_queue, &event, pdMS_TO_TICKS(PLUTO_MENU_WAIT_TIME_MS))) {
-            lcd_1602_send_string(handle->lcd_i2c, "Payment failed");
-            vTaskDelay(pdMS_TO_TICKS(PLUTO_ERROR_MESSAGE_TIME_MS));
-            break;
+    for (; *amount != '\0'; amount++) {
+        if (*amount == '.') {
+            decimals = 0;
+            continue;
         }
+        value = value * 10 + (*amount - '0');
+        if (decimals >= 0) decimals++;
+    }
 
-        if (event.event_type == EV_KEY) {
-            if (isdigit((unsigned char)event.key.key_pressed)) {
-                if (pin_code_len < PLUTO_PIN_LENGTH - 1) {
-                    pin_code[pin_code_len++] = event.key.key_pressed;
-                }
-                if (pin_code_len == PLUTO_PIN_LENGTH - 1) {
-                    pin_code[pin_code_len] = '\0';
-                    pin_code_entered = true;
-                }
-            }
-            else if (event.key.key_pressed == 'A' ) {
-                if (pin_code_entered) {
-                    hash_sha256((const unsigned char*)pin_code, strlen(pin_code), payment->pin_code);
-                    break;
-                } 
-                else {
-                    lcd_1602_send_string(handle->lcd_i2c, "Enter 4 digits");
-                    vTaskDelay(pdMS_TO_TICKS(PLUTO_ERROR_MESSAGE_TIME_MS));
-                    xQueueReset(handle->event_queue);
-                }
-            }
-            else if (event.key.key_pressed == 'D' && pin_code_len > 0) {
-                pin_code[--pin_code_len] = '\0';
-            }
-            else if (event.key.key_pressed == 'C') {
-                lcd_1602_send_string(handle->lcd_i2c, "Payment canceled");
-                vTaskDelay(pdMS_TO_TICKS(PLUTO_ERROR_MESSAGE_TIME_MS));
-                break;
-            }
-            lcd_render_pin(handle->lcd_i2c, buf, sizeof(buf), header, prompt, pin_code_len, PLUTO_PIN_LENGTH);
+    // No point typed is a whole amount
+    if (decimals < 0) decimals = 0;
+
+    for (; decimals < PLUTO_AMOUNT_DECIMALS; decimals++) {
+        value *= 10;
+    }
+
+    return value;
+}
+
+// Frees the slots of payments given up on by pluto_payment_timeout once the worker is done with them
+static void pluto_collect_abandoned(pluto_system_handle_t handle) {
+    payment_response_t response;
+
+    for (uint8_t i = 0; i < HTTPS_REQUEST_SLOTS; i++) {
+        if (!https_request_is_done(handle->abandoned_requests[i])) continue;
+
+        https_wait_for_response(handle->abandoned_requests[i], &response);
+        handle->abandoned_requests[i] = NULL;
+
+        ESP_LOGW(PLUTO_TAG, "Payment given up on completed late: %s (HTTP %d)",
+            payment_response_result_name(response.result), (int)response.http_status);
+    }
+}
+
+// Picks a body buffer no request given up on still reads, false if every one is in use
+static bool pluto_select_body(pluto_system_handle_t handle) {
+    pluto_collect_abandoned(handle);
+
+    for (uint8_t i = 0; i < HTTPS_REQUEST_SLOTS; i++) {
+        if (handle->abandoned_requests[i] == NULL) {
+            handle->request_body_index = i;
+            handle->request_body = handle->request_bodies[i];
+            return true;
         }
     }
-    
-    return pin_code_entered;
+
+    return false;
 }
 
-static bool pluto_get_card_number(pluto_system_handle_t handle, pluto_payment *payment) {
-    bool card_scanned = false;
-    pluto_event_handle_t event;
+// The request keeps its body buffer, which pluto_select_body skips until the request completes
+static void pluto_abandon_request(pluto_system_handle_t handle, https_request_handle_t request) {
+    handle->abandoned_requests[handle->request_body_index] = request;
+}
 
-    lcd_1602_send_string(handle->lcd_i2c, "Scan card...");
+// Stored payments go out on their own task, the terminal stays usable meanwhile
+static void pluto_drain_offline() {
+    if (PLUTO_OFFLINE_MODE_ENABLED && wifi_is_connected()) {
+        offline_queue_drain_async();
+    }
+}
+
+// STATE ENTRY AND EXIT
+
+static void pluto_enter_sleeping(pluto_system_handle_t handle) {
+    // A payment left before the pin was confirmed
+    pluto_payment_discard(&handle->builder);
+    txn_trace_end();
+
+    pluto_collect_abandoned(handle);
+    pluto_drain_offline();
 
+    if (handle->input_latency_count > 0) {
+        ESP_LOGI(PLUTO_TAG, "Key handled: avg %d us, max %d us over %lu keys",
+            (int)(handle->input_latency_total_us / handle->input_latency_count),
+            (int)handle->input_latency_max_us, (unsigned long)handle->input_latency_count);
+
+        handle->input_latency_total_us = 0;
+        handle->input_latency_max_us = 0;
+        handle->input_latency_count = 0;
+    }
+
+    display_log_stats(handle->display);
+    display_clear(handle->display);
+}
+
+static void pluto_enter_waiting(pluto_system_handle_t handle) {
+    display_text(handle->display, "A:New payment\nC:Cancel");
+}
+
+static void pluto_render_amount(pluto_system_handle_t handle) {
+    lcd_frame_t frame;
+
+    lcd_render_amount(&frame, "Enter Amount:", handle->amount, CURRENCY);
+    display_frame(handle->display, &frame);
+}
+
+static void pluto_enter_scan_card(pluto_system_handle_t handle) {
+    display_text(handle->display, "Scan card...");
     rc522_start(handle->rc522);
+}
 
-    while (true) {
-        if (!xQueueReceive(handle->event_queue, &event, pdMS_TO_TICKS(PLUTO_MENU_WAIT_TIME_MS))) {
-            lcd_1602_send_string(handle->lcd_i2c, "Payment failed");
-            break;
-        }
+static void pluto_exit_scan_card(pluto_system_handle_t handle) {
+    rc522_pause(handle->rc522);
+}
 
-        if (event.event_type == EV_RFID) {
-            lcd_1602_send_string(handle->lcd_i2c, "Card scanned...");
-            snprintf(payment->card_number, sizeof(payment->card_number), event.rfid.cardNumber);
-            card_scanned = true;
-            break;
-        }
-        else if (event.event_type == EV_SCAN_FAILED) {
-            lcd_1602_send_string(handle->lcd_i2c, "Unkown provider\nOnly Pluto Card");
-            continue;
+static void pluto_render_pin(pluto_system_handle_t handle) {
+    char header[LCD_1602_SCREEN_CHAR_WIDTH + 1];
+
+    const pluto_payment *payment = &handle->builder.payment;
+    int64_t scale = 1;
+
+    // Minor units back to the amount as typed, the same PLUTO_AMOUNT_DECIMALS the parser scaled by
+    for (uint8_t i = 0; i < PLUTO_AMOUNT_DECIMALS; i++) {
+        scale *= 10;
+    }
+
+#if PLUTO_AMOUNT_DECIMALS > 0
+    snprintf(header, sizeof(header), "%ld.%0*ld %s", (long)(payment->amount / scale), PLUTO_AMOUNT_DECIMALS,
+        (long)(payment->amount % scale), payment->currency);
+#else
+    snprintf(header, sizeof(header), "%ld %s", (long)(payment->amount / scale), payment->currency);
+#endif
+    lcd_frame_t frame;
+
+    lcd_render_pin(&frame, header, "Pin: ", handle->pin_code_len, PLUTO_PIN_LENGTH);
+    display_frame(handle->display, &frame);
+}
+
+static void pluto_enter_make_payment(pluto_system_handle_t handle) {
+    display_text(handle->display, "Verifying");
+    display_spinner(handle->display, 0, 10, true);
+}
+
+static void pluto_enter_message(pluto_system_handle_t handle) {
+    display_text(handle->display, handle->message);
+}
+
+static void pluto_enter_wifi_lost(pluto_system_handle_t handle) {
+    display_text(handle->display, "Wifi lost...\nReconnecting...");
+}
+
+// ACTIONS
+
+static pluto_system_state pluto_go(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    return next;
+}
+
+static pluto_system_state pluto_wifi_up(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    ESP_LOGI(PLUTO_TAG, "WIFI CONNECTED");
+    pluto_drain_offline();
+    return next;
+}
+
+static pluto_system_state pluto_wifi_down(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    ESP_LOGE(PLUTO_TAG, "WIFI DISCONNECTED");
+    https_close_connection();
+
+    // Payments are stored and sent once the connection is back
+    if (PLUTO_OFFLINE_MODE_ENABLED) {
+        return SYS_STAY;
+    }
+
+    return next;
+}
+
+static pluto_system_state pluto_message_wifi_down(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    // A payment in progress carries on, like it does outside the message
+    if (handle->message_next != SYS_SLEEPING) {
+        ESP_LOGE(PLUTO_TAG, "WIFI DISCONNECTED");
+        https_close_connection();
+        return SYS_STAY;
+    }
+
+    return pluto_wifi_down(handle, event, next);
+}
+
+static pluto_system_state pluto_wifi_reconnected(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    ESP_LOGI(PLUTO_TAG, "WIFI CONNECTED");
+    return pluto_show_message(handle, "Wifi reconnected", next);
+}
+
+static pluto_system_state pluto_wifi_timeout(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    ESP_LOGE(PLUTO_TAG, "Wifi not back within %d s, restarting", PLUTO_WIFI_RECONNECT_TIME_MS / 1000);
+    esp_restart();
+
+    return SYS_STAY;
+}
+
+static pluto_system_state pluto_message_done(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    return handle->message_next;
+}
+
+static pluto_system_state pluto_message_skip(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    pluto_type_ahead_hold(handle, event);
+    return handle->message_next;
+}
+
+static pluto_system_state pluto_wake(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    pluto_type_ahead_hold(handle, event);
+    return next;
+}
+
+static pluto_system_state pluto_payment_failed(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    return pluto_show_message(handle, "Payment failed", next);
+}
+
+static pluto_system_state pluto_payment_canceled(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    return pluto_show_message(handle, "Payment canceled", next);
+}
+
+static void pluto_log_stats(pluto_system_handle_t handle) {
+    txn_trace_dump();
+    event_bus_log_stats(handle->event_bus);
+    clock_discipline_log_stats();
+    display_log_stats(handle->display);
+    keypad_log_stats();
+
+    ESP_LOGI(PLUTO_TAG, "Type-ahead: %lu replayed, %lu stale, %lu flushed", (unsigned long)handle->type_ahead_replayed,
+        (unsigned long)handle->type_ahead_stale, (unsigned long)handle->type_ahead_flushed);
+    handle->type_ahead_replayed = 0;
+    handle->type_ahead_stale = 0;
+    handle->type_ahead_flushed = 0;
+}
+
+static pluto_system_state pluto_dump_stats(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    pluto_log_stats(handle);
+    return next;
+}
+
+static pluto_system_state pluto_start_payment(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    txn_trace_begin();
+
+    // Handshake while the customer enters amount, card and pin
+    if (wifi_is_connected()) {
+        https_prewarm_connection();
+    }
+
+    pluto_payment *payment = &handle->builder.payment;
+
+    pluto_payment_discard(&handle->builder);
+    memset(payment, 0, sizeof(*payment));
+    snprintf(payment->operation, sizeof(payment->operation), "send_payment");
+    memcpy(payment->device_id, handle->device_id, sizeof(payment->device_id));
+
+    snprintf(handle->amount, sizeof(handle->amount), "0");
+    handle->amount_len = 1;
+    handle->comma_entered = false;
+    handle->decimals_entered = 0;
+
+    return next;
+}
+
+// The amount typed on the menu starts the payment and is its first key
+static pluto_system_state pluto_start_typed_payment(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    pluto_type_ahead_hold(handle, event);
+    return pluto_start_payment(handle, event, next);
+}
+
+static pluto_system_state pluto_amount_key(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    char key = event->key.key_pressed;
+
+    if (handle->amount_len < PLUTO_AMOUNT_MAX_LEN - 1 && handle->decimals_entered < PLUTO_AMOUNT_DECIMALS) {
+        if (isdigit((unsigned char)key)) {
+            // resetting if its the first entry
+            if (handle->amount_len == 1 && handle->amount[0] == '0') handle->amount_len = 0;
+            handle->amount[handle->amount_len++] = key;
+            handle->amount[handle->amount_len] = '\0';
+            if (handle->comma_entered) handle->decimals_entered++;
         }
-        else if (event.event_type == EV_KEY) {
-            if (event.key.key_pressed == 'C') {
-                lcd_1602_send_string(handle->lcd_i2c, "Payment canceled");
-                break;
+        else if (key == '*' && !handle->comma_entered) {
+            if (handle->amount_len == 0) {
+                handle->amount[handle->amount_len++] = '0';
             }
+
+            handle->amount[handle->amount_len++] = '.';
+            handle->amount[handle->amount_len] = '\0';
+            handle->comma_entered = true;
         }
     }
-    vTaskDelay(pdMS_TO_TICKS(PLUTO_ERROR_MESSAGE_TIME_MS));
-    rc522_pause(handle->rc522);
-    
-    return card_scanned;
+
+    pluto_render_amount(handle);
+    return next;
 }
 
-static bool pluto_get_amount(pluto_system_handle_t handle, pluto_payment *payment) {
+static pluto_system_state pluto_amount_delete(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    // If there is amount entered
+    if (handle->amount_len > 0) {
+        // if its a comma
+        if (handle->amount[handle->amount_len - 1] == '.') {
+            handle->comma_entered = false;
+            handle->decimals_entered = 0;
+        }
+        // if its a decimal
+        else if (handle->comma_entered && handle->decimals_entered > 0) handle->decimals_entered--;
 
-    pluto_event_handle_t event;
-    
-    char display_string [(LCD_1602_SCREEN_CHAR_WIDTH * LCD_1602_MAX_ROWS) + 1];
-    
-    lcd_render_amount(handle->lcd_i2c, display_string, sizeof(display_string), "Enter Amount:", "0", CURRENCY);
-    
-    char amount[PLUTO_AMOUNT_MAX_LEN] = "0";
-    uint8_t chars_entered = 1;
+        handle->amount[--handle->amount_len] = '\0';
+    }
 
-    bool comma_entered = false;
-    uint8_t decimals_entered = 0;
-    uint8_t max_decimals = 2;
+    // if there's no characters left
+    if (handle->amount_len == 0) {
+        handle->amount[0] = '0';
+        handle->amount[1] = '\0';
+        handle->amount_len = 1;
+    }
 
-    while (true) {
-        
-        if (!xQueueReceive(handle->event_queue, &event, pdMS_TO_TICKS(PLUTO_MENU_WAIT_TIME_MS))) break;
-
-        if (event.event_type == EV_KEY) {
-            if (event.key.key_pressed == 'A') {
-                snprintf(payment->amount, sizeof(payment->amount), "%s", amount);
-                snprintf(payment->currency, sizeof(payment->currency), "%s", CURRENCY);
-                return true;
-            }
+    pluto_render_amount(handle);
+    return next;
+}
 
-            else if (event.key.key_pressed == 'C') {
-                break;
-            }
+static pluto_system_state pluto_amount_confirm(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    txn_trace_mark_at(TXN_STAGE_AMOUNT_CONFIRMED, event->timestamp_us);
 
-            // Delete entered symbols
-            else if (event.key.key_pressed == 'D') {
-                // If there is amount entered
-                if (chars_entered > 0) {
-                    // if its a comma
-                    if(amount[chars_entered - 1] == '.' ){
-                        comma_entered = false;
-                        decimals_entered = 0;
-                    }
-                    // if its a decimal
-                    else if (comma_entered && decimals_entered > 0) decimals_entered--;
-                    
-                    amount[--chars_entered] = '\0';
-                }
-                
-                // if there's no characters left
-                if (chars_entered == 0) {
-                    amount[0] = '0';
-                    amount[1] = '\0';
-                    chars_entered = 1;
-                }
-
-                lcd_render_amount(handle->lcd_i2c, display_string, sizeof(display_string), "Enter Amount:", amount, CURRENCY);
-            }
-            
-            else if (chars_entered < PLUTO_AMOUNT_MAX_LEN - 1 && decimals_entered < max_decimals) {
-                if (isdigit((unsigned char)event.key.key_pressed)) {
-                    // resetting if its the first entry
-                    if (chars_entered == 1 && amount[0] == '0') chars_entered = 0;
-                    amount[chars_entered++] = event.key.key_pressed;
-                    amount[chars_entered] = '\0';
-                    if (comma_entered) decimals_entered++;
-                }
-                else if (event.key.key_pressed == '*' && !comma_entered) {
-                    if(chars_entered == 0) {
-                        amount[chars_entered++] = '0';
-                    }
-
-                    amount[chars_entered++] = '.';
-                    amount[chars_entered] = '\0';
-                    comma_entered = true;
-                }
-
-                lcd_render_amount(handle->lcd_i2c, display_string, sizeof(display_string), "Enter Amount:", amount, CURRENCY);
-            }
-        }
+    handle->builder.payment.amount = pluto_amount_to_minor_units(handle->amount);
+    snprintf(handle->builder.payment.currency, sizeof(handle->builder.payment.currency), "%s", CURRENCY);
+
+    return next;
+}
+
+static pluto_system_state pluto_card_scanned(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    txn_trace_mark(TXN_STAGE_CARD_READ);
+
+    event_bus_take_card(handle->event_bus, handle->builder.payment.card_number, sizeof(handle->builder.payment.card_number));
+
+    handle->pin_code_len = 0;
+    handle->pin_code[0] = '\0';
+
+    // Every request slot is held by a payment given up on that has not completed yet
+    if (!pluto_select_body(handle)) {
+        return pluto_show_message(handle, "Payment failed\nTerminal busy", SYS_SLEEPING);
+    }
+
+    // Everything but the pin is known now, write and hash it while the pin is typed
+    if (pluto_payment_prepare(&handle->builder, handle->request_body, HTTP_REQUEST_BODY_SIZE) != ESP_OK) {
+        return pluto_show_message(handle, "Payment failed", SYS_SLEEPING);
+    }
+
+    return pluto_show_message(handle, "Card scanned...", next);
+}
+
+static pluto_system_state pluto_scan_failed(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    // The scan screen comes back by itself, the reader keeps scanning
+    display_toast(handle->display, "Unkown provider\nOnly Pluto Card", PLUTO_ERROR_MESSAGE_TIME_MS);
+    return next;
+}
+
+static pluto_system_state pluto_pin_digit(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    if (handle->pin_code_len < PLUTO_PIN_LENGTH - 1) {
+        handle->pin_code[handle->pin_code_len++] = event->key.key_pressed;
+        handle->pin_code[handle->pin_code_len] = '\0';
+    }
+
+    pluto_render_pin(handle);
+    return next;
+}
+
+static pluto_system_state pluto_pin_delete(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    if (handle->pin_code_len > 0) {
+        handle->pin_code[--handle->pin_code_len] = '\0';
+    }
+
+    pluto_render_pin(handle);
+    return next;
+}
+
+static pluto_system_state pluto_pin_confirm(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    if (handle->pin_code_len < PLUTO_PIN_LENGTH - 1) {
+        return pluto_show_message(handle, "Enter 4 digits", SYS_ENTER_PIN);
+    }
+
+    handle->confirm_us = event->timestamp_us;
+    txn_trace_mark_at(TXN_STAGE_PIN_CONFIRMED, event->timestamp_us);
+
+    uint8_t pin_digest[SHA256_DIGEST_SIZE];
+    char hashed_body[SHA256_OUT_BUF_SIZE] = {0};
+    char message[PLUTO_LCD_TEXT_SIZE];
+
+    hash_sha256_digest((const unsigned char*)handle->pin_code, handle->pin_code_len, pin_digest);
+    memset(handle->pin_code, 0, sizeof(handle->pin_code));
+
+    // Only the pin is left to write, the rest of the body was hashed when the card was scanned
+    esp_err_t ret = pluto_payment_finish(&handle->builder, pin_digest, &handle->request_body_len, hashed_body);
+    memset(pin_digest, 0, sizeof(pin_digest));
+
+    if (ret != ESP_OK) {
+        return pluto_show_message(handle, "Payment failed", SYS_SLEEPING);
+    }
 
-        else if (event.event_type == EV_WIFI) {
-            pluto_wifi_state_logic(handle, event);
-            break;
+    // create HMAC, kept until the request is done in case it has to be stored offline
+    sec_sign_request(hashed_body, handle->request_hmac);
+    txn_trace_mark(TXN_STAGE_SIGNED);
+
+    if (PLUTO_OFFLINE_MODE_ENABLED && !wifi_is_connected()) {
+        if (offline_queue_append(handle->request_body, handle->request_body_len, handle->request_hmac) == ESP_OK) {
+            snprintf(message, sizeof(message), "Stored offline\nQueued: %lu", (unsigned long)offline_queue_depth());
+        } else {
+            snprintf(message, sizeof(message), "Payment failed\nOffline queue full");
         }
+        return pluto_show_message(handle, message, SYS_SLEEPING);
     }
 
-    return false;
+    if (https_submit_request(handle->request_body, handle->request_body_len, handle->request_hmac,
+                             pluto_request_done, handle, &handle->pending_request) != ESP_OK) {
+        payment_response_t response;
+        payment_response_no_answer(&response, false);
+        payment_response_lcd_text(&response, message, sizeof(message));
+        return pluto_show_message(handle, message, SYS_SLEEPING);
+    }
+
+    // Log what CBOR saves over JSON once per boot, after the request is on its way
+    if (PLUTO_PAYMENT_ENCODING_CBOR && !handle->encodings_compared) {
+        pluto_payment_compare_encodings(&handle->builder.payment);
+        handle->encodings_compared = true;
+    }
+
+    return next;
 }
 
-// create payment
-static void pluto_create_payment(pluto_system_handle_t handle) {
+static pluto_system_state pluto_payment_late(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    pluto_collect_abandoned(handle);
+    return next;
+}
 
-    pluto_update_state(handle, SYS_CREATE_PAYMENT);
+static pluto_system_state pluto_payment_done(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    char response_out[PLUTO_LCD_TEXT_SIZE];
+    payment_response_t response;
 
-    pluto_payment payment = {
-        .operation = "send_payment"
-    };
+    // The completion may be that of an earlier payment given up on
+    pluto_collect_abandoned(handle);
+    if (!https_request_is_done(handle->pending_request)) return SYS_STAY;
 
-    if (pluto_get_amount(handle, &payment) &&
-        pluto_get_card_number(handle, &payment) &&
-        pluto_get_pin_code(handle, &payment))
-        {
-        
-        lcd_1602_send_string(handle->lcd_i2c, "Verifying ...");
-
-        // get important values
-        time_get_current_time(payment.date, sizeof(payment.date));
-        sec_generate_nonce(payment.nonce, sizeof(payment.nonce));
-        get_mac_address(&payment);
-        
-        // create request body
-        char *payment_values[PAYMENT_KEY_SIZE] = {0};
-        char request_body[HTTP_REQUEST_BODY_SIZE] = {0};
-        pluto_create_values(&payment, payment_values);
-        create_request_body((const char **)payment_keys, (const char **)payment_values, PAYMENT_KEY_SIZE, request_body, sizeof(request_body));
-        
-        // hash body
-        char hashed_body[SHA256_OUT_BUF_SIZE] = {0};
-        hash_sha256((const unsigned char*) request_body, strlen(request_body), hashed_body);
-
-        // create HMAC
-        char device_key[] = DEVICE_KEY;
-        char canonical_string[CANONICAL_STRING_SIZE] = {0};
-        char hmac_hashed[SHA256_OUT_BUF_SIZE] = {0};
-        build_canonical_string(hashed_body, canonical_string, sizeof(canonical_string));
-
-        strncat(canonical_string, device_key, sizeof(canonical_string) - strlen(canonical_string));
-        hash_sha256((const unsigned char*) canonical_string, strlen(canonical_string), hmac_hashed);
-        
-        send_request(handle, hmac_hashed, request_body);
-
-        vTaskDelay(pdMS_TO_TICKS(PLUTO_ERROR_MESSAGE_TIME_MS));
-    }
-
-    lcd_1602_clear_screen(handle->lcd_i2c);
-}
-
-// wakeup
-static void pluto_run_menu(pluto_system_handle_t handle) {
-    pluto_event_handle_t event;
-    
-    pluto_update_state(handle, SYS_WAITING);
+    int64_t first_byte_us = https_request_first_byte_us(handle->pending_request);
+    if (first_byte_us > 0 && handle->confirm_us > 0) {
+        ESP_LOGI(PLUTO_TAG, "Confirm to first byte: %d us", (int)(first_byte_us - handle->confirm_us));
+    }
 
-    lcd_1602_send_string(handle->lcd_i2c, "A:New payment\nC:Cancel");
+    // Already complete, this only collects the response and frees the slot
+    esp_err_t ret = https_wait_for_response(handle->pending_request, &response);
+    handle->pending_request = NULL;
 
-    while(true) {
-        if (!xQueueReceive(handle->event_queue, &event, pdMS_TO_TICKS(PLUTO_MENU_WAIT_TIME_MS))) break;
+    ESP_LOGI(PLUTO_TAG, "Payment result %s (HTTP %d)", payment_response_result_name(response.result), (int)response.http_status);
 
-        if (event.event_type == EV_KEY) {
-            if (event.key.key_pressed == 'A') {
-                pluto_create_payment(handle);
-                break;
-            }
-            else if (event.key.key_pressed == 'C') {
-                break;
-            }
+    // Kept for looking the payment up with the server later
+    if (ret == ESP_OK) {
+        snprintf(handle->last_authorization_id, sizeof(handle->last_authorization_id), "%s", response.authorization_id);
+        ESP_LOGI(PLUTO_TAG, "Authorization id: %s", handle->last_authorization_id);
+    }
+
+    // Never sent, so the server cannot have seen it. A payment that was sent and not answered
+    // stays as it is, storing it would send it a second time.
+    if (ret == ESP_FAIL && PLUTO_OFFLINE_MODE_ENABLED) {
+        if (offline_queue_append(handle->request_body, handle->request_body_len, handle->request_hmac) == ESP_OK) {
+            snprintf(response_out, sizeof(response_out), "Stored offline\nQueued: %lu", (unsigned long)offline_queue_depth());
+            return pluto_show_message(handle, response_out, next);
         }
+    }
+
+    payment_response_lcd_text(&response, response_out, sizeof(response_out));
+    return pluto_show_message(handle, response_out, next);
+}
+
+static pluto_system_state pluto_payment_timeout(pluto_system_handle_t handle, const pluto_event_handle_t *event, pluto_system_state next) {
+    char message[PLUTO_LCD_TEXT_SIZE];
+    payment_response_t response;
+
+    // Done, only the completion event was lost
+    if (https_request_is_done(handle->pending_request)) {
+        return pluto_payment_done(handle, event, next);
+    }
+
+    // It may still go out, so it is neither stored offline nor sent again
+    ESP_LOGE(PLUTO_TAG, "No payment result within %d s, giving up", PLUTO_PAYMENT_TIMEOUT_MS / 1000);
+    pluto_abandon_request(handle, handle->pending_request);
+    handle->pending_request = NULL;
 
-        else if (event.event_type == EV_WIFI) {
-            pluto_wifi_state_logic(handle, event);
-            break;
+    payment_response_no_answer(&response, true);
+    payment_response_lcd_text(&response, message, sizeof(message));
+    return pluto_show_message(handle, message, next);
+}
+
+// STATE TABLE
+// Keys typed before the card is read are never pin digits, and none carry past a payment being sent
+static const pluto_state_config_t pluto_states[SYS_STATE_COUNT] = {
+    [SYS_SLEEPING]      = {"SLEEPING",      pluto_enter_sleeping,       NULL,                   0,                              TYPE_AHEAD_REPLAY},
+    [SYS_WAITING]       = {"WAITING",       pluto_enter_waiting,        NULL,                   PLUTO_MENU_WAIT_TIME_MS,        TYPE_AHEAD_REPLAY},
+    [SYS_ENTER_AMOUNT]  = {"ENTER_AMOUNT",  pluto_render_amount,        NULL,                   PLUTO_MENU_WAIT_TIME_MS,        TYPE_AHEAD_REPLAY},
+    [SYS_SCAN_CARD]     = {"SCAN_CARD",     pluto_enter_scan_card,      pluto_exit_scan_card,   PLUTO_MENU_WAIT_TIME_MS,        TYPE_AHEAD_FLUSH},
+    [SYS_ENTER_PIN]     = {"ENTER_PIN",     pluto_render_pin,           NULL,                   PLUTO_MENU_WAIT_TIME_MS,        TYPE_AHEAD_REPLAY},
+    [SYS_MAKE_PAYMENT]  = {"MAKE_PAYMENT",  pluto_enter_make_payment,   NULL,                   PLUTO_PAYMENT_TIMEOUT_MS,       TYPE_AHEAD_FLUSH},
+    [SYS_MESSAGE]       = {"MESSAGE",       pluto_enter_message,        NULL,                   PLUTO_ERROR_MESSAGE_TIME_MS,    TYPE_AHEAD_REPLAY},
+    [SYS_WIFI_LOST]     = {"WIFI_LOST",     pluto_enter_wifi_lost,      NULL,                   PLUTO_WIFI_RECONNECT_TIME_MS,   TYPE_AHEAD_FLUSH},
+};
+
+// TRANSITION TABLE, EMPTY ENTRIES IGNORE THE INPUT
+static const pluto_transition_t pluto_transitions[SYS_STATE_COUNT][INPUT_COUNT] = {
+    [SYS_SLEEPING] = {
+        // The key that wakes the terminal also counts on the menu
+        [INPUT_DIGIT]           = {pluto_wake,              SYS_WAITING},
+        [INPUT_POINT]           = {pluto_wake,              SYS_WAITING},
+        [INPUT_CONFIRM]         = {pluto_wake,              SYS_WAITING},
+        [INPUT_CANCEL]          = {pluto_go,                SYS_WAITING},
+        [INPUT_DELETE]          = {pluto_go,                SYS_WAITING},
+        [INPUT_STATS]           = {pluto_wake,              SYS_WAITING},
+        [INPUT_OTHER_KEY]       = {pluto_go,                SYS_WAITING},
+        [INPUT_WIFI_UP]         = {pluto_wifi_up,           SYS_STAY},
+        [INPUT_WIFI_DOWN]       = {pluto_wifi_down,         SYS_WIFI_LOST},
+        [INPUT_PAYMENT_DONE]    = {pluto_payment_late,      SYS_STAY},
+    },
+    [SYS_WAITING] = {
+        [INPUT_DIGIT]           = {pluto_start_typed_payment, SYS_ENTER_AMOUNT},
+        [INPUT_POINT]           = {pluto_start_typed_payment, SYS_ENTER_AMOUNT},
+        [INPUT_CONFIRM]         = {pluto_start_payment,     SYS_ENTER_AMOUNT},
+        [INPUT_CANCEL]          = {pluto_go,                SYS_SLEEPING},
+        [INPUT_STATS]           = {pluto_dump_stats,        SYS_STAY},
+        [INPUT_WIFI_UP]         = {pluto_wifi_up,           SYS_STAY},
+        [INPUT_WIFI_DOWN]       = {pluto_wifi_down,         SYS_WIFI_LOST},
+        [INPUT_TIMEOUT]         = {pluto_go,                SYS_SLEEPING},
+        [INPUT_PAYMENT_DONE]    = {pluto_payment_late,      SYS_STAY},
+    },
+    [SYS_ENTER_AMOUNT] = {
+        [INPUT_DIGIT]           = {pluto_amount_key,        SYS_STAY},
+        [INPUT_POINT]           = {pluto_amount_key,        SYS_STAY},
+        [INPUT_DELETE]          = {pluto_amount_delete,     SYS_STAY},
+        [INPUT_CONFIRM]         = {pluto_amount_confirm,    SYS_SCAN_CARD},
+        [INPUT_CANCEL]          = {pluto_go,                SYS_SLEEPING},
+        [INPUT_WIFI_UP]         = {pluto_wifi_up,           SYS_STAY},
+        [INPUT_WIFI_DOWN]       = {pluto_wifi_down,         SYS_WIFI_LOST},
+        [INPUT_TIMEOUT]         = {pluto_go,                SYS_SLEEPING},
+        [INPUT_PAYMENT_DONE]    = {pluto_payment_late,      SYS_STAY},
+    },
+    [SYS_SCAN_CARD] = {
+        [INPUT_CARD]            = {pluto_card_scanned,      SYS_ENTER_PIN},
+        [INPUT_SCAN_FAILED]     = {pluto_scan_failed,       SYS_STAY},
+        [INPUT_CANCEL]          = {pluto_payment_canceled,  SYS_SLEEPING},
+        [INPUT_WIFI_UP]         = {pluto_wifi_up,           SYS_STAY},
+        [INPUT_WIFI_DOWN]       = {pluto_wifi_down,         SYS_STAY},
+        [INPUT_TIMEOUT]         = {pluto_payment_failed,    SYS_SLEEPING},
+        [INPUT_PAYMENT_DONE]    = {pluto_payment_late,      SYS_STAY},
+    },
+    [SYS_ENTER_PIN] = {
+        [INPUT_DIGIT]           = {pluto_pin_digit,         SYS_STAY},
+        [INPUT_DELETE]          = {pluto_pin_delete,        SYS_STAY},
+        [INPUT_CONFIRM]         = {pluto_pin_confirm,       SYS_MAKE_PAYMENT},
+        [INPUT_CANCEL]          = {pluto_payment_canceled,  SYS_SLEEPING},
+        [INPUT_WIFI_UP]         = {pluto_wifi_up,           SYS_STAY},
+        [INPUT_WIFI_DOWN]       = {pluto_wifi_down,         SYS_STAY},
+        [INPUT_TIMEOUT]         = {pluto_payment_failed,    SYS_SLEEPING},
+        [INPUT_PAYMENT_DONE]    = {pluto_payment_late,      SYS_STAY},
+    },
+    [SYS_MAKE_PAYMENT] = {
+        [INPUT_PAYMENT_DONE]    = {pluto_payment_done,      SYS_SLEEPING},
+        [INPUT_TIMEOUT]         = {pluto_payment_timeout,   SYS_SLEEPING},
+        [INPUT_WIFI_UP]         = {pluto_wifi_up,           SYS_STAY},
+        [INPUT_WIFI_DOWN]       = {pluto_wifi_down,         SYS_STAY},
+    },
+    [SYS_MESSAGE] = {
+        // Any key skips the message and counts on the next screen, cancel only dismisses it
+        [INPUT_DIGIT]           = {pluto_message_skip,      SYS_STAY},
+        [INPUT_POINT]           = {pluto_message_skip,      SYS_STAY},
+        [INPUT_CONFIRM]         = {pluto_message_skip,      SYS_STAY},
+        [INPUT_CANCEL]          = {pluto_message_done,      SYS_STAY},
+        [INPUT_DELETE]          = {pluto_message_skip,      SYS_STAY},
+        [INPUT_STATS]           = {pluto_message_skip,      SYS_STAY},
+        [INPUT_OTHER_KEY]       = {pluto_message_done,      SYS_STAY},
+        [INPUT_WIFI_UP]         = {pluto_wifi_up,           SYS_STAY},
+        [INPUT_WIFI_DOWN]       = {pluto_message_wifi_down, SYS_WIFI_LOST},
+        [INPUT_TIMEOUT]         = {pluto_message_done,      SYS_STAY},
+        [INPUT_PAYMENT_DONE]    = {pluto_payment_late,      SYS_STAY},
+    },
+    [SYS_WIFI_LOST] = {
+        [INPUT_WIFI_UP]         = {pluto_wifi_reconnected,  SYS_SLEEPING},
+        [INPUT_TIMEOUT]         = {pluto_wifi_timeout,      SYS_STAY},
+        [INPUT_PAYMENT_DONE]    = {pluto_payment_late,      SYS_STAY},
+    },
+};
+
+static pluto_input pluto_classify_event(pluto_system_handle_t handle, const pluto_event_handle_t *event) {
+    switch (event->event_type) {
+        case EV_KEY: {
+            char key = event->key.key_pressed;
+
+            if (isdigit((unsigned char)key)) return INPUT_DIGIT;
+            if (key == '*') return INPUT_POINT;
+            if (key == 'A') return INPUT_CONFIRM;
+            if (key == 'C') return INPUT_CANCEL;
+            if (key == 'D') return INPUT_DELETE;
+            if (key == 'B') return INPUT_STATS;
+            return INPUT_OTHER_KEY;
         }
+
+        case EV_RFID:
+            return INPUT_CARD;
+
+        case EV_SCAN_FAILED:
+            return INPUT_SCAN_FAILED;
+
+        case EV_WIFI:
+            return event->wifi.isConnected ? INPUT_WIFI_UP : INPUT_WIFI_DOWN;
+
+        case EV_TIMER:
+            // Posted for an earlier arming, possibly while the current one was being armed
+            if (handle->timer_deadline_us == 0 || esp_timer_get_time() < handle->timer_deadline_us) return INPUT_NONE;
+
+            // Counted once, a late event of the same arming is ignored
+            handle->timer_deadline_us = 0;
+            return INPUT_TIMEOUT;
+
+        case EV_PAYMENT_DONE:
+            return INPUT_PAYMENT_DONE;
+
+        default:
+            return INPUT_NONE;
+    }
+}
+
+static void pluto_enter_state(pluto_system_handle_t handle, pluto_system_state state) {
+    const pluto_state_config_t *old_state = &pluto_states[handle->current_state];
+    const pluto_state_config_t *new_state = &pluto_states[state];
+
+    if (old_state->on_exit != NULL) old_state->on_exit(handle);
+
+    ESP_LOGD(PLUTO_TAG, "%s -> %s", old_state->name, new_state->name);
+
+    handle->current_state = state;
+
+    if (new_state->type_ahead == TYPE_AHEAD_FLUSH) pluto_type_ahead_flush(handle);
+
+    if (new_state->on_enter != NULL) new_state->on_enter(handle);
+}
+
+static void pluto_dispatch(pluto_system_handle_t handle, const pluto_event_handle_t *event) {
+    pluto_input input = pluto_classify_event(handle, event);
+    if (input == INPUT_NONE) return;
+
+    if (event->event_type == EV_WIFI && event->timestamp_us > 0) {
+        ESP_LOGI(PLUTO_TAG, "Wi-Fi change reached the state machine after %d us", (int)(esp_timer_get_time() - event->timestamp_us));
+    }
+
+    const pluto_transition_t *transition = &pluto_transitions[handle->current_state][input];
+    if (transition->action == NULL) return;
+
+    pluto_system_state next = transition->action(handle, event, transition->next);
+
+    if (next != SYS_STAY) {
+        pluto_enter_state(handle, next);
+    }
+
+    // Entering a state starts its timeout and a key on a screen restarts it. Wi-Fi changes and late
+    // payment results leave it running, they must not push back the payment timeout or the restart.
+    if (next != SYS_STAY || event->event_type == EV_KEY) {
+        pluto_arm_timer(handle, pluto_states[handle->current_state].timeout_ms);
+    }
+}
+
+static void pluto_handle_event(pluto_system_handle_t handle, const pluto_event_handle_t *event) {
+    pluto_event_handle_t held;
+
+    // Asked for from the console, logged in any state without touching it
+    if (event->event_type == EV_STATS) {
+        pluto_log_stats(handle);
+        return;
+    }
+
+    pluto_dispatch(handle, event);
+
+    // Keys held by the transition go to the screen it ended on, which may hold them again
+    while (pluto_type_ahead_take(handle, &held)) {
+        pluto_dispatch(handle, &held);
     }
 
-    lcd_1602_clear_screen(handle->lcd_i2c);
+    if (event->event_type == EV_KEY && event->timestamp_us > 0) {
+        int64_t latency_us = esp_timer_get_time() - event->timestamp_us;
+
+        handle->input_latency_total_us += latency_us;
+        handle->input_latency_count++;
+        if (latency_us > handle->input_latency_max_us) handle->input_latency_max_us = latency_us;
+
+        ESP_LOGD(PLUTO_TAG, "Key '%c' handled after %d us", event->key.key_pressed, (int)latency_us);
+    }
 }
 
 uint8_t pluto_run(pluto_system_handle_t handle) {
@@ -404,28 +945,13 @@ uint8_t pluto_run(pluto_system_handle_t handle) {
 
     pluto_event_handle_t event;
 
-    while (true) {
-        lcd_1602_clear_screen(handle->lcd_i2c);
+    pluto_enter_state(handle, SYS_SLEEPING);
 
-        if (handle->current_state != SYS_SLEEPING) {
-            xQueueReset(handle->event_queue);
-            pluto_update_state(handle, SYS_SLEEPING);
-        }
+    // Keys, cards, Wi-Fi changes, timeouts and network completions are all handled here as they arrive
+    while (true) {
+        if (!event_bus_receive(handle->event_bus, &event, portMAX_DELAY)) continue;
 
-        if (!xQueueReceive(handle->event_queue, &event, portMAX_DELAY)) continue;
-        
-        switch (event.event_type) {
-            case EV_KEY:
-                pluto_run_menu(handle);
-                break;
-            
-            case EV_WIFI:
-                pluto_wifi_state_logic(handle, event);
-                break;
-
-            default:
-                continue;
-        }
+        pluto_handle_event(handle, &event);
     }
 
     return 0;
@@ -447,10 +973,38 @@ uint8_t pluto_system_init(pluto_system_handle_t *handle) {
         return 1;
     }
 
-    // CREATE QUEUE
-    temp_handle->event_queue = xQueueCreate(10, sizeof(pluto_event_handle_t));
-    if (temp_handle->event_queue == NULL) {
-        ESP_LOGE(PLUTO_TAG, "Failed to create queue");
+    // CREATE EVENT BUS
+    if (event_bus_create(&temp_handle->event_bus) != ESP_OK) {
+        ESP_LOGE(PLUTO_TAG, "Failed to create event bus");
+        goto exit;
+    }
+
+    // CREATE STATE TIMER
+    const esp_timer_create_args_t timer_args = {
+        .callback = pluto_timer_callback,
+        .arg = temp_handle,
+        .name = "pluto_state"
+    };
+    if (esp_timer_create(&timer_args, &temp_handle->state_timer) != ESP_OK) {
+        ESP_LOGE(PLUTO_TAG, "Failed to create state timer");
+        goto exit;
+    }
+
+    // START HTTPS WORKER
+    if (https_worker_init() != ESP_OK) {
+        ESP_LOGE(PLUTO_TAG, "Failed to start https worker");
+        goto exit;
+    }
+
+    // PREPARE REQUEST SIGNING
+    if (sec_signer_init() != ESP_OK) {
+        ESP_LOGE(PLUTO_TAG, "Failed to prepare request signing");
+        goto exit;
+    }
+
+    // RESTORE OFFLINE PAYMENT QUEUE
+    if (PLUTO_OFFLINE_MODE_ENABLED && offline_queue_init() != ESP_OK) {
+        ESP_LOGE(PLUTO_TAG, "Failed to restore offline queue");
         goto exit;
     }
 
@@ -469,24 +1023,27 @@ uint8_t pluto_system_init(pluto_system_handle_t *handle) {
         goto exit;
     }
 
-    const uint8_t keypad_rows[] = KEYPAD_ROW_PINS;
-    const uint8_t keypad_cols[] = KEYPAD_COL_PINS;
+    // START DISPLAY TASK, THE ONLY WRITER OF THE LCD FROM HERE ON
+    if (display_start(&temp_handle->display, temp_handle->lcd_i2c) != ESP_OK) {
+        ESP_LOGE(PLUTO_TAG, "Failed to start display task");
+        goto exit;
+    }
 
-    // INITIALIZE KEYBOARD
-    if (_4x4_matrix_init(keypad_rows, keypad_cols) != 0) {
+    // INITIALIZE KEYBOARD, KEYS ARE ONLY POSTED ONCE IT IS STARTED
+    if (keypad_init(temp_handle->event_bus) != ESP_OK) {
         ESP_LOGE(PLUTO_TAG, "Failed to initialize keyboard");
         goto exit;
     }
 
     // INITIALIZE RC522
-    if (rc522_init(&temp_handle->rc522, temp_handle->event_queue) != 0) {
+    if (rc522_init(&temp_handle->rc522, temp_handle->event_bus) != 0) {
         ESP_LOGE(PLUTO_TAG, "Failed to initialize RC522 scanner");
         goto exit;
     }
 
     // INITIALIZE WIFI
-    lcd_1602_send_string(temp_handle->lcd_i2c, "Connecting to\ninternet...");
-    if (wifi_init() != 0) {
+    display_text(temp_handle->display, "Connecting to\ninternet...");
+    if (wifi_init(temp_handle->event_bus) != 0) {
         ESP_LOGE(PLUTO_TAG, "Failed to initialize Wi-fi");
         goto exit;
     } else {
@@ -498,23 +1055,39 @@ uint8_t pluto_system_init(pluto_system_handle_t *handle) {
         ESP_LOGE(PLUTO_TAG, "Failed to connect to Wi-fi");
         goto exit;
     }
-    lcd_1602_send_string(temp_handle->lcd_i2c, "Connected!");
+    display_text(temp_handle->display, "Connected!");
+
+    // The device id is the same for every payment
+    get_mac_address(temp_handle->device_id);
 
     temp_handle->current_state = SYS_SLEEPING;
 
     *handle = temp_handle;
-    xTaskCreate(wifi_check_status, "wifi_check_status", 2048, temp_handle->event_queue, 5, NULL);
-    xTaskCreate(_4x4_matrix_task, "_4x4_matrix_task", KEYPAD_TASK_WORD_SIZE, temp_handle->event_queue, 5, NULL);
+    keypad_start();
+
+    // STATS ON THE SERIAL CONSOLE, THE DEVICE WORKS WITHOUT IT
+    if (pluto_console_start(temp_handle->event_bus) != ESP_OK) {
+        ESP_LOGW(PLUTO_TAG, "Console not available");
+    }
 
     return 0;
 
 exit:
-    if (temp_handle->event_queue != NULL) {
-        QueueHandle_t temp_queue = temp_handle->event_queue;
-        temp_handle->event_queue = NULL;
-        vQueueDelete(temp_queue);
+    if (temp_handle->state_timer != NULL) {
+        esp_timer_delete(temp_handle->state_timer);
+        temp_handle->state_timer = NULL;
+    }
+
+    if (temp_handle->event_bus != NULL) {
+        event_bus_destroy(temp_handle->event_bus);
+        temp_handle->event_bus = NULL;
     }
     
+    if (temp_handle->display != NULL) {
+        display_stop(temp_handle->display);
+        temp_handle->display = NULL;
+    }
+
     if (i2c_is_created) {
         ESP_ERROR_CHECK(i2c_master_bus_rm_device(temp_handle->lcd_i2c));
         ESP_ERROR_CHECK(i2c_del_master_bus(bus_handle));
@@ -10,10 +10,11 @@
 #include <ctype.h>
 
 #include "pluto_events.h"
+#include "event_bus.h"
 
 static const char *TAG = "rc522";
 
-static QueueHandle_t queue;
+static event_bus_handle_t bus;
 static bool rc522_is_created = false;
 
 static bool rfid_check_check_card_format(char *card_number, size_t str_size) {
@@ -39,19 +40,21 @@ static void on_picc_state_changed(void *arg, esp_event_base_t base, int32_t even
     rc522_picc_t *picc = event->picc;
 
     if (picc->state == RC522_PICC_STATE_ACTIVE) {
-        pluto_event_handle_t event = {
-            .event_type = EV_RFID,
-        };
+        char card_number[EVENT_CARD_NUMBER_SIZE];
 
-        rc522_picc_uid_to_str(&picc->uid, event.rfid.cardNumber, sizeof(event.rfid.cardNumber));
+        rc522_picc_uid_to_str(&picc->uid, card_number, sizeof(card_number));
         
-        ESP_LOGI("RC522", "%s", event.rfid.cardNumber);
+        ESP_LOGI("RC522", "%s", card_number);
         
-        if(!rfid_check_check_card_format(event.rfid.cardNumber, sizeof(event.rfid.cardNumber))) {
-            event.event_type = EV_SCAN_FAILED;
+        // Runs on the esp_event loop, posting never blocks it
+        if(rfid_check_check_card_format(card_number, sizeof(card_number))) {
+            event_bus_post_card(bus, card_number);
+        } else {
+            pluto_event_handle_t failed = {
+                .event_type = EV_SCAN_FAILED
+            };
+            event_bus_post(bus, &failed);
         }
-
-        xQueueSend(queue, &event, portMAX_DELAY);
     }
     else if (picc->state == RC522_PICC_STATE_IDLE && event->old_state >= RC522_PICC_STATE_ACTIVE) {
         ESP_LOGI(TAG, "Card has been removed");
@@ -62,11 +65,11 @@ static void on_picc_state_changed(void *arg, esp_event_base_t base, int32_t even
  * Configures and installs the driver, creates the SPI communication between devices,
  * creates and registers a task to react on state changes on the PICC.
  * @param rc522_handle_t double pointer to the datastructure of rc522. If successful will point to the datastructure.
- * @param QueueHandle_t pointer to the queue for events.
+ * @param event_bus_handle_t bus to post card events to.
  * 
  * @return 0 for success or 1 for failed.
  */
-uint8_t rc522_init(rc522_handle_t *out, QueueHandle_t owner_queue)
+uint8_t rc522_init(rc522_handle_t *out, event_bus_handle_t owner_bus)
 {
     if(!out) return 1;
 
@@ -102,8 +105,8 @@ uint8_t rc522_init(rc522_handle_t *out, QueueHandle_t owner_queue)
         *out = scanner;
     }
 
-    if(!queue && owner_queue != NULL) {
-        queue = owner_queue;
+    if(!bus && owner_bus != NULL) {
+        bus = owner_bus;
     }
     
     return 0;
@@ -114,8 +117,8 @@ uint8_t rc522_deinit(rc522_handle_t handle) {
         rc522_destroy(handle);
     }
     
-    if(queue != NULL) {
-        queue = NULL;
+    if(bus != NULL) {
+        bus = NULL;
     }
     
     return 0;
@@ -1,35 +1,253 @@
 #include "request_formater.h"
+#include "security_measures.h"
 
 #include <string.h>
 
-#include "freeRTOS/FreeRTOS.h"
-#include "freertos/task.h"
 #include "esp_log.h"
-#include "esp_mac.h"
 #include "mbedtls/sha256.h"
 
 const char *SHA_TAG = "SHA256";
 
-uint8_t create_request_body(const char* keys[], const char* values[], uint8_t key_value_len,  char* out, size_t out_len) {
-    memset(out, 0, out_len);
+void body_writer_init(body_writer_t *writer, char *out, size_t out_len) {
+    writer->out = out;
+    writer->out_len = out_len;
+    writer->len = 0;
+    writer->overflow = false;
 
-    snprintf(out, out_len, "{");
+    mbedtls_sha256_init(&writer->sha);
+    mbedtls_sha256_starts(&writer->sha, 0);
+}
+
+void body_writer_append(body_writer_t *writer, const char *data, size_t len) {
+    // Keep room for the terminator
+    if (writer->overflow || writer->len + len >= writer->out_len) {
+        writer->overflow = true;
+        return;
+    }
+
+    memcpy(writer->out + writer->len, data, len);
+    writer->len += len;
+
+    mbedtls_sha256_update(&writer->sha, (const unsigned char*)data, len);
+}
+
+esp_err_t body_writer_finish(body_writer_t *writer, char hashed_body[SHA256_OUT_SIZE]) {
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    esp_err_t ret = ESP_OK;
+
+    if (writer->out_len > 0) {
+        writer->out[writer->overflow ? 0 : writer->len] = '\0';
+    }
+
+    if (writer->overflow) {
+        ESP_LOGE(SHA_TAG, "Request body does not fit %d bytes", (int)writer->out_len);
+        ret = ESP_ERR_INVALID_SIZE;
+    } else if (mbedtls_sha256_finish(&writer->sha, digest) != 0) {
+        ESP_LOGE(SHA_TAG, "SHA256 calculation failed");
+        ret = ESP_FAIL;
+    } else {
+        sec_to_hex(digest, SHA256_DIGEST_SIZE, hashed_body);
+    }
+
+    mbedtls_sha256_free(&writer->sha);
+    return ret;
+}
+
+void body_writer_discard(body_writer_t *writer) {
+    if (writer->out_len > 0) {
+        writer->out[0] = '\0';
+    }
+
+    writer->len = 0;
+    mbedtls_sha256_free(&writer->sha);
+}
+
+static void json_append_escaped(body_writer_t *body, const char *value) {
+    static const char hex_chars[] = "0123456789abcdef";
+    const char *run = value;
+
+    body_writer_append(body, "\"", 1);
 
-    for(size_t i = 0; i < key_value_len; i++) {
-        strncat(out, "\"", out_len - strlen(out) - 1);
-        strncat(out, keys[i], out_len - strlen(out) - 1);
-        strncat(out, "\":\"", out_len - strlen(out) - 1);
-        strncat(out, values[i], out_len - strlen(out) - 1);
-        strncat(out, "\"", out_len - strlen(out) - 1);
-        if(i < key_value_len - 1) {
-            strncat(out, ",", out_len - strlen(out) - 1);
+    // Copy runs of plain characters in one go, only characters that need escaping are written one by one
+    for (; *value != '\0'; value++) {
+        unsigned char c = (unsigned char)*value;
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+        body_writer_append(body, run, value - run);
+        run = value + 1;
+
+        switch (c) {
+            case '"':  body_writer_append(body, "\\\"", 2); break;
+            case '\\': body_writer_append(body, "\\\\", 2); break;
+            case '\n': body_writer_append(body, "\\n", 2); break;
+            case '\r': body_writer_append(body, "\\r", 2); break;
+            case '\t': body_writer_append(body, "\\t", 2); break;
+            default: {
+                char escaped[6] = {'\\', 'u', '0', '0', hex_chars[c >> 4], hex_chars[c & 0x0f]};
+                body_writer_append(body, escaped, sizeof(escaped));
+                break;
+            }
         }
     }
 
-    strncat(out, "}", out_len - strlen(out) - 1);
+    body_writer_append(body, run, value - run);
+    body_writer_append(body, "\"", 1);
+}
+
+// Writes the decimal digits of value, with a '.' before the last decimals digits if decimals > 0
+static void json_append_number(body_writer_t *body, int64_t value, uint8_t decimals) {
+    char digits[24];
+    size_t pos = sizeof(digits);
+    bool negative = value < 0;
+    uint64_t magnitude = negative ? (uint64_t)(-(value + 1)) + 1 : (uint64_t)value;
+    uint8_t written = 0;
+
+    do {
+        if (decimals > 0 && written == decimals) {
+            digits[--pos] = '.';
+        }
+        digits[--pos] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+        written++;
+    } while (magnitude > 0 || written <= decimals);
+
+    if (negative) digits[--pos] = '-';
+
+    body_writer_append(body, digits + pos, sizeof(digits) - pos);
+}
+
+void json_writer_begin(json_writer_t *json, char *out, size_t out_len) {
+    body_writer_init(&json->body, out, out_len);
+    json->first_field = true;
 
-    return 0;
+    body_writer_append(&json->body, "{", 1);
 }
 
-// create headers
-// get date
\ No newline at end of file
+void json_write_key_literal(json_writer_t *json, const char *rendered_key, size_t len) {
+    if (!json->first_field) {
+        body_writer_append(&json->body, ",", 1);
+    }
+    json->first_field = false;
+
+    body_writer_append(&json->body, rendered_key, len);
+}
+
+void json_value_string(json_writer_t *json, const char *value) {
+    json_append_escaped(&json->body, value);
+}
+
+void json_value_int(json_writer_t *json, int64_t value) {
+    json_append_number(&json->body, value, 0);
+}
+
+void json_value_minor_units(json_writer_t *json, int64_t minor_units, uint8_t decimals) {
+    body_writer_append(&json->body, "\"", 1);
+    json_append_number(&json->body, minor_units, decimals);
+    body_writer_append(&json->body, "\"", 1);
+}
+
+void json_value_hex(json_writer_t *json, const uint8_t *bytes, size_t len) {
+    static const char hex_chars[] = "0123456789abcdef";
+    // A digest fits in one append, every append is also a hash update
+    char hex[SHA256_DIGEST_SIZE * 2];
+    size_t hex_len = 0;
+
+    body_writer_append(&json->body, "\"", 1);
+
+    for (size_t i = 0; i < len; i++) {
+        hex[hex_len++] = hex_chars[bytes[i] >> 4];
+        hex[hex_len++] = hex_chars[bytes[i] & 0x0f];
+
+        if (hex_len == sizeof(hex)) {
+            body_writer_append(&json->body, hex, hex_len);
+            hex_len = 0;
+        }
+    }
+
+    body_writer_append(&json->body, hex, hex_len);
+    body_writer_append(&json->body, "\"", 1);
+}
+
+esp_err_t json_writer_end(json_writer_t *json, char hashed_body[SHA256_OUT_SIZE]) {
+    body_writer_append(&json->body, "}", 1);
+
+    return body_writer_finish(&json->body, hashed_body);
+}
+
+#define CBOR_MAJOR_UINT     0
+#define CBOR_MAJOR_NEGATIVE 1
+#define CBOR_MAJOR_BYTES    2
+#define CBOR_MAJOR_TEXT     3
+#define CBOR_MAJOR_MAP      5
+#define CBOR_MAJOR_TAG      6
+
+// Major type and argument, in the shortest form the argument fits
+static void cbor_write_head(cbor_writer_t *cbor, uint8_t major, uint64_t argument) {
+    uint8_t head[9];
+    uint8_t extra;
+
+    if (argument < 24) {
+        head[0] = (uint8_t)((major << 5) | argument);
+        extra = 0;
+    } else if (argument <= UINT8_MAX) {
+        head[0] = (uint8_t)((major << 5) | 24);
+        extra = 1;
+    } else if (argument <= UINT16_MAX) {
+        head[0] = (uint8_t)((major << 5) | 25);
+        extra = 2;
+    } else if (argument <= UINT32_MAX) {
+        head[0] = (uint8_t)((major << 5) | 26);
+        extra = 4;
+    } else {
+        head[0] = (uint8_t)((major << 5) | 27);
+        extra = 8;
+    }
+
+    // Network byte order
+    for (uint8_t i = 0; i < extra; i++) {
+        head[extra - i] = (uint8_t)(argument >> (i * 8));
+    }
+
+    body_writer_append(&cbor->body, (const char*)head, 1 + extra);
+}
+
+void cbor_writer_begin(cbor_writer_t *cbor, char *out, size_t out_len) {
+    body_writer_init(&cbor->body, out, out_len);
+}
+
+void cbor_write_map(cbor_writer_t *cbor, size_t entries) {
+    cbor_write_head(cbor, CBOR_MAJOR_MAP, entries);
+}
+
+void cbor_write_uint(cbor_writer_t *cbor, uint64_t value) {
+    cbor_write_head(cbor, CBOR_MAJOR_UINT, value);
+}
+
+void cbor_write_int(cbor_writer_t *cbor, int64_t value) {
+    if (value < 0) {
+        // Negative integers are encoded as -1 - value
+        cbor_write_head(cbor, CBOR_MAJOR_NEGATIVE, (uint64_t)(-(value + 1)));
+    } else {
+        cbor_write_head(cbor, CBOR_MAJOR_UINT, (uint64_t)value);
+    }
+}
+
+void cbor_write_text(cbor_writer_t *cbor, const char *value) {
+    size_t len = strlen(value);
+
+    cbor_write_head(cbor, CBOR_MAJOR_TEXT, len);
+    body_writer_append(&cbor->body, value, len);
+}
+
+void cbor_write_bytes(cbor_writer_t *cbor, const uint8_t *bytes, size_t len) {
+    cbor_write_head(cbor, CBOR_MAJOR_BYTES, len);
+    body_writer_append(&cbor->body, (const char*)bytes, len);
+}
+
+void cbor_write_tag(cbor_writer_t *cbor, uint64_t tag) {
+    cbor_write_head(cbor, CBOR_MAJOR_TAG, tag);
+}
+
+esp_err_t cbor_writer_end(cbor_writer_t *cbor, char hashed_body[SHA256_OUT_SIZE]) {
+    return body_writer_finish(&cbor->body, hashed_body);
+}
@@ -1,59 +1,169 @@
 #include "security_measures.h"
 
 #include "esp_random.h"
-#include "freeRTOS/FreeRTOS.h"
-#include "freertos/task.h"
 #include "esp_log.h"
-#include "esp_mac.h"
 #include "mbedtls/sha256.h"
+#include "mbedtls/md.h"
 #include "credentials.h"
+#include "pluto_payment.h"
 
 #include <string.h>
+#include <stdbool.h>
 
 const char *HASH_TAG = "SHA256";
 
-void sec_generate_nonce(char *out_buf, size_t buf_len) {
-    uint32_t random_number = esp_random();
-    char temp_buf[11];
-    snprintf(temp_buf, sizeof(temp_buf), "%lu", (unsigned long)random_number);
-    hash_sha256((const unsigned char*)temp_buf, sizeof(temp_buf), out_buf);
+// Everything in the canonical string except the body hash is known at compile time. The body hash
+// is taken over the bytes sent, so a CBOR body is signed as CBOR.
+#define SEC_CANONICAL_PREFIX "POST\n" PLUTO_URL PLUTO_PAYMENT_API "\nContent-Type: " PLUTO_PAYMENT_CONTENT_TYPE "\n"
+
+/**
+ * prefix_context holds the inner hash after the key ipad block and the canonical prefix.
+ * sign_context is keyed the same way so its opad is ready, and gets the prefix state cloned in per payment.
+ */
+static mbedtls_md_context_t prefix_context;
+static mbedtls_md_context_t sign_context;
+static bool signer_inited = false;
+
+void sec_to_hex(const unsigned char *digest, size_t digest_len, char *hex_output_buffer) {
+    static const char hex_chars[] = "0123456789abcdef";
+
+    for (size_t i = 0; i < digest_len; i++) {
+        hex_output_buffer[i * 2] = hex_chars[digest[i] >> 4];
+        hex_output_buffer[i * 2 + 1] = hex_chars[digest[i] & 0x0f];
+    }
+
+    hex_output_buffer[digest_len * 2] = '\0';
 }
 
-void build_canonical_string(const char *hashed_body, char *out_buf, size_t out_buf_size) {
-    strncat(out_buf, "POST\n", out_buf_size);
-    strncat(out_buf, PLUTO_URL, out_buf_size - strlen(out_buf));
-    strncat(out_buf, PLUTO_PAYMENT_API, out_buf_size - strlen(out_buf));
-    strncat(out_buf, "\nContent-Type: application/json\n", out_buf_size - strlen(out_buf));
-    strncat(out_buf, hashed_body, out_buf_size - strlen(out_buf));
+void sec_generate_nonce(uint8_t out[SHA256_DIGEST_SIZE]) {
+    esp_fill_random(out, SHA256_DIGEST_SIZE);
 }
 
-esp_err_t hash_sha256(const unsigned char *input_buffer, size_t input_buffer_len, char hex_output_buffer[SHA256_OUT_BUF_SIZE]) {
-    if(!input_buffer || !hex_output_buffer) {
+static esp_err_t sec_signer_setup(const unsigned char *key, size_t key_len, const unsigned char *prefix, size_t prefix_len) {
+    const mbedtls_md_info_t *md_info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+
+    mbedtls_md_init(&prefix_context);
+    mbedtls_md_init(&sign_context);
+
+    if (mbedtls_md_setup(&prefix_context, md_info, 1) != 0 ||
+        mbedtls_md_setup(&sign_context, md_info, 1) != 0 ||
+        mbedtls_md_hmac_starts(&prefix_context, key, key_len) != 0 ||
+        mbedtls_md_hmac_starts(&sign_context, key, key_len) != 0 ||
+        mbedtls_md_hmac_update(&prefix_context, prefix, prefix_len) != 0)
+        {
+        ESP_LOGE(HASH_TAG, "HMAC key setup failed");
+        mbedtls_md_free(&prefix_context);
+        mbedtls_md_free(&sign_context);
+        return ESP_FAIL;
+    }
+
+    signer_inited = true;
+    return ESP_OK;
+}
+
+static void sec_signer_free() {
+    if (signer_inited) {
+        mbedtls_md_free(&prefix_context);
+        mbedtls_md_free(&sign_context);
+        signer_inited = false;
+    }
+}
+
+// RFC 4231 test case 2, split so the midstate path is the one being checked
+static esp_err_t sec_signer_self_test() {
+    static const char key[] = "Jefe";
+    static const char prefix[] = "what do ya ";
+    static const char data[] = "want for nothing?";
+    static const char expected[] = "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843";
+    char out[SHA256_OUT_BUF_SIZE];
+
+    if (sec_signer_setup((const unsigned char*)key, strlen(key), (const unsigned char*)prefix, strlen(prefix)) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    esp_err_t ret = sec_sign_request(data, out);
+    sec_signer_free();
+
+    if (ret != ESP_OK || strcmp(out, expected) != 0) {
+        ESP_LOGE(HASH_TAG, "HMAC-SHA256 known answer test failed");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t sec_signer_init() {
+    if (signer_inited) {
+        ESP_LOGE(HASH_TAG, "Signer already inited");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (sec_signer_self_test() != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    static const char device_key[] = DEVICE_KEY;
+    static const char prefix[] = SEC_CANONICAL_PREFIX;
+
+    return sec_signer_setup((const unsigned char*)device_key, sizeof(device_key) - 1,
+                            (const unsigned char*)prefix, sizeof(prefix) - 1);
+}
+
+esp_err_t sec_sign_request(const char *hashed_body, char hex_output_buffer[SHA256_OUT_BUF_SIZE]) {
+    if (!signer_inited || !hashed_body || !hex_output_buffer) {
+        ESP_LOGE(HASH_TAG, "Signer not inited or invalid argument");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    unsigned char mac[SHA256_DIGEST_SIZE];
+
+    if (mbedtls_md_clone(&sign_context, &prefix_context) != 0 ||
+        mbedtls_md_hmac_update(&sign_context, (const unsigned char*)hashed_body, strlen(hashed_body)) != 0 ||
+        mbedtls_md_hmac_finish(&sign_context, mac) != 0)
+        {
+        ESP_LOGE(HASH_TAG, "HMAC calculation failed");
+        return ESP_FAIL;
+    }
+
+    sec_to_hex(mac, sizeof(mac), hex_output_buffer);
+
+    return ESP_OK;
+}
+
+esp_err_t hash_sha256_digest(const unsigned char *input_buffer, size_t input_buffer_len, uint8_t digest[SHA256_DIGEST_SIZE]) {
+    if(!input_buffer || !digest) {
         ESP_LOGE(HASH_TAG, "Invalid argument - Input or output buffer NULL");
         return ESP_ERR_INVALID_ARG;
     }
-    
-    unsigned char hash_digest[SHA256_DIGEST_SIZE];
+
     mbedtls_sha256_context context;
     mbedtls_sha256_init(&context);
     esp_err_t ret = ESP_OK;
 
     if (mbedtls_sha256_starts(&context, 0) != 0 ||
         mbedtls_sha256_update(&context, input_buffer, input_buffer_len) != 0 ||
-        mbedtls_sha256_finish(&context, hash_digest) != 0)
+        mbedtls_sha256_finish(&context, digest) != 0)
         {
         ESP_LOGE(HASH_TAG, "SHA256 calculation failed");
         ret = ESP_FAIL;
-        goto exit;
     }
-    
-    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
-        sprintf(hex_output_buffer + (i * 2), "%02x", hash_digest[i]);
+
+    mbedtls_sha256_free(&context);
+    return ret;
+}
+
+esp_err_t hash_sha256(const unsigned char *input_buffer, size_t input_buffer_len, char hex_output_buffer[SHA256_OUT_BUF_SIZE]) {
+    if(!input_buffer || !hex_output_buffer) {
+        ESP_LOGE(HASH_TAG, "Invalid argument - Input or output buffer NULL");
+        return ESP_ERR_INVALID_ARG;
     }
+    
+    unsigned char hash_digest[SHA256_DIGEST_SIZE];
+    esp_err_t ret = hash_sha256_digest(input_buffer, input_buffer_len, hash_digest);
 
-    hex_output_buffer[SHA256_DIGEST_SIZE * 2] = '\0';
+    if (ret == ESP_OK) {
+        sec_to_hex(hash_digest, SHA256_DIGEST_SIZE, hex_output_buffer);
+    }
 
-    exit:
-        mbedtls_sha256_free(&context);
-        return ret;
+    return ret;
 }
\ No newline at end of file
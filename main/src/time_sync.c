@@ -3,17 +3,22 @@
 */
 
 #include "time_sync.h"
+#include "clock_discipline.h"
 #include "error_checks.h"
 
 #include <sys/time.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
 #include "esp_sntp.h"
 #include "esp_netif_sntp.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs.h"
 
-#define SERVER_TIMEOUT_WAIT_MS  20000
 #define TIME_STORAGE_NAMESPACE  "Storage"
 #define TIME_STORAGE_NAME       "timespace"
 
@@ -21,74 +26,94 @@
 static bool time_inited = false;
 const char* TIME_TAG = "TIME";
 
+// Local date and hour of the last formatted timestamp, "YYYY-MM-DDTHH:"
+#define TIME_PREFIX_LEN 14
+
+typedef struct {
+    int64_t hour;
+    char prefix[TIME_PREFIX_LEN + 1];
+} time_prefix_cache_t;
+
+static portMUX_TYPE prefix_lock = portMUX_INITIALIZER_UNLOCKED;
+static time_prefix_cache_t prefix_cache = {
+    .hour = -1
+};
+
 void time_set_timezone() {
     setenv("TZ", "CET-1CEST,M3.5.0/2,M10.5.0/3", 1);
     tzset();
 }
 
 void time_get_current_time(char *buf, size_t buf_size) {
-    time_t now = time(NULL);
-    struct tm local_time;
-    localtime_r(&now, &local_time);
-
-    strftime(buf, buf_size, "%Y-%m-%dT%H:%M:%S", &local_time);
+    time_format_timestamp(clock_now(), buf, buf_size);
     ESP_LOGI("TIME", "Local time: %s", buf);
 }
 
-esp_err_t time_sync_init() {
-    if (!time_inited) {
-        esp_sntp_config_t config = 
-        ESP_NETIF_SNTP_DEFAULT_CONFIG_MULTIPLE(2,
-        ESP_SNTP_SERVER_LIST("time.windows.com", "pool.ntp.org" ) );
-        ESP_RETURN_ON_ERROR(esp_netif_sntp_init(&config), TIME_TAG, "Failed to initialize sntp");
-        time_inited = true;
-        return ESP_OK;
-    } else {
-        ESP_LOGE(TIME_TAG, "SNTP already inited");
-        return ESP_ERR_INVALID_STATE;
+/*
+    Our timezone only ever moves by whole hours, so the local date and hour change exactly on
+    UTC hour boundaries. They are formatted once per hour, minutes and seconds are plain arithmetic.
+*/
+void time_format_timestamp(time_t timestamp, char *buf, size_t buf_size) {
+    if (buf_size <= TIME_PREFIX_LEN + 5) {
+        if (buf_size > 0) buf[0] = '\0';
+        return;
     }
-}
 
-esp_err_t time_sync_deinit() {
-    if (time_inited) {
-        esp_netif_sntp_deinit();
-        time_inited = false;
-        return ESP_OK;
+    int64_t hour = (int64_t)timestamp / 3600;
+    uint32_t in_hour = (uint32_t)((int64_t)timestamp - hour * 3600);
+    time_prefix_cache_t cache;
+
+    portENTER_CRITICAL(&prefix_lock);
+    cache = prefix_cache;
+    portEXIT_CRITICAL(&prefix_lock);
+
+    if (cache.hour != hour || timestamp < 0) {
+        struct tm local_time;
+        localtime_r(&timestamp, &local_time);
+        strftime(cache.prefix, sizeof(cache.prefix), "%Y-%m-%dT%H:", &local_time);
+        cache.hour = hour;
+
+        portENTER_CRITICAL(&prefix_lock);
+        prefix_cache = cache;
+        portEXIT_CRITICAL(&prefix_lock);
     }
 
-    return ESP_ERR_INVALID_STATE;
+    uint32_t minute = in_hour / 60;
+    uint32_t second = in_hour % 60;
+
+    memcpy(buf, cache.prefix, TIME_PREFIX_LEN);
+    buf[TIME_PREFIX_LEN] = '0' + minute / 10;
+    buf[TIME_PREFIX_LEN + 1] = '0' + minute % 10;
+    buf[TIME_PREFIX_LEN + 2] = ':';
+    buf[TIME_PREFIX_LEN + 3] = '0' + second / 10;
+    buf[TIME_PREFIX_LEN + 4] = '0' + second % 10;
+    buf[TIME_PREFIX_LEN + 5] = '\0';
 }
 
-esp_err_t time_update_from_sntp() {
-    uint8_t amount_tried = 0;
-    uint8_t max_tries = 10;
+esp_err_t time_parse_timestamp(const char *buf, time_t *out) {
+    struct tm local_time = {0};
 
-    esp_err_t err = ESP_FAIL;
+    if (sscanf(buf, "%4d-%2d-%2dT%2d:%2d:%2d", &local_time.tm_year, &local_time.tm_mon, &local_time.tm_mday,
+               &local_time.tm_hour, &local_time.tm_min, &local_time.tm_sec) != 6) {
+        return ESP_ERR_INVALID_ARG;
+    }
 
-    while(amount_tried <= max_tries) {
-        err = esp_netif_sntp_sync_wait(pdMS_TO_TICKS(SERVER_TIMEOUT_WAIT_MS));
+    local_time.tm_year -= 1900;
+    local_time.tm_mon -= 1;
+    // Let mktime work out daylight saving from the timezone
+    local_time.tm_isdst = -1;
 
-        if (err != ESP_OK) {
-            amount_tried++;
-            ESP_LOGE(TIME_TAG, "Unable to update time on try %d within %d seconds", amount_tried, (int)(SERVER_TIMEOUT_WAIT_MS / 1000));
-            continue;
-        }
-        break;
-    }
+    time_t timestamp = mktime(&local_time);
+    if (timestamp == (time_t)-1) return ESP_ERR_INVALID_ARG;
 
-    return err;
+    *out = timestamp;
+    return ESP_OK;
 }
 
-esp_err_t time_update_and_store_in_nvs(void *args) {
+static void time_store_in_nvs(time_t now) {
     nvs_handle_t nvs_handle = 0;
     esp_err_t err = ESP_FAIL;
 
-    time_sync_init();
-    if ((err = time_update_from_sntp()) != ESP_OK) goto exit;
-
-    time_t now;
-    time(&now);
-
     if ((err = nvs_open(TIME_STORAGE_NAMESPACE, NVS_READWRITE, &nvs_handle)) != ESP_OK) goto exit;
     if ((err = nvs_set_i64(nvs_handle, TIME_STORAGE_NAME, now)) != ESP_OK) goto exit;
     if ((err = nvs_commit(nvs_handle)) != ESP_OK) goto exit;
@@ -98,41 +123,96 @@ exit:
         nvs_close(nvs_handle);
     }
 
-    time_sync_deinit();
-
     if (err != ESP_OK) {
         ESP_LOGE(TIME_TAG, "Error updating time in NVS");
-    } else {
-        ESP_LOGI(TIME_TAG, "Updated time in NVS");
     }
+}
 
-    return err;
+// Called by lwIP after the clock was set from a server
+static void time_sync_notification(struct timeval *tv) {
+    clock_discipline_set((int64_t)tv->tv_sec * 1000000 + tv->tv_usec, esp_timer_get_time(), CLOCK_SOURCE_SNTP);
+    time_store_in_nvs(tv->tv_sec);
 }
 
-esp_err_t time_updated_from_nvs() {
+esp_err_t time_seed_from_nvs() {
     nvs_handle_t nvs_handle = 0;
     esp_err_t err = ESP_FAIL;
+    int64_t timestamp = 0;
 
-    if ((err = nvs_open(TIME_STORAGE_NAMESPACE, NVS_READWRITE, &nvs_handle)) != ESP_OK) {
-        ESP_LOGE(TIME_TAG, "Unable to open NVS");
-        goto exit;
-    }
+    if ((err = nvs_open(TIME_STORAGE_NAMESPACE, NVS_READONLY, &nvs_handle)) != ESP_OK) goto exit;
+    if ((err = nvs_get_i64(nvs_handle, TIME_STORAGE_NAME, &timestamp)) != ESP_OK) goto exit;
 
-    int64_t timestamp = 0;
+    // The clock survives a software restart, never move it back
+    if (time(NULL) < timestamp) {
+        struct timeval stored_time = {
+            .tv_sec = timestamp
+        };
+        settimeofday(&stored_time, NULL);
+    }
 
-    err = nvs_get_i64(nvs_handle, TIME_STORAGE_NAME, &timestamp);
-    if (err == ESP_ERR_NVS_NOT_FOUND) {
-        err = time_update_and_store_in_nvs(NULL);
-    } else if (err == ESP_OK) {
-        struct timeval get_nvs_time;
-        get_nvs_time.tv_sec = timestamp;
-        settimeofday(&get_nvs_time, NULL);
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    if (clock_discipline_source() == CLOCK_SOURCE_NONE) {
+        clock_discipline_set((int64_t)now.tv_sec * 1000000 + now.tv_usec, esp_timer_get_time(), CLOCK_SOURCE_STORED);
     }
 
+    ESP_LOGI(TIME_TAG, "Clock seeded from NVS, waiting for SNTP");
+
 exit:
     if (nvs_handle != 0) {
         nvs_close(nvs_handle);
     }
 
-    return err;
-}
\ No newline at end of file
+    return err == ESP_ERR_NVS_NOT_FOUND ? ESP_ERR_NOT_FOUND : err;
+}
+
+esp_err_t time_sync_start() {
+    if (time_inited) {
+        ESP_LOGE(TIME_TAG, "SNTP already inited");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_sntp_config_t config = 
+    ESP_NETIF_SNTP_DEFAULT_CONFIG_MULTIPLE(2,
+    ESP_SNTP_SERVER_LIST("time.windows.com", "pool.ntp.org" ) );
+
+    // Nothing waits for the sync, lwIP keeps retrying and calls back when it succeeds
+    config.wait_for_sync = false;
+    config.sync_cb = time_sync_notification;
+
+    ESP_RETURN_ON_ERROR(esp_netif_sntp_init(&config), TIME_TAG, "Failed to initialize sntp");
+    esp_sntp_set_sync_interval(TIME_SYNC_INTERVAL_MS);
+
+    time_inited = true;
+    return ESP_OK;
+}
+
+esp_err_t time_sync_stop() {
+    if (time_inited) {
+        esp_netif_sntp_deinit();
+        time_inited = false;
+        return ESP_OK;
+    }
+
+    return ESP_ERR_INVALID_STATE;
+}
+
+time_quality_t time_get_quality() {
+    switch (clock_discipline_source()) {
+        case CLOCK_SOURCE_SNTP:
+        case CLOCK_SOURCE_HTTP_DATE:
+            return TIME_QUALITY_SYNCED;
+        case CLOCK_SOURCE_STORED:
+            return TIME_QUALITY_STORED;
+        default:
+            return TIME_QUALITY_NONE;
+    }
+}
+
+const char *time_quality_name(time_quality_t quality) {
+    switch (quality) {
+        case TIME_QUALITY_SYNCED: return "synced";
+        case TIME_QUALITY_STORED: return "stored";
+        default:                  return "none";
+    }
+}
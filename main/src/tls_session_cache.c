@@ -0,0 +1,57 @@
+/*
+    Session resumption lets the server skip the certificate exchange, so the client signature and
+    chain verification are only paid on the first handshake. The session is only kept in RAM
+    through esp-tls' public API: it holds the master secret, and the session struct is private to
+    esp-tls, so it can neither be serialized here nor written to flash safely. A reboot costs one
+    full handshake, every reconnect after that is resumed.
+*/
+
+#include "tls_session_cache.h"
+
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+
+static const char *SESSION_TAG = "TLS_SESSION";
+
+static esp_tls_client_session_t *cached_session = NULL;
+
+esp_tls_client_session_t *tls_session_cache_get() {
+    return cached_session;
+}
+
+esp_err_t tls_session_cache_store(esp_tls_t *tls) {
+    esp_tls_client_session_t *session = esp_tls_get_client_session(tls);
+    if (session == NULL) {
+        ESP_LOGW(SESSION_TAG, "Server did not provide a resumable session");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    tls_session_cache_clear();
+    cached_session = session;
+
+    return ESP_OK;
+}
+
+void tls_session_cache_clear() {
+    if (cached_session != NULL) {
+        esp_tls_free_client_session(cached_session);
+        cached_session = NULL;
+    }
+}
+
+#else
+
+esp_tls_client_session_t *tls_session_cache_get() {
+    return NULL;
+}
+
+esp_err_t tls_session_cache_store(esp_tls_t *tls) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void tls_session_cache_clear() {
+}
+
+#endif
@@ -0,0 +1,197 @@
+/*
+    Stage timestamps go into a ring shared by every task. Producers claim a slot with one atomic add
+    and publish it through its sequence number, so marking never blocks or takes a lock.
+    The ring is only read when a transaction ends, by the task that began it, which is also the only
+    one touching the histograms.
+*/
+
+#include "txn_trace.h"
+
+#include <stdatomic.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TRACE_TAG = "TXN_TRACE";
+
+_Static_assert((TXN_TRACE_RING_SIZE & (TXN_TRACE_RING_SIZE - 1)) == 0, "Ring size must be a power of two");
+
+typedef struct {
+    atomic_uint_least32_t sequence;     // index + 1 once the slot is written
+    uint32_t txn;
+    txn_stage_t stage;
+    int64_t timestamp_us;
+} txn_trace_entry_t;
+
+const uint32_t txn_trace_bucket_limits_ms[TXN_TRACE_BUCKET_COUNT - 1] = {
+    1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 30000
+};
+
+#define TXN_STAGE_FROM(name, from, also_from, label)       [TXN_STAGE_##name] = TXN_STAGE_##from,
+#define TXN_STAGE_ALSO_FROM(name, from, also_from, label)  [TXN_STAGE_##name] = TXN_STAGE_##also_from,
+#define TXN_STAGE_LABEL(name, from, also_from, label)      [TXN_STAGE_##name] = label,
+
+static const txn_stage_t txn_stage_from[TXN_STAGE_COUNT] = {
+    TXN_STAGE_TABLE(TXN_STAGE_FROM)
+};
+
+static const txn_stage_t txn_stage_also_from[TXN_STAGE_COUNT] = {
+    TXN_STAGE_TABLE(TXN_STAGE_ALSO_FROM)
+};
+
+static const char *txn_stage_label[TXN_STAGE_COUNT] = {
+    TXN_STAGE_TABLE(TXN_STAGE_LABEL)
+};
+
+static txn_trace_entry_t ring[TXN_TRACE_RING_SIZE];
+static atomic_uint_least32_t ring_head = 0;
+static uint32_t ring_tail = 0;
+
+static atomic_uint_least32_t current_txn = 0;
+static uint32_t next_txn = 1;
+
+// The extra histogram is the total, from pin confirmed to body complete
+static txn_histogram_t histograms[TXN_STAGE_COUNT + 1];
+
+static void txn_histogram_add(txn_histogram_t *histogram, int64_t latency_us) {
+    if (latency_us < 0) latency_us = 0;
+
+    uint32_t latency_ms = (uint32_t)(latency_us / 1000);
+    uint8_t bucket = 0;
+
+    while (bucket < TXN_TRACE_BUCKET_COUNT - 1 && latency_ms >= txn_trace_bucket_limits_ms[bucket]) bucket++;
+
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->total_us += (uint64_t)latency_us;
+    if (latency_us > histogram->max_us) histogram->max_us = latency_us > UINT32_MAX ? UINT32_MAX : (uint32_t)latency_us;
+}
+
+void txn_trace_mark_at(txn_stage_t stage, int64_t timestamp_us) {
+    uint32_t txn = atomic_load_explicit(&current_txn, memory_order_relaxed);
+    if (txn == 0 || stage >= TXN_STAGE_COUNT) return;
+
+    uint32_t index = atomic_fetch_add_explicit(&ring_head, 1, memory_order_relaxed);
+    txn_trace_entry_t *entry = &ring[index & (TXN_TRACE_RING_SIZE - 1)];
+
+    // Hide the slot from the reader while it is rewritten
+    atomic_store_explicit(&entry->sequence, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    entry->txn = txn;
+    entry->stage = stage;
+    entry->timestamp_us = timestamp_us;
+
+    atomic_store_explicit(&entry->sequence, index + 1, memory_order_release);
+}
+
+void txn_trace_mark(txn_stage_t stage) {
+    txn_trace_mark_at(stage, esp_timer_get_time());
+}
+
+// Reads every published entry of txn, entries of other transactions are dropped
+static void txn_trace_collect(uint32_t txn, int64_t stamps[TXN_STAGE_COUNT]) {
+    uint32_t head = atomic_load_explicit(&ring_head, memory_order_acquire);
+
+    // Entries older than one ring length have been overwritten
+    if (head - ring_tail > TXN_TRACE_RING_SIZE) {
+        ESP_LOGW(TRACE_TAG, "Ring overrun, %lu marks lost", (unsigned long)(head - ring_tail - TXN_TRACE_RING_SIZE));
+        ring_tail = head - TXN_TRACE_RING_SIZE;
+    }
+
+    for (; ring_tail != head; ring_tail++) {
+        txn_trace_entry_t *entry = &ring[ring_tail & (TXN_TRACE_RING_SIZE - 1)];
+
+        if (atomic_load_explicit(&entry->sequence, memory_order_acquire) != ring_tail + 1) continue;
+
+        txn_trace_entry_t copy = {
+            .txn = entry->txn,
+            .stage = entry->stage,
+            .timestamp_us = entry->timestamp_us
+        };
+
+        // Overwritten while it was copied
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&entry->sequence, memory_order_relaxed) != ring_tail + 1) continue;
+
+        if (copy.txn == txn) stamps[copy.stage] = copy.timestamp_us;
+    }
+}
+
+void txn_trace_end() {
+    uint32_t txn = atomic_exchange_explicit(&current_txn, 0, memory_order_acq_rel);
+    if (txn == 0) return;
+
+    int64_t stamps[TXN_STAGE_COUNT] = {0};
+    txn_trace_collect(txn, stamps);
+
+    // Only stages where both ends were reached are counted, the later from stage is the start
+    for (uint8_t stage = 0; stage < TXN_STAGE_COUNT; stage++) {
+        txn_stage_t from = txn_stage_from[stage];
+        if (from == stage || stamps[stage] == 0) continue;
+
+        int64_t start_us = stamps[from];
+        if (stamps[txn_stage_also_from[stage]] > start_us) start_us = stamps[txn_stage_also_from[stage]];
+        if (start_us == 0) continue;
+
+        txn_histogram_add(&histograms[stage], stamps[stage] - start_us);
+    }
+
+    if (stamps[TXN_STAGE_PIN_CONFIRMED] != 0 && stamps[TXN_STAGE_BODY_COMPLETE] != 0) {
+        txn_histogram_add(&histograms[TXN_STAGE_COUNT], stamps[TXN_STAGE_BODY_COMPLETE] - stamps[TXN_STAGE_PIN_CONFIRMED]);
+    }
+}
+
+void txn_trace_begin() {
+    txn_trace_end();
+
+    uint32_t txn = next_txn++;
+    if (next_txn == 0) next_txn = 1;
+
+    atomic_store_explicit(&current_txn, txn, memory_order_release);
+    txn_trace_mark(TXN_STAGE_STARTED);
+}
+
+esp_err_t txn_trace_get_histogram(txn_stage_t stage, txn_histogram_t *out) {
+    if (stage > TXN_STAGE_COUNT || out == NULL) return ESP_ERR_INVALID_ARG;
+
+    memcpy(out, &histograms[stage], sizeof(*out));
+    return ESP_OK;
+}
+
+uint32_t txn_trace_percentile_ms(const txn_histogram_t *histogram, uint8_t percentile) {
+    if (histogram->count == 0) return 0;
+
+    // Rank of the sample holding the percentile, rounded up
+    uint32_t rank = (uint32_t)(((uint64_t)histogram->count * percentile + 99) / 100);
+    uint32_t seen = 0;
+
+    for (uint8_t bucket = 0; bucket < TXN_TRACE_BUCKET_COUNT - 1; bucket++) {
+        seen += histogram->buckets[bucket];
+        if (seen >= rank) return txn_trace_bucket_limits_ms[bucket];
+    }
+
+    return histogram->max_us / 1000;
+}
+
+static void txn_trace_dump_one(const char *label, const txn_histogram_t *histogram) {
+    if (histogram->count == 0) return;
+
+    ESP_LOGI(TRACE_TAG, "%-12s n=%-4lu avg=%lu p50<%lu p95<%lu p99<%lu max=%lu ms", label,
+        (unsigned long)histogram->count,
+        (unsigned long)(histogram->total_us / histogram->count / 1000),
+        (unsigned long)txn_trace_percentile_ms(histogram, 50),
+        (unsigned long)txn_trace_percentile_ms(histogram, 95),
+        (unsigned long)txn_trace_percentile_ms(histogram, 99),
+        (unsigned long)(histogram->max_us / 1000));
+}
+
+void txn_trace_dump() {
+    ESP_LOGI(TRACE_TAG, "Stage latencies, each from the stage it is measured from");
+
+    for (uint8_t stage = 0; stage < TXN_STAGE_COUNT; stage++) {
+        txn_trace_dump_one(txn_stage_label[stage], &histograms[stage]);
+    }
+    txn_trace_dump_one("pin to body", &histograms[TXN_STAGE_COUNT]);
+}
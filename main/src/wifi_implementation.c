@@ -2,46 +2,137 @@
 #include "credentials.h"
 #include "error_checks.h"
 #include "pluto_events.h"
+#include "event_bus.h"
+#include "wifi_profile.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
-#include "freertos/queue.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_mac.h"
 #include "nvs_flash.h"
 #include "esp_netif.h"
+#include "esp_timer.h"
 
 static const char *WIFI_TAG = "WIFI";
 EventGroupHandle_t wifi_event_group;
 const int WIFI_CONNECTED_BIT = BIT0;
 static esp_netif_t *station_network_interface = NULL;
-static bool wifi_is_running = true;
+static event_bus_handle_t bus = NULL;
+static wifi_config_t wifi_config = {0};
+
+// FAST CONNECT STATE, ONLY TOUCHED BY THE EVENT HANDLER AFTER INIT
+static wifi_profile_t profile;
+static bool profile_valid = false;
+static bool using_profile = false;
+static uint8_t fast_failures = 0;
+static int64_t connect_start_us = 0;
+
+// TIME TO IP, INDEXED BY using_profile
+static uint32_t time_to_ip_count[2] = {0};
+static int64_t time_to_ip_total_us[2] = {0};
+
+static void wifi_use_profile(bool use) {
+    if (use) {
+        wifi_profile_apply(&profile, &wifi_config.sta);
+    } else {
+        wifi_profile_release(&wifi_config.sta);
+    }
+
+    using_profile = use;
+    fast_failures = 0;
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+}
+
+static void wifi_log_time_to_ip() {
+    int64_t elapsed_us = esp_timer_get_time() - connect_start_us;
+
+    time_to_ip_count[using_profile]++;
+    time_to_ip_total_us[using_profile] += elapsed_us;
+
+    ESP_LOGI(WIFI_TAG, "Time to IP: %d ms (%s). Average fast connect %d ms over %lu, full scan %d ms over %lu",
+        (int)(elapsed_us / 1000), using_profile ? "fast connect" : "full scan",
+        (int)(time_to_ip_count[1] ? time_to_ip_total_us[1] / time_to_ip_count[1] / 1000 : 0), (unsigned long)time_to_ip_count[1],
+        (int)(time_to_ip_count[0] ? time_to_ip_total_us[0] / time_to_ip_count[0] / 1000 : 0), (unsigned long)time_to_ip_count[0]);
+}
+
+static void wifi_post_state(bool is_connected) {
+    pluto_event_handle_t event = {
+        .event_type = EV_WIFI,
+        .timestamp_us = esp_timer_get_time(),
+        .wifi.isConnected = is_connected
+    };
+
+    // Runs on the esp_event loop, the connectivity channel keeps only the latest state
+    event_bus_post(bus, &event);
+}
 
 static void wifi_event_handler(void *arg, esp_event_base_t event_base,
     int32_t event_id, void *event_data)
 {
     if(event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
+        connect_start_us = esp_timer_get_time();
         esp_wifi_connect();
         ESP_LOGI(WIFI_TAG, "Connecting to WiFi...");
     }   
+    else if(event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t*) event_data;
+        ESP_LOGI(WIFI_TAG, "Associated, waiting for IP...");
+
+        // Saved once the connection proves itself by getting an IP
+        wifi_profile_from_event(WIFI_SSID, event, &profile);
+        profile_valid = true;
+    }
     else if(event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        esp_wifi_connect();
+        wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t*) event_data;
+
+        // Every failed reconnect ends up here again, only the first one is a state change
+        EventBits_t bits = xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT);
+        ESP_LOGW(WIFI_TAG, "WiFi disconnected (reason %d). Trying to reconnect...", (int)event->reason);
+
+        if (bits & WIFI_CONNECTED_BIT) {
+            wifi_post_state(false);
+            connect_start_us = esp_timer_get_time();
+
+            // Go straight back to the access point that was just lost
+            if (profile_valid && !using_profile) wifi_use_profile(true);
+            fast_failures = 0;
+        }
+        else if (using_profile && wifi_profile_should_fall_back(event->reason, ++fast_failures)) {
+            ESP_LOGW(WIFI_TAG, "Fast connect to " MACSTR " failed, falling back to full scan", MAC2STR(profile.bssid));
+            wifi_use_profile(false);
+        }
 
-        xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT);
-        ESP_LOGW(WIFI_TAG, "WiFi disconnected. Trying to reconnect...");
+        esp_wifi_connect();
     }
     else if(event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t *event = (ip_event_got_ip_t*) event_data;
         ESP_LOGI(WIFI_TAG, "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
+
+        // Set returns the bits after setting, the handler is the only writer so read them first
+        EventBits_t bits = xEventGroupGetBits(wifi_event_group);
         xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
+        if (!(bits & WIFI_CONNECTED_BIT)) {
+            wifi_log_time_to_ip();
+            fast_failures = 0;
+            if (profile_valid) wifi_profile_store(&profile);
+
+            wifi_post_state(true);
+        }
+    }
+    else if(event_base == IP_EVENT && event_id == IP_EVENT_STA_LOST_IP) {
+        ESP_LOGW(WIFI_TAG, "Lost IP");
+
+        EventBits_t bits = xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT);
+        if (bits & WIFI_CONNECTED_BIT) wifi_post_state(false);
     }
 }
 
-esp_err_t wifi_init(){
+esp_err_t wifi_init(event_bus_handle_t owner_bus){
     wifi_event_group = xEventGroupCreate();
+    bus = owner_bus;
 
     ESP_RETURN_ON_ERROR(esp_netif_init(), WIFI_TAG, "esp_netif_init failed");
     ESP_RETURN_ON_ERROR(esp_event_loop_create_default(), WIFI_TAG, "failed to create event loop");
@@ -53,14 +144,23 @@ esp_err_t wifi_init(){
     ESP_RETURN_ON_ERROR(esp_wifi_init(&config), WIFI_TAG, "failed to wifi init with config");
     ESP_RETURN_ON_ERROR(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL), WIFI_TAG, "failed to register wifi events");
     ESP_RETURN_ON_ERROR(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL), WIFI_TAG, "failed to register IP event");
+    ESP_RETURN_ON_ERROR(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_LOST_IP, &wifi_event_handler, NULL), WIFI_TAG, "failed to register IP event");
 
-    wifi_config_t wifi_config = {
+    wifi_config = (wifi_config_t){
         .sta = {
             .ssid = WIFI_SSID,
             .password = WIFI_PASS
         },
     };
 
+    // Start on the access point of the last good connection, the handler falls back if it is gone
+    if (wifi_profile_load(WIFI_SSID, &profile) == ESP_OK) {
+        ESP_LOGI(WIFI_TAG, "Fast connect to " MACSTR " on channel %d", MAC2STR(profile.bssid), (int)profile.channel);
+        wifi_profile_apply(&profile, &wifi_config.sta);
+        profile_valid = true;
+        using_profile = true;
+    }
+
     ESP_RETURN_ON_ERROR(esp_wifi_set_mode(WIFI_MODE_STA), WIFI_TAG, "Failed to set wifi mode");
     ESP_RETURN_ON_ERROR(esp_wifi_set_config(WIFI_IF_STA, &wifi_config), WIFI_TAG, "Failed to set config");
     ESP_RETURN_ON_ERROR(esp_wifi_start(), WIFI_TAG, "Failed to start wifi");
@@ -92,42 +192,6 @@ esp_err_t wifi_wait_for_connection(int wait_time_ms) {
 }
 
 esp_err_t wifi_destroy() {
-    wifi_is_running = false;
+    bus = NULL;
     return esp_wifi_deinit();
 }
-
-void wifi_check_status (void *args) {
-    QueueHandle_t queue = (QueueHandle_t)args;
-    bool queue_received = true;
-    
-    /**
-     * Used to keep track on status changes. We only want to add to queue if:
-     * wifi was connected && wifi has disconnected
-    */
-    bool was_connected = false;
-    bool is_connected = false;
-
-    if (queue == NULL) {
-        queue_received = false;
-        ESP_LOGE(WIFI_TAG, "Queue not received in wifi_check_status task");
-        abort();
-    }
-
-    while (wifi_is_running && queue_received) {
-        is_connected = wifi_is_connected();
-
-        if (is_connected != was_connected && !is_connected) {
-            pluto_event_handle_t event = {
-                .event_type = EV_WIFI,
-                .wifi.isConnected = is_connected
-            };
-
-            was_connected = is_connected;
-            xQueueSend(queue, &event, portMAX_DELAY);
-        }
-        
-        vTaskDelay(pdMS_TO_TICKS(5000));
-    }
-    
-    vTaskDelete(NULL);
-}
\ No newline at end of file
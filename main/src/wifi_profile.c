@@ -0,0 +1,115 @@
+/*
+    A directed connect skips the all-channel scan, which is most of the time from boot to
+    association. The profile is only a hint, any mismatch falls back to the normal scan.
+*/
+
+#include "wifi_profile.h"
+
+#include <string.h>
+#include <stdio.h>
+
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "nvs.h"
+
+// Stored in the same namespace as the time kept by time_sync.c
+#define WIFI_PROFILE_STORAGE_NAMESPACE  "Storage"
+#define WIFI_PROFILE_STORAGE_NAME       "wifi_profile"
+
+static const char *PROFILE_TAG = "WIFI_PROFILE";
+
+esp_err_t wifi_profile_load(const char *ssid, wifi_profile_t *out) {
+    nvs_handle_t nvs_handle = 0;
+    esp_err_t err = ESP_FAIL;
+    size_t len = sizeof(*out);
+
+    if ((err = nvs_open(WIFI_PROFILE_STORAGE_NAMESPACE, NVS_READONLY, &nvs_handle)) != ESP_OK) goto exit;
+    if ((err = nvs_get_blob(nvs_handle, WIFI_PROFILE_STORAGE_NAME, out, &len)) != ESP_OK) goto exit;
+
+    if (len != sizeof(*out) || out->version != WIFI_PROFILE_VERSION || strncmp(out->ssid, ssid, sizeof(out->ssid)) != 0) {
+        ESP_LOGW(PROFILE_TAG, "Stored profile does not match, using full scan");
+        err = ESP_ERR_NOT_FOUND;
+    }
+
+exit:
+    if (nvs_handle != 0) {
+        nvs_close(nvs_handle);
+    }
+
+    return err == ESP_ERR_NVS_NOT_FOUND ? ESP_ERR_NOT_FOUND : err;
+}
+
+esp_err_t wifi_profile_store(const wifi_profile_t *profile) {
+    nvs_handle_t nvs_handle = 0;
+    wifi_profile_t stored;
+    esp_err_t err = ESP_FAIL;
+
+    // Reconnects to the same access point are the common case, do not wear the flash for them
+    if (wifi_profile_load(profile->ssid, &stored) == ESP_OK && memcmp(&stored, profile, sizeof(stored)) == 0) {
+        return ESP_OK;
+    }
+
+    if ((err = nvs_open(WIFI_PROFILE_STORAGE_NAMESPACE, NVS_READWRITE, &nvs_handle)) != ESP_OK) goto exit;
+    if ((err = nvs_set_blob(nvs_handle, WIFI_PROFILE_STORAGE_NAME, profile, sizeof(*profile))) != ESP_OK) goto exit;
+    if ((err = nvs_commit(nvs_handle)) != ESP_OK) goto exit;
+
+    ESP_LOGI(PROFILE_TAG, "Saved access point " MACSTR " on channel %d", MAC2STR(profile->bssid), (int)profile->channel);
+
+exit:
+    if (nvs_handle != 0) {
+        nvs_close(nvs_handle);
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGE(PROFILE_TAG, "Error storing Wi-Fi profile in NVS");
+    }
+
+    return err;
+}
+
+void wifi_profile_clear() {
+    nvs_handle_t nvs_handle = 0;
+
+    if (nvs_open(WIFI_PROFILE_STORAGE_NAMESPACE, NVS_READWRITE, &nvs_handle) == ESP_OK) {
+        nvs_erase_key(nvs_handle, WIFI_PROFILE_STORAGE_NAME);
+        nvs_commit(nvs_handle);
+        nvs_close(nvs_handle);
+    }
+}
+
+void wifi_profile_from_event(const char *ssid, const wifi_event_sta_connected_t *event, wifi_profile_t *out) {
+    memset(out, 0, sizeof(*out));
+
+    out->version = WIFI_PROFILE_VERSION;
+    memcpy(out->bssid, event->bssid, sizeof(out->bssid));
+    out->channel = event->channel;
+    snprintf(out->ssid, sizeof(out->ssid), "%s", ssid);
+}
+
+void wifi_profile_apply(const wifi_profile_t *profile, wifi_sta_config_t *config) {
+    config->bssid_set = true;
+    memcpy(config->bssid, profile->bssid, sizeof(config->bssid));
+    config->channel = profile->channel;
+    config->scan_method = WIFI_FAST_SCAN;
+}
+
+void wifi_profile_release(wifi_sta_config_t *config) {
+    config->bssid_set = false;
+    memset(config->bssid, 0, sizeof(config->bssid));
+    config->channel = 0;
+    config->scan_method = WIFI_ALL_CHANNEL_SCAN;
+}
+
+bool wifi_profile_should_fall_back(uint8_t reason, uint8_t failed_attempts) {
+    switch (reason) {
+        // The access point is gone or moved to another channel, retrying the same one cannot help
+        case WIFI_REASON_NO_AP_FOUND:
+        case WIFI_REASON_NO_AP_FOUND_W_COMPATIBLE_SECURITY:
+        case WIFI_REASON_NO_AP_FOUND_IN_AUTHMODE_THRESHOLD:
+        case WIFI_REASON_NO_AP_FOUND_IN_RSSI_THRESHOLD:
+            return true;
+
+        default:
+            return failed_attempts >= WIFI_PROFILE_MAX_FAST_ATTEMPTS;
+    }
+}
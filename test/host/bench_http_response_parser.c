@@ -0,0 +1,76 @@
+/*
+    Throughput of the response parser on a typical payment response, fed in reads of different
+    sizes. Small reads split most lines, so they go through the line copy instead of being
+    parsed in place.
+*/
+
+#include "http_response_parser.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_RESPONSES 200000
+
+static const char response[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Date: Sat, 17 Oct 2026 10:00:00 GMT\r\n"
+    "Server: pluto\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: 84\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n"
+    "{\"resultCode\":\"approved\",\"authorizationId\":\"a1b2c3d4e5f6\",\"displayMessage\":\"Thanks\"}";
+
+#define BENCH_BODY_SIZE 84
+
+static size_t body_bytes;
+
+static void on_body(void *ctx, const char *data, size_t len) {
+    (void)ctx;
+    (void)data;
+    body_bytes += len;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench(size_t read_size) {
+    size_t len = sizeof(response) - 1;
+    double start = now_seconds();
+
+    for (int i = 0; i < BENCH_RESPONSES; i++) {
+        http_response_parser_t parser;
+        http_parser_init(&parser, NULL, on_body, NULL);
+
+        for (size_t pos = 0; pos < len && !http_parser_is_done(&parser);) {
+            size_t n = len - pos < read_size ? len - pos : read_size;
+            size_t consumed = http_parser_feed(&parser, response + pos, n);
+            if (http_parser_has_error(&parser) || consumed == 0) {
+                fprintf(stderr, "Parse failed at %zu\n", pos);
+                return 1;
+            }
+            pos += consumed;
+        }
+    }
+
+    double elapsed = now_seconds() - start;
+    printf("reads of %4zu bytes: %7.1f MB/s, %6.0f ns per response\n",
+           read_size, (double)len * BENCH_RESPONSES / elapsed / 1e6, elapsed / BENCH_RESPONSES * 1e9);
+    return 0;
+}
+
+int main(void) {
+    // The last size takes the whole response in one read
+    static const size_t read_sizes[] = {16, 64, 1024};
+
+    for (size_t i = 0; i < sizeof(read_sizes) / sizeof(read_sizes[0]); i++) {
+        if (bench(read_sizes[i]) != 0) return 1;
+    }
+
+    size_t runs = sizeof(read_sizes) / sizeof(read_sizes[0]);
+    return body_bytes == (size_t)BENCH_BODY_SIZE * BENCH_RESPONSES * runs ? 0 : 1;
+}
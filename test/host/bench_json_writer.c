@@ -0,0 +1,148 @@
+/*
+    Cost of writing a payment body. The JSON writer appends at its write position and hashes as
+    it goes, the strncat chain it replaced rescanned the output for every fragment and was hashed
+    afterwards. Hashing the finished body alone shows how much of either is SHA-256.
+*/
+
+#include "request_formater.h"
+#include "security_measures.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_BODIES 20000
+#define BENCH_ROUNDS 5
+#define BENCH_BODY_SIZE 512
+
+static const char *keys[] = {"amount", "cardNumber", "currency", "timeStamp", "nonce", "operation", "deviceMacAddress", "timeQuality", "pinCode"};
+static const char *values[] = {
+    "12.50", "A1B2C3D4", "SEK", "2026-10-17T12:00:00",
+    "6b86b273ff34fce19d6b804eff5a3f5747ada4eaa22f1d49c01e52ddb7875b4b",
+    "payment", "AA:BB:CC:DD:EE:FF", "synced",
+    "d4735e3a265e16eee03f59718b9b5d03019c07d8b6c51f90da3a666eec13ab35"
+};
+
+#define BENCH_FIELDS (sizeof(keys) / sizeof(keys[0]))
+
+static uint8_t nonce[SHA256_DIGEST_SIZE];
+static uint8_t pin_digest[SHA256_DIGEST_SIZE];
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The body as it was written before the JSON writer
+static void strncat_body(char *out, size_t out_len) {
+    memset(out, 0, out_len);
+    snprintf(out, out_len, "{");
+
+    for (size_t i = 0; i < BENCH_FIELDS; i++) {
+        strncat(out, "\"", out_len - strlen(out) - 1);
+        strncat(out, keys[i], out_len - strlen(out) - 1);
+        strncat(out, "\":\"", out_len - strlen(out) - 1);
+        strncat(out, values[i], out_len - strlen(out) - 1);
+        strncat(out, "\"", out_len - strlen(out) - 1);
+        if (i < BENCH_FIELDS - 1) {
+            strncat(out, ",", out_len - strlen(out) - 1);
+        }
+    }
+
+    strncat(out, "}", out_len - strlen(out) - 1);
+}
+
+// The same fields the way pluto_payment writes them, keys rendered at compile time and typed values
+static size_t json_writer_body(char *out, size_t out_len, char hashed_body[SHA256_OUT_SIZE]) {
+    json_writer_t json;
+    json_writer_begin(&json, out, out_len);
+
+    json_write_key_literal(&json, JSON_KEY("amount"), sizeof(JSON_KEY("amount")) - 1);
+    json_value_minor_units(&json, 1250, 2);
+    json_write_key_literal(&json, JSON_KEY("cardNumber"), sizeof(JSON_KEY("cardNumber")) - 1);
+    json_value_string(&json, values[1]);
+    json_write_key_literal(&json, JSON_KEY("currency"), sizeof(JSON_KEY("currency")) - 1);
+    json_value_string(&json, values[2]);
+    json_write_key_literal(&json, JSON_KEY("timeStamp"), sizeof(JSON_KEY("timeStamp")) - 1);
+    json_value_string(&json, values[3]);
+    json_write_key_literal(&json, JSON_KEY("nonce"), sizeof(JSON_KEY("nonce")) - 1);
+    json_value_hex(&json, nonce, sizeof(nonce));
+    json_write_key_literal(&json, JSON_KEY("operation"), sizeof(JSON_KEY("operation")) - 1);
+    json_value_string(&json, values[5]);
+    json_write_key_literal(&json, JSON_KEY("deviceMacAddress"), sizeof(JSON_KEY("deviceMacAddress")) - 1);
+    json_value_string(&json, values[6]);
+    json_write_key_literal(&json, JSON_KEY("timeQuality"), sizeof(JSON_KEY("timeQuality")) - 1);
+    json_value_string(&json, values[7]);
+    json_write_key_literal(&json, JSON_KEY("pinCode"), sizeof(JSON_KEY("pinCode")) - 1);
+    json_value_hex(&json, pin_digest, sizeof(pin_digest));
+
+    if (json_writer_end(&json, hashed_body) != ESP_OK) return 0;
+    return json.body.len;
+}
+
+static char out[BENCH_BODY_SIZE];
+static char hashed_body[SHA256_OUT_SIZE];
+static size_t body_len;
+
+static void run_strncat(void) {
+    strncat_body(out, sizeof(out));
+}
+
+static void run_strncat_and_hash(void) {
+    strncat_body(out, sizeof(out));
+    hash_sha256((const unsigned char*)out, strlen(out), hashed_body);
+}
+
+static void run_json_writer(void) {
+    body_len = json_writer_body(out, sizeof(out), hashed_body);
+}
+
+static void run_hash(void) {
+    hash_sha256((const unsigned char*)out, body_len, hashed_body);
+}
+
+// Best of a few rounds, the other processes on a PC only ever make a round slower
+static double bench(void (*run)(void)) {
+    double best = 0;
+
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        double start = now_seconds();
+        for (int i = 0; i < BENCH_BODIES; i++) {
+            run();
+        }
+        double elapsed = now_seconds() - start;
+        if (round == 0 || elapsed < best) best = elapsed;
+    }
+
+    return best / BENCH_BODIES * 1e9;
+}
+
+int main(void) {
+    char expected_hash[SHA256_OUT_SIZE];
+
+    for (size_t i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        nonce[i] = (uint8_t)(0x6b + i * 7);
+        pin_digest[i] = (uint8_t)(0xd4 + i * 13);
+    }
+
+    double strncat_ns = bench(run_strncat);
+    double strncat_hash_ns = bench(run_strncat_and_hash);
+    double writer_ns = bench(run_json_writer);
+    double hash_ns = bench(run_hash);
+
+    // The hash the writer kept while writing has to match hashing the finished body
+    run_json_writer();
+    hash_sha256((const unsigned char*)out, body_len, expected_hash);
+    if (body_len == 0 || strlen(out) != body_len || strcmp(hashed_body, expected_hash) != 0) {
+        fprintf(stderr, "JSON writer output does not match its hash\n");
+        return 1;
+    }
+
+    printf("%zu byte body\n", body_len);
+    printf("strncat chain:          %6.0f ns, %6.0f ns with the hash after\n", strncat_ns, strncat_hash_ns);
+    printf("json writer with hash:  %6.0f ns\n", writer_ns);
+    printf("SHA-256 of the body:    %6.0f ns\n", hash_ns);
+
+    return 0;
+}
@@ -0,0 +1,55 @@
+/*
+    libFuzzer entry point for payment_response_parse. Up to three leading digits are taken as the
+    http status so the seeds stay readable, the rest is the body. The body is copied into a buffer
+    of its exact size, so a read past the end is caught by the address sanitizer.
+*/
+
+#include "payment_response.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void check_string(const char *text, size_t size) {
+    assert(memchr(text, '\0', size) != NULL);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    uint16_t status = 0;
+    size_t digits = 0;
+
+    while (digits < size && digits < 3 && data[digits] >= '0' && data[digits] <= '9') {
+        status = status * 10 + (data[digits++] - '0');
+    }
+
+    size_t len = size - digits;
+    char *body = malloc(len ? len : 1);
+    if (body == NULL) return 0;
+    memcpy(body, data + digits, len);
+
+    payment_response_t response;
+    esp_err_t ret = payment_response_parse(status, body, len, &response);
+    free(body);
+
+    assert(ret == ESP_OK || ret == ESP_ERR_INVALID_RESPONSE);
+    assert(response.http_status == status);
+    assert(response.result < PAYMENT_RESULT_COUNT);
+    check_string(response.authorization_id, sizeof(response.authorization_id));
+    check_string(response.message, sizeof(response.message));
+
+    // Only a 2xx with an id the server can look up is an approval
+    if (response.result == PAYMENT_RESULT_APPROVED) {
+        assert(status / 100 == 2 && response.authorization_id[0] != '\0');
+    } else {
+        assert(response.authorization_id[0] == '\0');
+    }
+
+    for (const char *c = response.message; *c != '\0'; c++) {
+        assert(*c >= 0x20 && *c <= 0x7e);
+    }
+
+    char text[64];
+    payment_response_lcd_text(&response, text, sizeof(text));
+
+    return 0;
+}
@@ -0,0 +1,39 @@
+/*
+    Runs a libFuzzer entry point over the files given on the command line. Lets the corpus be
+    checked with any compiler, libFuzzer itself only comes with clang.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        FILE *file = fopen(argv[i], "rb");
+        if (file == NULL) {
+            fprintf(stderr, "Cannot open %s\n", argv[i]);
+            return 1;
+        }
+
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        uint8_t *data = malloc(size > 0 ? (size_t)size : 1);
+        if (data == NULL || fread(data, 1, (size_t)size, file) != (size_t)size) {
+            fprintf(stderr, "Cannot read %s\n", argv[i]);
+            fclose(file);
+            free(data);
+            return 1;
+        }
+        fclose(file);
+
+        LLVMFuzzerTestOneInput(data, (size_t)size);
+        free(data);
+    }
+
+    printf("Replayed %d inputs\n", argc - 1);
+    return 0;
+}
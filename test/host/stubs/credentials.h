@@ -0,0 +1,18 @@
+/*
+    Fixed credentials for the host tests, the expected signatures are computed with these.
+    The key is longer than a SHA-256 block, so HMAC hashes it before use.
+*/
+
+#ifndef SECRET_CREDENTIALS_H
+#define SECRET_CREDENTIALS_H
+
+#define WIFI_SSID   "pluto-test"
+#define WIFI_PASS   "pluto-test-pass"
+
+#define DEVICE_KEY  "host-test-device-key-longer-than-one-sha256-block-so-it-is-hashed-first"
+
+#define SERVER_HOST         "pluto.test"
+#define PLUTO_URL           "https://pluto.test:443"
+#define PLUTO_PAYMENT_API   "/device/authorize"
+
+#endif
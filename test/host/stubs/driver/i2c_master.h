@@ -0,0 +1,12 @@
+#ifndef I2C_MASTER_H_
+#define I2C_MASTER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+typedef struct i2c_master_dev_t *i2c_master_dev_handle_t;
+
+esp_err_t i2c_master_transmit(i2c_master_dev_handle_t i2c_dev, const uint8_t *write_buffer, size_t write_size, int xfer_timeout_ms);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef ESP_LOG_H_
+#define ESP_LOG_H_
+
+#include <stdio.h>
+
+#define ESP_LOGE(tag, format, ...) fprintf(stderr, "E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fprintf(stderr, "W %s: " format "\n", tag, ##__VA_ARGS__)
+// Kept quiet, but still type checked
+#define ESP_LOGI(tag, format, ...) do { if (0) fprintf(stderr, "%s: " format "\n", tag, ##__VA_ARGS__); } while (0)
+#define ESP_LOGD(tag, format, ...) ESP_LOGI(tag, format, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef ESP_NETIF_SNTP_H_
+#define ESP_NETIF_SNTP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_sntp.h"
+
+typedef struct {
+    bool wait_for_sync;
+    size_t num_of_servers;
+    const char *servers[2];
+    sntp_sync_time_cb_t sync_cb;
+} esp_sntp_config_t;
+
+#define ESP_SNTP_SERVER_LIST(...) { __VA_ARGS__ }
+#define ESP_NETIF_SNTP_DEFAULT_CONFIG_MULTIPLE(servers_in_list, list_of_servers) { \
+        .wait_for_sync = true,                                                      \
+        .num_of_servers = (servers_in_list),                                        \
+        .servers = list_of_servers                                                  \
+    }
+
+esp_err_t esp_netif_sntp_init(const esp_sntp_config_t *config);
+void esp_netif_sntp_deinit(void);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef ESP_RANDOM_H_
+#define ESP_RANDOM_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Not random enough for anything but tests
+static inline void esp_fill_random(void *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) ((uint8_t*)buf)[i] = (uint8_t)rand();
+}
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef ESP_SNTP_H_
+#define ESP_SNTP_H_
+
+#include <stdint.h>
+#include <sys/time.h>
+
+typedef void (*sntp_sync_time_cb_t)(struct timeval *tv);
+
+void esp_sntp_set_sync_interval(uint32_t interval_ms);
+
+#endif
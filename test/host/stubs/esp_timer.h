@@ -0,0 +1,9 @@
+#ifndef ESP_TIMER_H_
+#define ESP_TIMER_H_
+
+#include <stdint.h>
+
+// Defined by the test that needs it
+int64_t esp_timer_get_time(void);
+
+#endif
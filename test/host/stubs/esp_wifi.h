@@ -0,0 +1,84 @@
+#ifndef ESP_WIFI_H_
+#define ESP_WIFI_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+
+#define ESP_ERR_WIFI_NOT_CONNECT 0x300f
+
+extern esp_event_base_t const WIFI_EVENT;
+
+typedef enum {
+    WIFI_EVENT_STA_START = 2,
+    WIFI_EVENT_STA_CONNECTED = 4,
+    WIFI_EVENT_STA_DISCONNECTED = 5
+} wifi_event_t;
+
+typedef enum {
+    WIFI_REASON_ASSOC_LEAVE = 8,
+    WIFI_REASON_NO_AP_FOUND = 201,
+    WIFI_REASON_AUTH_FAIL = 202,
+    WIFI_REASON_HANDSHAKE_TIMEOUT = 204,
+    WIFI_REASON_NO_AP_FOUND_W_COMPATIBLE_SECURITY = 210,
+    WIFI_REASON_NO_AP_FOUND_IN_AUTHMODE_THRESHOLD = 211,
+    WIFI_REASON_NO_AP_FOUND_IN_RSSI_THRESHOLD = 212
+} wifi_err_reason_t;
+
+typedef enum {
+    WIFI_FAST_SCAN = 0,
+    WIFI_ALL_CHANNEL_SCAN
+} wifi_scan_method_t;
+
+typedef enum {
+    WIFI_MODE_STA = 1
+} wifi_mode_t;
+
+typedef enum {
+    WIFI_IF_STA = 0
+} wifi_interface_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t password[64];
+    wifi_scan_method_t scan_method;
+    bool bssid_set;
+    uint8_t bssid[6];
+    uint8_t channel;
+} wifi_sta_config_t;
+
+typedef union {
+    wifi_sta_config_t sta;
+} wifi_config_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t ssid_len;
+    uint8_t bssid[6];
+    uint8_t channel;
+} wifi_event_sta_connected_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t ssid_len;
+    uint8_t bssid[6];
+    uint8_t reason;
+    int8_t rssi;
+} wifi_event_sta_disconnected_t;
+
+typedef struct {
+    int unused;
+} wifi_init_config_t;
+
+#define WIFI_INIT_CONFIG_DEFAULT() {0}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config);
+esp_err_t esp_wifi_deinit(void);
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode);
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf);
+esp_err_t esp_wifi_start(void);
+esp_err_t esp_wifi_connect(void);
+
+#endif
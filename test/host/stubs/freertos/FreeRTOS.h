@@ -0,0 +1,28 @@
+/*
+    Host stand-in for the FreeRTOS types the tested modules name. Nothing is scheduled on the
+    host, the functions are defined by the tests that call them.
+*/
+
+#ifndef INC_FREERTOS_H
+#define INC_FREERTOS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE  1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+#define BIT0 0x00000001
+
+// The tests run on one thread, a critical section has nothing to keep out
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux)  ((void)(mux))
+
+#endif
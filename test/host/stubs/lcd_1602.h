@@ -0,0 +1,23 @@
+/*
+    Host stand-in for the lcd_1602_i2c_driver header, only what the tested modules use.
+*/
+
+#ifndef LCD_1602_H_
+#define LCD_1602_H_
+
+#include "esp_err.h"
+#include "driver/i2c_master.h"
+
+#define LCD_1602_SCREEN_CHAR_WIDTH  16
+#define LCD_1602_MAX_ROWS           2
+
+// PCF8574 backpack wiring
+#define LCD_1602_PIN_RS             0x01
+#define LCD_1602_PIN_EN             0x04
+#define LCD_1602_BACKLIGHT          0x08
+
+esp_err_t lcd_1602_init(i2c_master_dev_handle_t dev);
+esp_err_t lcd_1602_clear_screen(i2c_master_dev_handle_t dev);
+esp_err_t lcd_1602_send_string(i2c_master_dev_handle_t dev, const char *str);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef NVS_FLASH_H_
+#define NVS_FLASH_H_
+
+#include "nvs.h"
+
+#endif
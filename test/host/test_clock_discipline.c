@@ -0,0 +1,199 @@
+/*
+    Checks the Date header parser and the clock corrections in clock_discipline.c, and the cached
+    date and hour in time_format_timestamp against localtime across hour and daylight saving changes.
+    The test owns esp_timer and the system time, so every correction can be checked to the microsecond.
+*/
+
+#include "clock_discipline.h"
+#include "time_sync.h"
+#include "test_host.h"
+
+#include <string.h>
+#include <sys/time.h>
+
+#include "esp_timer.h"
+#include "esp_netif_sntp.h"
+#include "nvs.h"
+
+// MOCKED TIME
+static int64_t now_us;
+static int64_t system_us;
+static int settimeofday_calls;
+
+int64_t esp_timer_get_time(void) { return now_us; }
+
+int gettimeofday(struct timeval *restrict tv, void *restrict tz) {
+    tv->tv_sec = (time_t)(system_us / 1000000);
+    tv->tv_usec = (suseconds_t)(system_us % 1000000);
+    return 0;
+}
+
+int settimeofday(const struct timeval *tv, const struct timezone *tz) {
+    system_us = (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+    settimeofday_calls++;
+    return 0;
+}
+
+// Only linked in, time_sync.c is here for the formatter
+esp_err_t esp_netif_sntp_init(const esp_sntp_config_t *config) { return ESP_OK; }
+void esp_netif_sntp_deinit(void) {}
+void esp_sntp_set_sync_interval(uint32_t interval_ms) {}
+esp_err_t nvs_open(const char *namespace_name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle) { return ESP_ERR_NVS_NOT_FOUND; }
+void nvs_close(nvs_handle_t handle) {}
+esp_err_t nvs_commit(nvs_handle_t handle) { return ESP_OK; }
+esp_err_t nvs_set_i64(nvs_handle_t handle, const char *key, int64_t value) { return ESP_OK; }
+esp_err_t nvs_get_i64(nvs_handle_t handle, const char *key, int64_t *out_value) { return ESP_ERR_NVS_NOT_FOUND; }
+
+#define SEC 1000000LL
+
+static bool parse(const char *value, time_t *out) {
+    return clock_parse_http_date(value, strlen(value), out);
+}
+
+static void test_days_from_civil() {
+    CHECK(clock_days_from_civil(1970, 1, 1) == 0);
+    CHECK(clock_days_from_civil(1969, 12, 31) == -1);
+    CHECK(clock_days_from_civil(2000, 3, 1) == 11017);
+    CHECK(clock_days_from_civil(2024, 2, 29) == 19782);
+    CHECK(clock_days_from_civil(2100, 3, 1) == 47541);
+    CHECK(clock_days_from_civil(1600, 1, 1) == -135140);
+}
+
+static void test_parse_http_date() {
+    time_t date = 0;
+
+    CHECK(parse("Sun, 06 Nov 1994 08:49:37 GMT", &date) && date == 784111777);
+    CHECK(parse("Thu, 01 Jan 1970 00:00:00 GMT", &date) && date == 0);
+    CHECK(parse("Tue, 29 Feb 2000 12:00:00 GMT", &date) && date == 951825600);
+    CHECK(parse("Sat, 01 Jun 2024 12:34:56 GMT", &date) && date == 1717245296);
+    CHECK(parse("Sat, 01 Jan 2039 00:00:00 GMT", &date) && date == 2177452800);
+
+    date = 42;
+    CHECK(!parse("Sun, 06 Nov 1994 08:49:37 UTC", &date));
+    CHECK(!parse("Sun, 06 Nov 1994 08:49:37", &date));
+    CHECK(!parse("Sunday, 06-Nov-94 08:49:37 GMT", &date));
+    CHECK(!parse("Sun Nov  6 08:49:37 1994", &date));
+    CHECK(!parse("Sun, 06 Foo 1994 08:49:37 GMT", &date));
+    CHECK(!parse("Sun, 6  Nov 1994 08:49:37 GMT", &date));
+    CHECK(!parse("Sun, 00 Nov 1994 08:49:37 GMT", &date));
+    CHECK(!parse("Sun, 06 Nov 1994 24:00:00 GMT", &date));
+    CHECK(!parse("Sun, 06 Nov 1994 08:60:37 GMT", &date));
+    CHECK(date == 42);
+}
+
+static void test_http_date() {
+    const int64_t wall_us = 1717245296 * SEC;
+    const int64_t mono_us = 10 * SEC;
+    clock_discipline_stats_t stats;
+
+    // Never set, the system time is what the header is checked against
+    system_us = wall_us - 60 * SEC;
+    now_us = mono_us;
+    CHECK(clock_discipline_http_date(1717245296, mono_us - SEC / 2, mono_us));
+    CHECK(clock_now_us() == wall_us);
+    CHECK(system_us == wall_us);
+    CHECK(clock_discipline_source() == CLOCK_SOURCE_HTTP_DATE);
+
+    clock_discipline_set(wall_us, mono_us, CLOCK_SOURCE_SNTP);
+    settimeofday_calls = 0;
+
+    // Early, moved to the start of the header's second at the time the response came in
+    now_us = mono_us + 1200 * 1000;
+    CHECK(clock_discipline_http_date(1717245296 + 5, mono_us + SEC, now_us));
+    CHECK(clock_now_us() == wall_us + 5 * SEC);
+    CHECK(system_us == wall_us + 5 * SEC);
+    clock_discipline_get_stats(&stats);
+    CHECK(stats.date_corrections == 2);
+    CHECK(stats.last_correction_ms == 3800);
+    CHECK(stats.source == CLOCK_SOURCE_HTTP_DATE);
+
+    // Late, moved to the end of the header's second at the time the request went out
+    now_us = mono_us + 2300 * 1000;
+    CHECK(clock_discipline_http_date(1717245296 + 2, mono_us + 2 * SEC, now_us));
+    CHECK(clock_now_us() == wall_us + 3300 * 1000);
+    clock_discipline_get_stats(&stats);
+    CHECK(stats.date_corrections == 3);
+    CHECK(stats.last_correction_ms == -2800);
+
+    // Clock reads +4 s when sent and +4.4 s when received, so the header's +4 s allows it
+    now_us = mono_us + 3400 * 1000;
+    CHECK(!clock_discipline_http_date(1717245296 + 4, mono_us + 3 * SEC, now_us));
+    CHECK(clock_now_us() == wall_us + 4400 * 1000);
+
+    // Received exactly at the start of the header's second is still inside
+    CHECK(!clock_discipline_http_date(1717245296 + 4, mono_us + 3 * SEC, mono_us + 3 * SEC));
+    // Sent exactly at its end as well
+    CHECK(!clock_discipline_http_date(1717245296 + 3, mono_us + 3 * SEC, now_us));
+
+    clock_discipline_get_stats(&stats);
+    CHECK(stats.date_corrections == 3);
+    CHECK(settimeofday_calls == 2);
+
+    // A good SNTP time stays the source when the header agrees
+    clock_discipline_set(wall_us + 4400 * 1000, now_us, CLOCK_SOURCE_SNTP);
+    CHECK(!clock_discipline_http_date(1717245296 + 4, now_us - SEC / 10, now_us));
+    CHECK(clock_discipline_source() == CLOCK_SOURCE_SNTP);
+}
+
+static bool formats_as_localtime(time_t timestamp) {
+    char expected[TIME_STRING_SIZE];
+    char buf[TIME_STRING_SIZE];
+    struct tm local_time;
+
+    localtime_r(&timestamp, &local_time);
+    strftime(expected, sizeof(expected), "%Y-%m-%dT%H:%M:%S", &local_time);
+    time_format_timestamp(timestamp, buf, sizeof(buf));
+
+    return strcmp(buf, expected) == 0;
+}
+
+static bool formats_as(time_t timestamp, const char *expected) {
+    char buf[TIME_STRING_SIZE];
+
+    time_format_timestamp(timestamp, buf, sizeof(buf));
+    return strcmp(buf, expected) == 0;
+}
+
+static void test_format_timestamp() {
+    // Last second before and first after the new hour: a day and month change, then both DST changes
+    static const time_t boundaries[] = {1706742000, 1711846800, 1729990800};
+    char buf[TIME_STRING_SIZE];
+
+    time_set_timezone();
+
+    CHECK(formats_as(1717245296, "2024-06-01T14:34:56"));
+    CHECK(formats_as(1706741999, "2024-01-31T23:59:59"));
+    CHECK(formats_as(1706742000, "2024-02-01T00:00:00"));
+    // Back into the hour before, the cached prefix must not be kept
+    CHECK(formats_as(1706741999, "2024-01-31T23:59:59"));
+
+    CHECK(formats_as(1711846799, "2024-03-31T01:59:59"));
+    CHECK(formats_as(1711846800, "2024-03-31T03:00:00"));
+    CHECK(formats_as(1729990799, "2024-10-27T02:59:59"));
+    CHECK(formats_as(1729990800, "2024-10-27T02:00:00"));
+
+    for (size_t i = 0; i < sizeof(boundaries) / sizeof(boundaries[0]); i++) {
+        int mismatches = 0;
+
+        for (time_t t = boundaries[i] - 2 * 3600; t < boundaries[i] + 2 * 3600; t++) {
+            if (!formats_as_localtime(t)) mismatches++;
+        }
+        CHECK(mismatches == 0);
+    }
+
+    // Room for the text and its terminator or nothing is written
+    time_format_timestamp(1717245296, buf, 20);
+    CHECK(strcmp(buf, "2024-06-01T14:34:56") == 0);
+    memset(buf, 'x', sizeof(buf));
+    time_format_timestamp(1717245296, buf, 19);
+    CHECK(buf[0] == '\0');
+}
+
+int main() {
+    test_days_from_civil();
+    test_parse_http_date();
+    test_http_date();
+    test_format_timestamp();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,18 @@
+#ifndef TEST_HOST_H_
+#define TEST_HOST_H_
+
+#include <stdio.h>
+
+static int test_failures = 0;
+
+// Keeps going after a failed check so one run reports every broken case
+#define CHECK(cond) do {                                                            \
+        if (!(cond)) {                                                              \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            test_failures++;                                                        \
+        }                                                                           \
+    } while (0)
+
+#define TEST_RESULT() (test_failures == 0 ? 0 : 1)
+
+#endif
@@ -0,0 +1,140 @@
+#include "http_response_parser.h"
+#include "test_host.h"
+
+#include <string.h>
+
+typedef struct {
+    char body[256];
+    size_t body_len;
+} body_t;
+
+static void on_body(void *ctx, const char *data, size_t len) {
+    body_t *body = (body_t*)ctx;
+
+    if (body->body_len + len < sizeof(body->body)) {
+        memcpy(body->body + body->body_len, data, len);
+        body->body_len += len;
+    }
+}
+
+// Feeds the response in reads of step bytes, the way TLS records may split it
+static void parse(http_response_parser_t *parser, body_t *body, const char *response, size_t step) {
+    size_t len = strlen(response);
+    size_t pos = 0;
+
+    memset(body, 0, sizeof(*body));
+    http_parser_init(parser, NULL, on_body, body);
+
+    while (pos < len && !http_parser_is_done(parser) && !http_parser_has_error(parser)) {
+        size_t n = len - pos < step ? len - pos : step;
+        pos += http_parser_feed(parser, response + pos, n);
+    }
+}
+
+static void check_response(const char *response, int status, const char *expected_body, bool keep_alive, bool close) {
+    for (size_t step = 1; step <= strlen(response); step++) {
+        http_response_parser_t parser;
+        body_t body;
+
+        parse(&parser, &body, response, step);
+        if (close) http_parser_on_close(&parser);
+
+        CHECK(http_parser_is_done(&parser));
+        CHECK(parser.status_code == status);
+        CHECK(parser.keep_alive == keep_alive);
+        CHECK(strcmp(body.body, expected_body) == 0);
+    }
+}
+
+static bool has_error(const char *response) {
+    http_response_parser_t parser;
+    body_t body;
+
+    parse(&parser, &body, response, strlen(response));
+    return http_parser_has_error(&parser);
+}
+
+static void test_framing(void) {
+    check_response("HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: 5\r\n\r\nhello", 200, "hello", true, false);
+    check_response("HTTP/1.1 402 Payment Required\r\nTransfer-Encoding: chunked\r\n\r\n3;x=y\r\nabc\r\n0A\r\n0123456789\r\n0\r\nX: y\r\n\r\n",
+                   402, "abc0123456789", true, false);
+    check_response("HTTP/1.1 200 OK\r\nTransfer-Encoding: gzip,chunked\r\n\r\n2\r\nok\r\n0\r\n\r\n", 200, "ok", true, false);
+    check_response("HTTP/1.1 200 OK\r\nTransfer-Encoding: gzip, chunked\r\n\r\n2\r\nok\r\n0\r\n\r\n", 200, "ok", true, false);
+    // Only the whole token counts, this body runs to the close
+    check_response("HTTP/1.1 200 OK\r\nTransfer-Encoding: xchunked\r\n\r\n2\r\nok", 200, "2\r\nok", false, true);
+    check_response("HTTP/1.0 500 ERR\r\n\r\nrest", 500, "rest", false, true);
+    check_response("HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 2\r\n\r\nok", 200, "ok", false, false);
+    check_response("HTTP/1.1 204 No Content\r\n\r\n", 204, "", true, false);
+}
+
+static void test_bytes_after_response(void) {
+    static const char response[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nokNEXT";
+    http_response_parser_t parser;
+    body_t body = {0};
+
+    http_parser_init(&parser, NULL, on_body, &body);
+    CHECK(http_parser_feed(&parser, response, sizeof(response) - 1) == sizeof(response) - 1 - 4);
+    CHECK(http_parser_is_done(&parser));
+    CHECK(strcmp(body.body, "ok") == 0);
+}
+
+static void test_content_length_bounds(void) {
+    char response[128];
+
+    snprintf(response, sizeof(response), "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n", HTTP_PARSER_MAX_BODY);
+    CHECK(!has_error(response));
+
+    snprintf(response, sizeof(response), "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n", HTTP_PARSER_MAX_BODY + 1);
+    CHECK(has_error(response));
+
+    // Would overflow a long long before the digits run out
+    CHECK(has_error("HTTP/1.1 200 OK\r\nContent-Length: 99999999999999999999999999\r\n\r\n"));
+    CHECK(has_error("HTTP/1.1 200 OK\r\nContent-Length: 18446744073709551617\r\n\r\n"));
+    CHECK(has_error("HTTP/1.1 200 OK\r\nContent-Length: -1\r\n\r\n"));
+    CHECK(has_error("HTTP/1.1 200 OK\r\nContent-Length: \r\n\r\n"));
+    CHECK(has_error("HTTP/1.1 200 OK\r\nContent-Length: 1 2\r\n\r\n"));
+}
+
+static void test_chunk_size_bounds(void) {
+    char response[128];
+
+    snprintf(response, sizeof(response), "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n%x\r\n", HTTP_PARSER_MAX_BODY);
+    CHECK(!has_error(response));
+
+    snprintf(response, sizeof(response), "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n%x\r\n", HTTP_PARSER_MAX_BODY + 1);
+    CHECK(has_error(response));
+
+    CHECK(has_error("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n10000000000000001\r\n"));
+    CHECK(has_error("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n"));
+}
+
+static void test_malformed(void) {
+    CHECK(has_error("HTTP/2 200 OK\r\n\r\n"));
+    CHECK(has_error("HTTP/1.1 2x0 OK\r\n\r\n"));
+    CHECK(has_error("HTTP/1.1 200 OK\r\nNo colon here\r\n\r\n"));
+
+    // A line longer than the parser keeps when it is split across reads
+    char response[HTTP_PARSER_MAX_LINE * 2];
+    memset(response, 'a', sizeof(response) - 1);
+    response[sizeof(response) - 1] = '\0';
+    memcpy(response, "HTTP/1.1 200 OK\r\nX: ", 20);
+
+    http_response_parser_t parser;
+    body_t body;
+    parse(&parser, &body, response, 7);
+    CHECK(http_parser_has_error(&parser));
+
+    // Closed before the body was complete
+    parse(&parser, &body, "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhel", 64);
+    CHECK(!http_parser_on_close(&parser));
+}
+
+int main(void) {
+    test_framing();
+    test_bytes_after_response();
+    test_content_length_bounds();
+    test_chunk_size_bounds();
+    test_malformed();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,165 @@
+#include "payment_response.h"
+#include "test_host.h"
+
+#include <string.h>
+
+static esp_err_t parse(uint16_t status, const char *body, payment_response_t *out) {
+    return payment_response_parse(status, body, body ? strlen(body) : 0, out);
+}
+
+static void test_success(void) {
+    payment_response_t response;
+
+    CHECK(parse(200, "{\"resultCode\":\"approved\",\"authorizationId\":\"A-1\",\"displayMessage\":\"Thanks\"}", &response) == ESP_OK);
+    CHECK(response.http_status == 200);
+    CHECK(response.result == PAYMENT_RESULT_APPROVED);
+    CHECK(strcmp(response.authorization_id, "A-1") == 0);
+    CHECK(strcmp(response.message, "Thanks") == 0);
+
+    // Key order and unknown keys do not matter
+    CHECK(parse(201, "{ \"extra\": [1, {\"a\": null}], \"authorizationId\": \"B\", \"resultCode\": \"approved\" }", &response) == ESP_OK);
+    CHECK(response.result == PAYMENT_RESULT_APPROVED);
+    CHECK(strcmp(response.authorization_id, "B") == 0);
+
+    CHECK(parse(200, "{\"resultCode\":\"declined\",\"authorizationId\":\"C\"}", &response) == ESP_OK);
+    CHECK(response.result == PAYMENT_RESULT_DECLINED);
+    CHECK(response.authorization_id[0] == '\0');
+}
+
+static void test_success_without_authorization(void) {
+    payment_response_t response;
+
+    CHECK(parse(200, "{\"resultCode\":\"approved\"}", &response) == ESP_ERR_INVALID_RESPONSE);
+    CHECK(response.result == PAYMENT_RESULT_INVALID_RESPONSE);
+
+    // Longer than the buffer, a cut id cannot be looked up later
+    CHECK(parse(200, "{\"resultCode\":\"approved\",\"authorizationId\":\"0123456789012345678901234567890123456789\"}", &response) == ESP_ERR_INVALID_RESPONSE);
+    CHECK(response.result == PAYMENT_RESULT_INVALID_RESPONSE);
+    CHECK(response.authorization_id[0] == '\0');
+}
+
+static void test_client_error(void) {
+    payment_response_t response;
+
+    CHECK(parse(402, "{\"resultCode\":\"insufficient_funds\",\"displayMessage\":\"Balance low\"}", &response) == ESP_OK);
+    CHECK(response.result == PAYMENT_RESULT_INSUFFICIENT_FUNDS);
+    CHECK(strcmp(response.message, "Balance low") == 0);
+
+    CHECK(parse(403, "{\"resultCode\":\"card_blocked\"}", &response) == ESP_OK);
+    CHECK(response.result == PAYMENT_RESULT_CARD_BLOCKED);
+
+    CHECK(parse(400, "{\"resultCode\":\"something_new\"}", &response) == ESP_ERR_INVALID_RESPONSE);
+    CHECK(response.result == PAYMENT_RESULT_REJECTED);
+
+    CHECK(parse(400, "Bad Request", &response) == ESP_ERR_INVALID_RESPONSE);
+    CHECK(response.result == PAYMENT_RESULT_REJECTED);
+
+    // A 4xx is never an approval
+    CHECK(parse(409, "{\"resultCode\":\"approved\",\"authorizationId\":\"X\"}", &response) == ESP_OK);
+    CHECK(response.result == PAYMENT_RESULT_REJECTED);
+    CHECK(response.authorization_id[0] == '\0');
+}
+
+static void test_server_error(void) {
+    payment_response_t response;
+
+    CHECK(parse(500, "{\"resultCode\":\"approved\",\"authorizationId\":\"X\"}", &response) == ESP_OK);
+    CHECK(response.result == PAYMENT_RESULT_SERVER_ERROR);
+    CHECK(response.authorization_id[0] == '\0');
+
+    CHECK(parse(503, "<html>Service Unavailable</html>", &response) == ESP_ERR_INVALID_RESPONSE);
+    CHECK(response.result == PAYMENT_RESULT_SERVER_ERROR);
+
+    CHECK(parse(502, NULL, &response) == ESP_ERR_INVALID_RESPONSE);
+    CHECK(response.result == PAYMENT_RESULT_SERVER_ERROR);
+}
+
+static void test_other_status(void) {
+    payment_response_t response;
+
+    CHECK(parse(302, "{\"resultCode\":\"approved\",\"authorizationId\":\"X\"}", &response) == ESP_OK);
+    CHECK(response.result == PAYMENT_RESULT_INVALID_RESPONSE);
+    CHECK(response.authorization_id[0] == '\0');
+}
+
+// Every cut of a valid body is rejected, whether it ends inside a key, a string or between tokens
+static void test_truncated(void) {
+    static const char body[] = "{\"resultCode\":\"approved\",\"authorizationId\":\"A-1\",\"displayMessage\":\"Thanks\"}";
+    payment_response_t response;
+
+    for (size_t len = 0; len < sizeof(body) - 1; len++) {
+        CHECK(payment_response_parse(200, body, len, &response) == ESP_ERR_INVALID_RESPONSE);
+        CHECK(response.result == PAYMENT_RESULT_INVALID_RESPONSE);
+    }
+
+    // Escapes cut short inside a value that is otherwise complete
+    CHECK(parse(200, "{\"resultCode\":\"approved\",\"authorizationId\":\"A\\u00\"}", &response) == ESP_ERR_INVALID_RESPONSE);
+    CHECK(parse(200, "{\"resultCode\":\"approved\",\"authorizationId\":\"A\\", &response) == ESP_ERR_INVALID_RESPONSE);
+}
+
+static void test_too_many_tokens(void) {
+    char body[512] = "{\"resultCode\":\"declined\"";
+    payment_response_t response;
+
+    for (int i = 0; i < PAYMENT_RESPONSE_MAX_TOKENS; i++) {
+        size_t len = strlen(body);
+        snprintf(body + len, sizeof(body) - len, ",\"k%d\":%d", i, i);
+    }
+    strcat(body, "}");
+
+    CHECK(parse(402, body, &response) == ESP_ERR_INVALID_RESPONSE);
+    CHECK(response.result == PAYMENT_RESULT_REJECTED);
+}
+
+static void test_non_ascii_message(void) {
+    payment_response_t response;
+
+    // Raw UTF-8, each byte outside printable ascii is replaced
+    CHECK(parse(402, "{\"resultCode\":\"declined\",\"displayMessage\":\"K\xc3\xb6ln\"}", &response) == ESP_OK);
+    CHECK(strcmp(response.message, "K??ln") == 0);
+
+    // Escaped code points outside ascii become one replacement
+    CHECK(parse(402, "{\"resultCode\":\"declined\",\"displayMessage\":\"Caf\\u00e9 \\u0041\"}", &response) == ESP_OK);
+    CHECK(strcmp(response.message, "Caf? A") == 0);
+
+    // Control characters too, the lcd would draw garbage for them
+    CHECK(parse(402, "{\"resultCode\":\"declined\",\"displayMessage\":\"a\\nb\\tc\"}", &response) == ESP_OK);
+    CHECK(strcmp(response.message, "a?b?c") == 0);
+
+    // Too long for one row is cut, not rejected
+    CHECK(parse(402, "{\"resultCode\":\"declined\",\"displayMessage\":\"0123456789abcdefXYZ\"}", &response) == ESP_OK);
+    CHECK(strcmp(response.message, "0123456789abcdef") == 0);
+}
+
+static void test_lcd_text(void) {
+    payment_response_t response;
+    char text[40];
+
+    parse(200, "{\"resultCode\":\"approved\",\"authorizationId\":\"A\",\"displayMessage\":\"Thanks\"}", &response);
+    payment_response_lcd_text(&response, text, sizeof(text));
+    CHECK(strcmp(text, "Payment approved\nThanks") == 0);
+
+    // Two row results leave no room for the message
+    parse(402, "{\"resultCode\":\"insufficient_funds\",\"displayMessage\":\"Balance low\"}", &response);
+    payment_response_lcd_text(&response, text, sizeof(text));
+    CHECK(strcmp(text, "Insufficient\nfunds") == 0);
+
+    payment_response_no_answer(&response, true);
+    CHECK(response.result == PAYMENT_RESULT_NO_ANSWER);
+    payment_response_no_answer(&response, false);
+    CHECK(response.result == PAYMENT_RESULT_NO_RESPONSE);
+}
+
+int main(void) {
+    test_success();
+    test_success_without_authorization();
+    test_client_error();
+    test_server_error();
+    test_other_status();
+    test_truncated();
+    test_too_many_tokens();
+    test_non_ascii_message();
+    test_lcd_text();
+
+    return TEST_RESULT();
+}
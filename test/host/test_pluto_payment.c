@@ -0,0 +1,205 @@
+/*
+    Round trip of the payment schema: whatever pluto_payment_serialize writes, pluto_payment_parse
+    reads back field for field. The clock and time formatting come from time_sync and
+    clock_discipline on the device, they need SNTP and NVS and are stood in for below.
+*/
+
+#include "pluto_payment.h"
+#include "clock_discipline.h"
+#include "time_sync.h"
+#include "test_host.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_NOW 1792238400     // 2026-10-17T12:00:00 UTC
+#define TEST_BODY_SIZE 512
+
+int64_t esp_timer_get_time(void) {
+    return 0;
+}
+
+int64_t clock_now_us() {
+    return (int64_t)TEST_NOW * 1000000;
+}
+
+time_quality_t time_get_quality() {
+    return TIME_QUALITY_SYNCED;
+}
+
+const char *time_quality_name(time_quality_t quality) {
+    return quality == TIME_QUALITY_SYNCED ? "synced" : "none";
+}
+
+void time_format_timestamp(time_t timestamp, char *buf, size_t buf_size) {
+    struct tm utc;
+    gmtime_r(&timestamp, &utc);
+    strftime(buf, buf_size, "%Y-%m-%dT%H:%M:%S", &utc);
+}
+
+esp_err_t time_parse_timestamp(const char *buf, time_t *out) {
+    struct tm utc = {0};
+
+    if (sscanf(buf, "%4d-%2d-%2dT%2d:%2d:%2d", &utc.tm_year, &utc.tm_mon, &utc.tm_mday,
+               &utc.tm_hour, &utc.tm_min, &utc.tm_sec) != 6) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    utc.tm_year -= 1900;
+    utc.tm_mon -= 1;
+    *out = timegm(&utc);
+    return ESP_OK;
+}
+
+static void test_payment(pluto_payment *payment) {
+    memset(payment, 0, sizeof(*payment));
+
+    payment->amount = 123456;
+    snprintf(payment->card_number, sizeof(payment->card_number), "%s", "04A1B2C3D4E5F6");
+    snprintf(payment->currency, sizeof(payment->currency), "%s", "SEK");
+    payment->date = TEST_NOW;
+    // Quotes, backslashes and control characters have to survive the escaping
+    snprintf(payment->operation, sizeof(payment->operation), "%s", "pay \"now\"\\\t");
+    snprintf(payment->device_id, sizeof(payment->device_id), "%s", "AA:BB:CC:DD:EE:FF");
+    snprintf(payment->time_quality, sizeof(payment->time_quality), "%s", "synced");
+
+    for (size_t i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        payment->nonce[i] = (uint8_t)(i * 7 + 1);
+        payment->pin_code[i] = (uint8_t)(0xff - i);
+    }
+}
+
+static void test_round_trip(void) {
+    pluto_payment payment;
+    pluto_payment parsed;
+    char body[TEST_BODY_SIZE];
+    char hashed_body[SHA256_OUT_BUF_SIZE];
+    char expected_hash[SHA256_OUT_BUF_SIZE];
+    size_t body_len = 0;
+
+    test_payment(&payment);
+
+    CHECK(pluto_payment_serialize(&payment, body, sizeof(body), &body_len, hashed_body) == ESP_OK);
+    CHECK(body_len == strlen(body));
+
+    // The hash kept while writing is the hash of what was written
+    CHECK(hash_sha256((const unsigned char*)body, body_len, expected_hash) == ESP_OK);
+    CHECK(strcmp(hashed_body, expected_hash) == 0);
+
+    // The deferred field goes last
+    CHECK(strstr(body, "\"amount\":\"1234.56\"") != NULL);
+    CHECK(strstr(body, JSON_KEY("pinCode")) != NULL && strstr(body, "\"timeQuality\"") < strstr(body, JSON_KEY("pinCode")));
+
+    memset(&parsed, 0xa5, sizeof(parsed));
+    CHECK(pluto_payment_parse(body, body_len, &parsed) == ESP_OK);
+
+    CHECK(parsed.amount == payment.amount);
+    CHECK(strcmp(parsed.card_number, payment.card_number) == 0);
+    CHECK(memcmp(parsed.pin_code, payment.pin_code, sizeof(payment.pin_code)) == 0);
+    CHECK(strcmp(parsed.currency, payment.currency) == 0);
+    CHECK(parsed.date == payment.date);
+    CHECK(memcmp(parsed.nonce, payment.nonce, sizeof(payment.nonce)) == 0);
+    CHECK(strcmp(parsed.operation, payment.operation) == 0);
+    CHECK(strcmp(parsed.device_id, payment.device_id) == 0);
+    CHECK(strcmp(parsed.time_quality, payment.time_quality) == 0);
+}
+
+// Typing the pin between the two halves gives the same bytes as writing the payment in one go
+static void test_prepare_finish(void) {
+    pluto_payment_builder_t builder = {0};
+    char prepared[TEST_BODY_SIZE];
+    char whole[TEST_BODY_SIZE];
+    char prepared_hash[SHA256_OUT_BUF_SIZE];
+    char whole_hash[SHA256_OUT_BUF_SIZE];
+    size_t prepared_len = 0;
+    size_t whole_len = 0;
+    uint8_t pin_digest[SHA256_DIGEST_SIZE];
+
+    test_payment(&builder.payment);
+    memcpy(pin_digest, builder.payment.pin_code, sizeof(pin_digest));
+    memset(builder.payment.pin_code, 0, sizeof(builder.payment.pin_code));
+
+    CHECK(pluto_payment_finish(&builder, pin_digest, &prepared_len, prepared_hash) == ESP_ERR_INVALID_STATE);
+
+    CHECK(pluto_payment_prepare(&builder, prepared, sizeof(prepared)) == ESP_OK);
+    CHECK(builder.payment.date == TEST_NOW);
+    CHECK(strcmp(builder.payment.time_quality, "synced") == 0);
+    CHECK(pluto_payment_finish(&builder, pin_digest, &prepared_len, prepared_hash) == ESP_OK);
+
+    CHECK(pluto_payment_to_json(&builder.payment, whole, sizeof(whole), &whole_len, whole_hash) == ESP_OK);
+    CHECK(prepared_len == whole_len);
+    CHECK(memcmp(prepared, whole, whole_len) == 0);
+    CHECK(strcmp(prepared_hash, whole_hash) == 0);
+
+    // Nothing left to discard after finishing
+    pluto_payment_discard(&builder);
+    CHECK(!builder.prepared);
+}
+
+static void test_does_not_fit(void) {
+    pluto_payment payment;
+    char body[64];
+    char hashed_body[SHA256_OUT_BUF_SIZE];
+    size_t body_len = 0;
+
+    test_payment(&payment);
+
+    CHECK(pluto_payment_serialize(&payment, body, sizeof(body), &body_len, hashed_body) == ESP_ERR_INVALID_SIZE);
+    CHECK(body[0] == '\0');
+}
+
+static void test_parse_errors(void) {
+    pluto_payment payment;
+    pluto_payment parsed;
+    char body[TEST_BODY_SIZE];
+    char edited[TEST_BODY_SIZE + 32];
+    char hashed_body[SHA256_OUT_BUF_SIZE];
+    size_t body_len = 0;
+
+    test_payment(&payment);
+    CHECK(pluto_payment_serialize(&payment, body, sizeof(body), &body_len, hashed_body) == ESP_OK);
+
+    // Unknown keys are skipped
+    snprintf(edited, sizeof(edited), "{\"extra\":[1,2],%s", body + 1);
+    CHECK(pluto_payment_parse(edited, strlen(edited), &parsed) == ESP_OK);
+
+    // Missing field, the pin digest is the last one
+    char *pin = strstr(body, "," JSON_KEY("pinCode"));
+    CHECK(pin != NULL);
+    if (pin != NULL) {
+        snprintf(edited, sizeof(edited), "%.*s}", (int)(pin - body), body);
+        CHECK(pluto_payment_parse(edited, strlen(edited), &parsed) == ESP_ERR_NOT_FOUND);
+
+        // Digest one byte short
+        snprintf(edited, sizeof(edited), "%.*s%.*s\"}", (int)(pin - body), body, (int)(strlen(pin) - 4), pin);
+        CHECK(pluto_payment_parse(edited, strlen(edited), &parsed) == ESP_ERR_INVALID_ARG);
+    }
+
+    CHECK(pluto_payment_parse("[]", 2, &parsed) == ESP_ERR_INVALID_ARG);
+    CHECK(pluto_payment_parse(body, body_len - 1, &parsed) == ESP_ERR_INVALID_ARG);
+}
+
+static void test_cbor(void) {
+    pluto_payment payment;
+    uint8_t body[TEST_BODY_SIZE];
+    char hashed_body[SHA256_OUT_BUF_SIZE];
+    size_t body_len = 0;
+
+    test_payment(&payment);
+
+    CHECK(pluto_payment_to_cbor(&payment, (char*)body, sizeof(body), &body_len, hashed_body) == ESP_OK);
+    // Map of every field, first entry is field 0, the amount as an unsigned integer
+    CHECK(body[0] == (0xa0 | PAYMENT_FIELD_COUNT));
+    CHECK(body[1] == PAYMENT_FIELD_amount);
+    CHECK(body[2] == 0x1a && body[3] == 0x00 && body[4] == 0x01 && body[5] == 0xe2 && body[6] == 0x40);
+}
+
+int main(void) {
+    test_round_trip();
+    test_prepare_finish();
+    test_does_not_fit();
+    test_parse_errors();
+    test_cbor();
+
+    return TEST_RESULT();
+}
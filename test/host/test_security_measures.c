@@ -0,0 +1,60 @@
+/*
+    Known answers for the request signer. sec_signer_init runs RFC 4231 test case 2 through the
+    precomputed prefix state and fails if it does not match. The signatures below were computed
+    with Python's hmac module over the canonical string built from stubs/credentials.h.
+*/
+
+#include "security_measures.h"
+#include "test_host.h"
+
+#include <string.h>
+
+static void test_sha256(void) {
+    char hex[SHA256_OUT_BUF_SIZE];
+
+    // FIPS 180-2 example
+    CHECK(hash_sha256((const unsigned char*)"abc", 3, hex) == ESP_OK);
+    CHECK(strcmp(hex, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad") == 0);
+
+    CHECK(hash_sha256((const unsigned char*)"", 0, hex) == ESP_OK);
+    CHECK(strcmp(hex, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855") == 0);
+
+    CHECK(hash_sha256(NULL, 0, hex) == ESP_ERR_INVALID_ARG);
+}
+
+static void test_sign_before_init(void) {
+    char hmac[SHA256_OUT_BUF_SIZE];
+
+    CHECK(sec_sign_request("00", hmac) == ESP_ERR_INVALID_STATE);
+}
+
+static void test_sign_request(void) {
+    static const char body[] = "{\"amount\":\"12.50\"}";
+    static const char other_body[] = "{\"amount\":\"0.01\"}";
+    char hashed_body[SHA256_OUT_BUF_SIZE];
+    char hmac[SHA256_OUT_BUF_SIZE];
+
+    CHECK(sec_signer_init() == ESP_OK);
+    CHECK(sec_signer_init() == ESP_ERR_INVALID_STATE);
+
+    CHECK(hash_sha256((const unsigned char*)body, sizeof(body) - 1, hashed_body) == ESP_OK);
+    CHECK(strcmp(hashed_body, "b8a5fa3ead3a18272ad86f0a4881714cdfa0e918dd5f79de983e59a191f1ec93") == 0);
+    CHECK(sec_sign_request(hashed_body, hmac) == ESP_OK);
+    CHECK(strcmp(hmac, "f4deec03d3ca91cee7e65e8648258cfd77e66656e9b0afdf70f8fdd5a5e73771") == 0);
+
+    // Every signature starts again from the prefix state, the previous one leaves nothing behind
+    CHECK(hash_sha256((const unsigned char*)other_body, sizeof(other_body) - 1, hashed_body) == ESP_OK);
+    CHECK(sec_sign_request(hashed_body, hmac) == ESP_OK);
+    CHECK(strcmp(hmac, "6467fba9c167baa38f5e9f396e447413692748fb27d5726fe934da28f2cbec27") == 0);
+
+    CHECK(sec_sign_request("b8a5fa3ead3a18272ad86f0a4881714cdfa0e918dd5f79de983e59a191f1ec93", hmac) == ESP_OK);
+    CHECK(strcmp(hmac, "f4deec03d3ca91cee7e65e8648258cfd77e66656e9b0afdf70f8fdd5a5e73771") == 0);
+}
+
+int main(void) {
+    test_sha256();
+    test_sign_before_init();
+    test_sign_request();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,296 @@
+/*
+    Drives the fast reconnect in wifi_implementation.c through a mocked Wi-Fi driver and NVS.
+    The test plays the driver: it sends the events the driver would and checks the station
+    config and connects that come back, the profile kept in NVS and the states posted to the bus.
+*/
+
+#include "wifi_implementation.h"
+#include "wifi_profile.h"
+#include "credentials.h"
+#include "test_host.h"
+
+#include <string.h>
+
+#include "freertos/event_groups.h"
+#include "esp_event.h"
+#include "esp_wifi.h"
+#include "esp_netif.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+esp_event_base_t const WIFI_EVENT = "WIFI_EVENT";
+esp_event_base_t const IP_EVENT = "IP_EVENT";
+
+// MOCKED DRIVER
+static esp_event_handler_t handler;
+static wifi_sta_config_t sta_config;
+static int connects;
+static int64_t now_us;
+
+esp_err_t esp_netif_init(void) { return ESP_OK; }
+esp_netif_t *esp_netif_create_default_wifi_sta(void) { return (esp_netif_t*)&handler; }
+esp_err_t esp_event_loop_create_default(void) { return ESP_OK; }
+esp_err_t esp_wifi_init(const wifi_init_config_t *config) { return ESP_OK; }
+esp_err_t esp_wifi_deinit(void) { return ESP_OK; }
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode) { return ESP_OK; }
+esp_err_t esp_wifi_start(void) { return ESP_OK; }
+int64_t esp_timer_get_time(void) { return now_us; }
+
+esp_err_t esp_event_handler_register(esp_event_base_t event_base, int32_t event_id, esp_event_handler_t event_handler, void *arg) {
+    handler = event_handler;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf) {
+    sta_config = conf->sta;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_connect(void) {
+    connects++;
+    return ESP_OK;
+}
+
+// One event group is enough, only wifi_implementation.c creates one
+static EventBits_t event_bits;
+
+EventGroupHandle_t xEventGroupCreate(void) {
+    event_bits = 0;
+    return (EventGroupHandle_t)&event_bits;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    event_bits |= bits;
+    return event_bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    EventBits_t before = event_bits;
+    event_bits &= ~bits;
+    return before;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+    return event_bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks_to_wait) {
+    return event_bits;
+}
+
+// EVENT BUS
+static int states_posted;
+static bool last_state;
+
+bool event_bus_post(event_bus_handle_t bus, const pluto_event_handle_t *event) {
+    if (event->event_type == EV_WIFI) {
+        states_posted++;
+        last_state = event->wifi.isConnected;
+    }
+    return true;
+}
+
+// MOCKED NVS, holds the one blob wifi_profile uses
+static uint8_t nvs_blob[64];
+static size_t nvs_blob_len;
+static bool nvs_has_blob;
+static int nvs_writes;
+
+esp_err_t nvs_open(const char *namespace_name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle) {
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle) {}
+esp_err_t nvs_commit(nvs_handle_t handle) { return ESP_OK; }
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length) {
+    if (length > sizeof(nvs_blob)) return ESP_ERR_INVALID_SIZE;
+
+    memcpy(nvs_blob, value, length);
+    nvs_blob_len = length;
+    nvs_has_blob = true;
+    nvs_writes++;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length) {
+    if (!nvs_has_blob) return ESP_ERR_NVS_NOT_FOUND;
+    if (*length < nvs_blob_len) return ESP_ERR_INVALID_SIZE;
+
+    memcpy(out_value, nvs_blob, nvs_blob_len);
+    *length = nvs_blob_len;
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key) {
+    if (!nvs_has_blob) return ESP_ERR_NVS_NOT_FOUND;
+
+    nvs_has_blob = false;
+    return ESP_OK;
+}
+
+// DRIVER EVENTS
+static const uint8_t ap_first[6] = {0x02, 0x11, 0x22, 0x33, 0x44, 0x55};
+static const uint8_t ap_second[6] = {0x02, 0x66, 0x77, 0x88, 0x99, 0xaa};
+
+static void send_start(void) {
+    handler(NULL, WIFI_EVENT, WIFI_EVENT_STA_START, NULL);
+}
+
+static void send_connected(const uint8_t bssid[6], uint8_t channel) {
+    wifi_event_sta_connected_t event = {
+        .channel = channel
+    };
+    memcpy(event.bssid, bssid, sizeof(event.bssid));
+    handler(NULL, WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &event);
+}
+
+static void send_disconnected(uint8_t reason) {
+    wifi_event_sta_disconnected_t event = {
+        .reason = reason
+    };
+    handler(NULL, WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &event);
+}
+
+static void send_got_ip(void) {
+    ip_event_got_ip_t event = {
+        .ip_info.ip.addr = 0x0a00a8c0
+    };
+    handler(NULL, IP_EVENT, IP_EVENT_STA_GOT_IP, &event);
+}
+
+static bool config_is_directed(const uint8_t bssid[6], uint8_t channel) {
+    return sta_config.bssid_set && memcmp(sta_config.bssid, bssid, 6) == 0 &&
+           sta_config.channel == channel && sta_config.scan_method == WIFI_FAST_SCAN;
+}
+
+static bool config_is_full_scan(void) {
+    return !sta_config.bssid_set && sta_config.channel == 0 && sta_config.scan_method == WIFI_ALL_CHANNEL_SCAN;
+}
+
+static wifi_profile_t stored_profile(void) {
+    wifi_profile_t profile = {0};
+    memcpy(&profile, nvs_blob, sizeof(profile));
+    return profile;
+}
+
+// First boot, nothing stored: a normal scan, and the access point is saved once it gave an IP
+static void test_first_boot(void) {
+    CHECK(wifi_init(NULL) == ESP_OK);
+    // Driver default scan, not locked to any access point
+    CHECK(!sta_config.bssid_set && sta_config.channel == 0);
+    CHECK(strcmp((const char*)sta_config.ssid, WIFI_SSID) == 0);
+
+    send_start();
+    CHECK(connects == 1);
+
+    send_connected(ap_first, 6);
+    CHECK(nvs_writes == 0);
+
+    now_us += 3000000;
+    send_got_ip();
+    CHECK(wifi_is_connected());
+    CHECK(states_posted == 1 && last_state);
+    CHECK(nvs_writes == 1);
+
+    wifi_profile_t profile = stored_profile();
+    CHECK(profile.version == WIFI_PROFILE_VERSION);
+    CHECK(memcmp(profile.bssid, ap_first, 6) == 0);
+    CHECK(profile.channel == 6);
+    CHECK(strcmp(profile.ssid, WIFI_SSID) == 0);
+
+    // A lease renewal is not a new connection
+    send_got_ip();
+    CHECK(states_posted == 1);
+    CHECK(nvs_writes == 1);
+}
+
+// Losing the access point goes straight back to it, and to a full scan once it is gone
+static void test_reconnect_and_fall_back(void) {
+    int connects_before = connects;
+
+    send_disconnected(WIFI_REASON_ASSOC_LEAVE);
+    CHECK(!wifi_is_connected());
+    CHECK(states_posted == 2 && !last_state);
+    CHECK(config_is_directed(ap_first, 6));
+    CHECK(connects == connects_before + 1);
+
+    send_disconnected(WIFI_REASON_NO_AP_FOUND);
+    CHECK(config_is_full_scan());
+    CHECK(connects == connects_before + 2);
+    // Still disconnected, nothing new to post
+    CHECK(states_posted == 2);
+
+    // The scan finds another access point for the SSID, which replaces the saved one
+    send_connected(ap_second, 11);
+    send_got_ip();
+    CHECK(states_posted == 3 && last_state);
+    CHECK(nvs_writes == 2);
+    CHECK(memcmp(stored_profile().bssid, ap_second, 6) == 0);
+    CHECK(stored_profile().channel == 11);
+}
+
+// Boot with a saved profile: directed connect, the same access point again does not rewrite the flash
+static void test_boot_with_profile(void) {
+    int writes_before = nvs_writes;
+
+    CHECK(wifi_init(NULL) == ESP_OK);
+    CHECK(config_is_directed(ap_second, 11));
+
+    send_start();
+    send_connected(ap_second, 11);
+    send_got_ip();
+    CHECK(wifi_is_connected());
+    CHECK(nvs_writes == writes_before);
+}
+
+// Failures that are not about the access point being gone get WIFI_PROFILE_MAX_FAST_ATTEMPTS tries
+static void test_fall_back_after_attempts(void) {
+    send_disconnected(WIFI_REASON_ASSOC_LEAVE);
+    CHECK(config_is_directed(ap_second, 11));
+
+    for (int attempt = 1; attempt < WIFI_PROFILE_MAX_FAST_ATTEMPTS; attempt++) {
+        send_disconnected(WIFI_REASON_AUTH_FAIL);
+        CHECK(config_is_directed(ap_second, 11));
+    }
+
+    send_disconnected(WIFI_REASON_AUTH_FAIL);
+    CHECK(config_is_full_scan());
+}
+
+static void test_load(void) {
+    wifi_profile_t profile;
+    wifi_profile_t saved;
+    wifi_event_sta_connected_t event = {
+        .channel = 1
+    };
+    memcpy(event.bssid, ap_first, 6);
+
+    wifi_profile_from_event(WIFI_SSID, &event, &saved);
+    CHECK(wifi_profile_store(&saved) == ESP_OK);
+    CHECK(wifi_profile_load(WIFI_SSID, &profile) == ESP_OK);
+    CHECK(memcmp(&profile, &saved, sizeof(profile)) == 0);
+
+    // Saved for another network
+    CHECK(wifi_profile_load("other-network", &profile) == ESP_ERR_NOT_FOUND);
+
+    // Written by another firmware version
+    saved.version = WIFI_PROFILE_VERSION + 1;
+    CHECK(wifi_profile_store(&saved) == ESP_OK);
+    CHECK(wifi_profile_load(WIFI_SSID, &profile) == ESP_ERR_NOT_FOUND);
+
+    wifi_profile_clear();
+    CHECK(wifi_profile_load(WIFI_SSID, &profile) == ESP_ERR_NOT_FOUND);
+}
+
+int main(void) {
+    test_first_boot();
+    test_reconnect_and_fall_back();
+    test_boot_with_profile();
+    test_fall_back_after_attempts();
+    test_load();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+"""
+Stand-in for the Pluto payment server, for measuring full against resumed mTLS handshakes.
+
+    tools/standin_server.py certs            make a throwaway CA, server and device certificates
+    tools/standin_server.py serve            answer payments the way the backend does
+    tools/standin_server.py bench            time full and resumed handshakes from this host
+
+The server asks for a client certificate and issues session tickets like the backend. With
+--close it ends every session after one response, so each payment the device sends needs a
+new handshake and the "Connection established in .. ms (full|resumed)" lines and the session
+stats after each request show the difference on the device itself. Copy certs/ca-cert.pem,
+client-cert.pem and client-key.pem to main/certs/ and point SERVER_HOST at this machine.
+
+bench does the same handshakes from this host, useful as a baseline for the server's side.
+"""
+
+import argparse
+import http.server
+import json
+import os
+import socket
+import ssl
+import subprocess
+import sys
+import time
+
+CERT_DIR = "certs"
+TLS_VERSION = ssl.TLSVersion.TLSv1_2     # what esp-tls negotiates by default
+
+
+def make_certs(args):
+    os.makedirs(args.dir, exist_ok=True)
+
+    def openssl(*cmd):
+        subprocess.run(["openssl", *cmd], cwd=args.dir, check=True, capture_output=True)
+
+    openssl("req", "-x509", "-newkey", "ec", "-pkeyopt", "ec_paramgen_curve:prime256v1", "-nodes",
+            "-keyout", "ca-key.pem", "-out", "ca-cert.pem", "-days", "365", "-subj", "/CN=Pluto stand-in CA")
+
+    for name, cn in (("server", args.host), ("client", "pluto-device")):
+        openssl("req", "-newkey", "ec", "-pkeyopt", "ec_paramgen_curve:prime256v1", "-nodes",
+                "-keyout", f"{name}-key.pem", "-out", f"{name}.csr", "-subj", f"/CN={cn}")
+
+        ext = f"{name}.ext"
+        with open(os.path.join(args.dir, ext), "w") as f:
+            kind = "IP" if all(p.isdigit() for p in cn.split(".")) else "DNS"
+            f.write(f"subjectAltName={kind}:{cn}\n" if name == "server" else "extendedKeyUsage=clientAuth\n")
+
+        openssl("x509", "-req", "-in", f"{name}.csr", "-CA", "ca-cert.pem", "-CAkey", "ca-key.pem",
+                "-CAcreateserial", "-out", f"{name}-cert.pem", "-days", "365", "-extfile", ext)
+
+    print(f"Certificates written to {args.dir}/")
+
+
+def server_context(cert_dir):
+    ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    ctx.maximum_version = TLS_VERSION
+    ctx.verify_mode = ssl.CERT_REQUIRED
+    ctx.load_cert_chain(os.path.join(cert_dir, "server-cert.pem"), os.path.join(cert_dir, "server-key.pem"))
+    ctx.load_verify_locations(os.path.join(cert_dir, "ca-cert.pem"))
+    return ctx
+
+
+def serve(args):
+    close = args.close
+
+    class Handler(http.server.BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.1"
+
+        def do_POST(self):
+            self.rfile.read(int(self.headers.get("Content-Length", 0)))
+
+            body = json.dumps({
+                "resultCode": "approved",
+                "authorizationId": f"standin-{int(time.time() * 1000)}",
+                "displayMessage": "Stand-in",
+            }).encode()
+
+            self.send_response(200)
+            self.send_header("Content-Type", "application/json")
+            self.send_header("Content-Length", str(len(body)))
+            self.send_header("Connection", "close" if close else "keep-alive")
+            self.end_headers()
+            self.wfile.write(body)
+
+            resumed = self.connection.session_reused
+            print(f"{self.client_address[0]} payment answered, session {'resumed' if resumed else 'full'}")
+
+    httpd = http.server.HTTPServer(("", args.port), Handler)
+    httpd.socket = server_context(args.dir).wrap_socket(httpd.socket, server_side=True)
+    print(f"Listening on {args.port}, {'closing after every response' if close else 'keep-alive'}")
+    httpd.serve_forever()
+
+
+def bench(args):
+    ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+    ctx.maximum_version = TLS_VERSION
+    ctx.check_hostname = False
+    ctx.load_verify_locations(os.path.join(args.dir, "ca-cert.pem"))
+    ctx.load_cert_chain(os.path.join(args.dir, "client-cert.pem"), os.path.join(args.dir, "client-key.pem"))
+
+    def handshake(session):
+        sock = socket.create_connection((args.host, args.port))
+        start = time.perf_counter()
+        tls = ctx.wrap_socket(sock, session=session)
+        elapsed = time.perf_counter() - start
+        reused = tls.session_reused
+        session = tls.session
+        tls.close()
+        return elapsed, reused, session
+
+    _, _, session = handshake(None)
+    full = [handshake(None)[0] for _ in range(args.count)]
+
+    resumed = []
+    for _ in range(args.count):
+        elapsed, reused, session = handshake(session)
+        if not reused:
+            sys.exit("Server did not resume the session")
+        resumed.append(elapsed)
+
+    avg_full = sum(full) / len(full) * 1000
+    avg_resumed = sum(resumed) / len(resumed) * 1000
+    print(f"{args.count} handshakes each: full avg {avg_full:.2f} ms, resumed avg {avg_resumed:.2f} ms "
+          f"({avg_full / avg_resumed:.1f}x)")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--dir", default=CERT_DIR, help="certificate directory")
+    parser.add_argument("--port", type=int, default=443)
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    certs = sub.add_parser("certs")
+    certs.add_argument("--host", default="192.168.0.100", help="SERVER_HOST the device connects to")
+
+    srv = sub.add_parser("serve")
+    srv.add_argument("--close", action="store_true", help="new session for every payment")
+
+    bch = sub.add_parser("bench")
+    bch.add_argument("--host", default="127.0.0.1")
+    bch.add_argument("--count", type=int, default=50)
+
+    args = parser.parse_args()
+    {"certs": make_certs, "serve": serve, "bench": bench}[args.command](args)
+
+
+if __name__ == "__main__":
+    main()